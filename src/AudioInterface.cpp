@@ -32,89 +32,49 @@
 
 #include "AudioInterface.h"
 
-uint16_t c_buff::put(uint32_t * data, uint16_t len)
-{  // consider overrun if nw is len bytes above nr + mbuf
-  if( (nw+len) > (nr+mbuf)) return 0;
-  //
-  for(int ii=0; ii<len; ii++) buffer[(nw+ii) % mbuf] = data[ii];
-  nw += len;
-  return len;
-}
-
-//
-int16_t *c_buff::get(uint16_t len)
-{ if(nr+len > nw) return 0;
-
-  int16_t *ptr = (int16_t *) &buffer[nr % mbuf];
-  nr += len;
-  return ptr;
-}
-
 /************************ AudioInterface **************************************************************/
 //
+#define USB_FRAME_SAMPLES 441   // samples per 10 USB frames (44.1 kHz)
+#define USB_DUE_MAX (4*10*AUDIO_BLOCK_SAMPLES) // host stalled, do not burst
 
 void AudioInterface::init(c_buff *store, int fsamp)
 { 	audioStore = store;
-	jfs1=fsamp;
-	jfs2=44100;
-
-	// remove tailing zeros
-	while( ((jfs1 % 10) ==0) && ((jfs2 % 10))==0) { jfs1 /= 10; jfs2 /= 10; } 
-	jfs1 *= 10; jfs2 *= 10;
-	//
-	n_src=(uint16_t)((AUDIO_BLOCK_SAMPLES*jfs1)/jfs2); // number od samples in src_buffer
-	//
-	sc = (float) (n_src) / (float) (AUDIO_BLOCK_SAMPLES);	
+	rs.init(fsamp, 44100);
+	due = 0;
+	running = 0;
 }
 
-void AudioInterface::interpolate(int16_t *dst, const int16_t *src)
-{
-
-	for(int ii=0; ii<AUDIO_BLOCK_SAMPLES; ii++) dst[ii]=0;
-	for(int ii=0; ii<AUDIO_BLOCK_SAMPLES; ii++)
-	{	
-		uint32_t j0;
-		float tx;
-		
-		tx = ii*sc;
-		// index into original
-		j0 = (uint32_t)tx;
-		// handle boundary
-		if(j0 == 0) j0 =1;
-		if(j0 == (n_src-1)) j0=n_src-2;
-		
-		// distance to index 
-		dx1 = 0*(tx - (float)j0);
-		dst[ii] = src[2*j0]
-					+ ((src[2*j0+2] - src[2*j0-2])/2)*dx1
-					+ (((src[2*j0+2] - src[2*j0]) - (src[2*j0] - src[2*j0-2]))/4)*dx1*dx1;
-	}
+uint16_t AudioInterface::usbFrame(void)
+{	// 11 bit frame number, incremented by each start of frame (1 kHz, host clock)
+	uint8_t hi, lo;
+	do { hi = USB0_FRMNUMH; lo = USB0_FRMNUML; } while(hi != USB0_FRMNUMH);
+	return ((hi & 7) << 8) | lo;
 }
 
 void AudioInterface::update(void)
-{	const int16_t *src;
-	int16_t *dst;
-	audio_block_t *left, *right;
-	int16_t *src_buffer;
+{	audio_block_t *left, *right;
 	//
-	src_buffer = audioStore->get(n_src);
-	if(!src_buffer) { return; }
+	uint16_t fn = usbFrame();
+	uint16_t df = (fn - frame) & 0x7ff;
+	frame = fn;
+	if(!running) { running = 1; due = 0; return; } // frame was not yet known
+	due += df*USB_FRAME_SAMPLES;
+	if(due > USB_DUE_MAX) due = USB_DUE_MAX;
+	if(due < 10*AUDIO_BLOCK_SAMPLES) return;
+	due -= 10*AUDIO_BLOCK_SAMPLES; // USB plays this block, delivered or not
 	
 	left = allocate();  if (!left) return;
-	right = allocate(); if (!right) return;
-	
-	src = &src_buffer[0];
-	dst = left->data;
-	//
-	interpolate(dst, src);
-	
-	src = &src_buffer[1];
-	dst = right->data;
-	//
-	interpolate(dst, src);
+	right = allocate(); if (!right) { release(left); return; }
 	
-	transmit(left,0);
-	transmit(right,1);
+	if(prof) prof->start();
+	int ok = rs.process(audioStore, left->data, right->data, AUDIO_BLOCK_SAMPLES, due/10);
+	if(prof) prof->stop();
+	if(ok)
+	{ transmit(left,0);
+	  transmit(right,1);
+	}
 	release(left);
 	release(right);
+	// USB takes one block per update: while another one is due, run the update again
+	if(due >= 10*AUDIO_BLOCK_SAMPLES) AudioStream::update_all();
 }
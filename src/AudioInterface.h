@@ -34,39 +34,37 @@
 //#include "usb_audio.h"
 #include <Arduino.h>
 #include "AudioStream.h"
-
-class c_buff
-{
-	uint32_t nw; 	// write index
-	uint32_t nr;	// read index
-	uint32_t * buffer;
-	uint32_t mbuf;	// buffer length
-public:
-	//
-	c_buff(uint32_t *data, uint32_t len) 
-	{	buffer=data; mbuf=len; nw=0; nr=0; for(int ii=0; ii<mbuf; ii++) buffer[ii]=0; };
-	uint16_t put(uint32_t * data, uint16_t len);
-	int16_t *get(uint16_t len);
-	uint16_t get_top() {return nw;}
-	uint16_t get_bot() {return nr;}
-};
+#include "resample.h"   // c_buff and c_resample
+#include "profile.h"
 
 /************************ AudioInterface **************************************************************/
 //
+// resamples the stereo frames of audioStore (I2S rate) to the 44.1 kHz of USB audio
+// update() is called with every I2S interrupt, but delivers a block only when USB
+// has taken 128 samples since the last one (9 frames of 44 and one of 45 samples
+// per 10 ms, counted from the USB frame number); so the resampler reads audioStore
+// at the pace of the host clock and its ratio follows the latency (resample.h)
+// USB takes one block per update, so while another block is due (fsamp below 44.1 kHz,
+// or a late interrupt) the update is pended again
+//
 class AudioInterface : public AudioStream
 {
 public:
 	AudioInterface(c_buff * store, int fsamp) : AudioStream(0, NULL) { init(store, fsamp);}
+	void init(c_buff * store, int fsamp);
 	virtual void update(void);
+	int32_t ppm(void) { return rs.ppm(); } // ratio correction
+	uint32_t underrun(void) { return rs.underrun; }
+	void profile(c_profile *p) { prof = p; } // measures the resampler (0: none)
 private:
-	float sc, dx1;
-
+	c_profile * prof = 0;
 	c_buff * audioStore;
-	int32_t jfs1, jfs2;
-	int32_t n_src;
+	c_resample rs;
+	uint16_t frame;   // last USB frame number
+	uint32_t due;     // samples taken by USB and not yet delivered (x10)
+	int16_t running;  // frame is valid
 	//
-	void init(c_buff * store, int fsamp);
-	void interpolate(int16_t *dst, const int16_t *src);
+	uint16_t usbFrame(void);
 };
 
 #endif
@@ -31,6 +31,7 @@
 #include "core_pins.h"
 
 #include "i2s.h"
+#include "i2sdiv.h"
 #include "dma.h"
 
 //#define HAVE_HW_SERIAL
@@ -138,18 +139,13 @@ float i2s_speedConfig(int device, int nbits, int fs)
 	}
 	
 	else
-  {
-    i3=2;
-    float A=F_CPU/2.0f/i3/(2.0f*nbits*fs);
-    float mn=1.0; 
-    for(int ii=1;ii<32;ii++) 
-    { float xx;
-      xx=A*ii-(int32_t)(A*ii); 
-      if(xx<mn && A*ii<256.0) { mn=xx; i1=ii; i2=A*ii;} //select first candidate
-    }
-    iscl[0] = (int) (i1-1);
-    iscl[1] = (int) (i2-1);
-    iscl[2] = (int) (i3-1);
+  { // exact integer search (i2sdiv.h)
+    i2s_div_s div = i2sDivSolve(i2sClockSource(F_CPU), nbits, fs);
+    if(div.ppm == I2SDIV_NONE) return 0.0f;
+    iscl[0] = div.fract;
+    iscl[1] = div.divide;
+    iscl[2] = div.div;
+    return (float) div.fs;
   }
 	return F_CPU * (float)(i1) / (float)(i2) / 2.0f / (float)(i3) / (2.0f*nbits); // is sampling frequency
 }
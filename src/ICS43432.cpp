@@ -9,6 +9,7 @@
 // general (WMXZ) core library
 #include "dma.h"
 #include "I2S.h"
+#include "i2sdiv.h"
 //
 // local class definition
 #include "ICS43432.h"
@@ -32,8 +33,11 @@ uint32_t c_ICS43432::init(int32_t fsamp, int32_t *buffer, uint32_t nbuf, uint16_
 {
   i2s_init();
   
-  float fs = i2s_speedConfig(ICS43432_DEV,N_BITS, fsamp);
-  if(fs<1.0f) return 0;
+  // exact dividers (table of F_CPU or solved), refuse rates that are off by more than ICS_MAX_PPM
+  i2s_div_s div = i2sDivLookup<N_BITS>(fsamp);
+  fs = div.fs; ppm = div.ppm;
+  if(div.ppm > ICS_MAX_PPM || div.ppm < -ICS_MAX_PPM) return 0;
+  iscl[0] = div.fract; iscl[1] = div.divide; iscl[2] = div.div;
 
   if(nch>2)  
   	i2s_config(1, N_BITS, I2S_RX_2CH, 0); // both RX channels
@@ -43,7 +47,7 @@ uint32_t c_ICS43432::init(int32_t fsamp, int32_t *buffer, uint32_t nbuf, uint16_
 
   DMA_init();
   i2s_setupInput(buffer,nbuf,2,5); //port, prio (8=normal)
-  return (uint32_t) fs;
+  return (uint32_t) (fs + 0.5);
 }
 
 void c_ICS43432::start(void)
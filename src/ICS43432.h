@@ -5,6 +5,7 @@
 #define ICS43432_H
 
 #define N_BITS 32
+#define ICS_MAX_PPM 1000 // largest error of sampling rate
 
 class c_ICS43432
 {
@@ -13,6 +14,8 @@ class c_ICS43432
   void start(void);
   void stop(void);
   void exit(void);
+  double fs = 0;  // sampling rate set by init (exact)
+  double ppm = 0; // its error
 };
 
 #endif
@@ -0,0 +1,330 @@
+/* wmxzAudio Library for Teensy 3.X
+ * Copyright (c) 2017, Walter Zimmer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice, development funding notice, and this permission
+ * notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+// binfile.h
+// layout of the .bin files written by Logger
+// shared between firmware and (linux) host tools, so no teensy includes here
+//
+// a file is a 512 byte header_s followed by data blocks of nch*nsamp samples
+// records (e.g. gap markers) are written in-band and occupy one data block
+// they start with a magic word and its complement; in FMT_INT32 data this pair cannot
+// occur (upper byte of a sign extended 24 bit sample is always 0x00 or 0xFF), but
+// FMT_INT16 and FMT_PACK24 payload can form it (any two or four samples are possible)
+// so records are only recognised at block boundaries: readers step through the data
+// block by block (or frame by frame for FMT_RICE, where records are RICE_RAW frames)
+// or follow the index, and never scan for a magic word; a data block that happens to
+// start with a magic pair is still misread, which is unlikely (8 given bytes) but not
+// impossible for 16 and 24 bit formats
+
+#ifndef BINFILE_H
+#define BINFILE_H
+
+#include <stdint.h>
+
+// header_s.flags
+#define HDR_GAPS  1  // stream may contain gap records
+#define HDR_INDEX 2  // stream contains block index records
+#define HDR_STATS 4  // file ends with statistics record
+#define HDR_TRACE 8  // stream contains write latency trace records
+#define HDR_RATE 16  // file ends with measured rate record, header has rate fields
+
+// header_s.fmt (sample format)
+#define FMT_INT32  0  // 32 bit words
+#define FMT_INT16  1  // 16 bit words
+#define FMT_PACK24 2  // 24 bit samples packed into 3 bytes (little endian)
+#define FMT_RICE   3  // 32 bit samples, rice coded frames (rice.h), one frame per block
+
+typedef struct
+{
+  uint32_t rtc;
+  uint32_t t0;
+  uint32_t nch;
+  uint32_t fsamp;
+  uint32_t fsize;
+  uint32_t nsamp;
+  uint32_t hsize;
+  uint32_t nclst;
+  uint32_t flags;
+  uint32_t fmt;
+  uint32_t block;   // first block of file since logger start (as gap_s.block)
+  uint32_t npoint;  // RTC stamps in measured rate (0: not yet measured)
+  double rate;      // measured sampling rate since logger start (Hz)
+  double tfirst;    // RTC time of first sample (s since 1970, 0 if not measured)
+  float ppm;        // (rate/fsamp - 1)*1e6
+  float drift;      // ppm per hour (as rate_s.drift)
+  uint32_t fill[128-18];
+} header_s;
+
+/*
+ * gap record
+ * replaces the first of ndrop blocks the Logger had to drop on overrun
+ * (or did not write in trigger mode, as there was no detection)
+ * block is the index of the first dropped block since logger start
+ * sample is the corresponding sample index (per channel)
+ */
+#define GAP_MAGIC 0x5047534Du // "MSGP"
+#define GAP_OVERRUN 0  // gap_s.cause
+#define GAP_IDLE    1
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t nmagic;  // ~magic
+  uint32_t ndrop;   // number of dropped blocks
+  uint32_t block;   // index of first dropped block
+  uint64_t sample;  // index of first dropped sample
+  uint32_t cause;   // GAP_OVERRUN or GAP_IDLE
+  uint32_t res;
+} gap_s;
+
+static inline int isGap(const void *ptr)
+{ const uint32_t *w = (const uint32_t *) ptr;
+  return (w[0] == GAP_MAGIC) && (w[1] == (uint32_t) ~GAP_MAGIC);
+}
+
+/*
+ * block index record
+ * written after every chunk that fills the record (one chunk is one write of
+ * Logger's buffer) and at file close
+ * each entry describes the first block of a chunk as seen by the ISR:
+ * seq is the block index since logger start (as in gap_s.block),
+ * rxcount the I2S DMA interrupt count and cycles the cpu cycle counter
+ * when the block was queued
+ * the record is followed by zeros up to the block size
+ */
+#define IDX_MAGIC 0x5849534Du // "MSIX"
+
+typedef struct
+{
+  uint32_t seq;     // index of first block in chunk
+  uint32_t rxcount; // I2S interrupt count
+  uint32_t cycles;  // cycle counter
+  uint32_t nblk;    // number of blocks in chunk
+} idx_entry_s;
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t nmagic;  // ~magic
+  uint32_t nent;    // number of entries following
+  uint32_t res;
+} idx_s;
+
+static inline int isIndex(const void *ptr)
+{ const uint32_t *w = (const uint32_t *) ptr;
+  return (w[0] == IDX_MAGIC) && (w[1] == (uint32_t) ~IDX_MAGIC);
+}
+
+/*
+ * statistics record
+ * written at file close, describes writing of this file
+ * hist[ii] counts buffer writes that took 2^ii to 2^(ii+1) us (hist[0] also < 1 us)
+ * queueMax is the largest number of queued blocks (head - tail) seen by the ISR
+ * rotateDepth is the largest number of queued blocks from file start until
+ * the queue was first drained (i.e. around file rotation)
+ * busy counts I2S interrupts that found previous processing still running
+ */
+#define STAT_MAGIC 0x5453534Du // "MSST"
+#define STAT_NHIST 24
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t nmagic;      // ~magic
+  uint32_t nwrite;      // number of buffer writes
+  uint32_t wbytes;      // bytes per buffer write (before compression)
+  uint32_t maxLatency;  // us
+  uint32_t sumLatency;  // us
+  uint32_t queueSize;   // number of blocks in queue
+  uint32_t queueMax;
+  uint32_t rotateDepth;
+  uint32_t overrun;     // dropped blocks
+  uint32_t busy;
+  uint32_t res;
+  uint32_t hist[STAT_NHIST];
+} stat_s;
+
+static inline int isStat(const void *ptr)
+{ const uint32_t *w = (const uint32_t *) ptr;
+  return (w[0] == STAT_MAGIC) && (w[1] == (uint32_t) ~STAT_MAGIC);
+}
+
+/*
+ * write latency trace record
+ * one entry per card operation of the logger, in the order they were done,
+ * written when the record is full and at file close (before the statistics record)
+ * an entry holds the duration in us (bits 0..23, saturating) and the number
+ * of written 512 byte sectors (bits 24..31, rounded up, saturating);
+ * zero sectors mark file operations (open, pre-allocate, close)
+ * the record is followed by zeros up to the block size
+ * a trace file (.trc, see tools/esmtrace) is a trace_s header with nent
+ * of all entries, followed by the entries
+ */
+#define TRACE_MAGIC 0x5254534Du // "MSTR"
+#define TRACE_MAXUS 0xffffff
+#define TRACE_ENTRY(us, nbytes) (((us) > TRACE_MAXUS? TRACE_MAXUS : (us)) | \
+                         ((((nbytes)+511)/512 > 255? 255 : ((nbytes)+511)/512) << 24))
+#define TRACE_US(ent) ((ent) & TRACE_MAXUS)
+#define TRACE_SECTORS(ent) ((ent) >> 24)
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t nmagic;  // ~magic
+  uint32_t nent;    // number of entries following
+  uint32_t res;
+} trace_s;
+
+static inline int isTrace(const void *ptr)
+{ const uint32_t *w = (const uint32_t *) ptr;
+  return (w[0] == TRACE_MAGIC) && (w[1] == (uint32_t) ~TRACE_MAGIC);
+}
+
+/*
+ * measured rate record
+ * written at file close (before the statistics record)
+ * the logger stamps once per RTC second the number of samples received since
+ * logger start with the RTC time (seconds and 32768 Hz prescaler) and fits a line
+ * through the stamps; the rate is that of the RTC crystal, the time of a sample is
+ * when its block reached the ISR (ISR latency and decimation filter delay included)
+ * the file fit uses the stamps taken while the file was written, the run fit
+ * all stamps since logger start (as in the header of the next file)
+ * drift is the change of ppm between the last two windows of RATE_WINDOW seconds
+ * of stamps (rate.h) divided by the time between their centres, independent of
+ * the file length (0 until two windows are complete)
+ */
+#define RATE_MAGIC 0x5452534Du // "MSRT"
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t nmagic;  // ~magic
+  uint32_t npoint;  // RTC stamps in file fit
+  uint32_t block;   // first block of file (as header_s.block)
+  double rate;      // measured sampling rate (Hz)
+  double tfirst;    // RTC time of first sample of file (s since 1970)
+  float ppm;        // (rate/fsamp - 1)*1e6
+  float drift;      // ppm per hour
+  float rms;        // rms residual of fit (us)
+  float span;       // time between first and last stamp (s)
+  double runRate;   // run fit
+  float runPpm;
+  uint32_t runPoint;
+} rate_s;
+
+static inline int isRate(const void *ptr)
+{ const uint32_t *w = (const uint32_t *) ptr;
+  return (w[0] == RATE_MAGIC) && (w[1] == (uint32_t) ~RATE_MAGIC);
+}
+
+// any in-band record
+static inline int isRecord(const void *ptr)
+{ return isGap(ptr) || isIndex(ptr) || isStat(ptr) || isTrace(ptr) || isRate(ptr);
+}
+
+/*
+ * long-term spectral average file (.lts, see ltsa.h)
+ * a ltsa_header_s followed by records of a ltsa_rec_s and nbin levels (one byte each),
+ * level l of bin k (k*fsamp/nfft Hz) is dbMin + l*dbStep (dB re full scale sine)
+ * records are appended, one file per day
+ */
+#define LTSA_MAGIC  0x544C534Du // "MSLT"
+#define LTSA_DBMIN  (-127.5f)
+#define LTSA_DBSTEP 0.5f
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t nmagic;  // ~magic
+  uint32_t fsamp;
+  uint32_t nfft;
+  uint32_t nbin;    // levels per record
+  uint32_t nframe;  // FFT frames per record
+  float dbMin;
+  float dbStep;
+  uint32_t fill[8];
+} ltsa_header_s;
+
+typedef struct
+{
+  uint32_t rtc;     // end of average (s since 1970)
+  uint16_t nframe;  // frames in average
+  uint16_t nlost;   // frames lost (loop() too late)
+} ltsa_rec_s;
+
+/*
+ * sound level file (.spl, see spl.h)
+ * a spl_header_s followed by records of a spl_rec_s and nch spl_chan_s,
+ * levels are in 0.01 dB re full scale sine (rms) or full scale (peak)
+ * records are appended, one file per day
+ */
+#define SPL_MAGIC 0x5053534Du // "MSSP"
+#define SPL_MIN   (-32768)    // level of silence
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t nmagic;  // ~magic
+  uint32_t fsamp;
+  uint32_t nch;
+  uint32_t nsamp;   // samples per block
+  uint32_t nblock;  // blocks per record
+  uint32_t fill[10];
+} spl_header_s;
+
+typedef struct
+{
+  uint32_t rtc;     // end of record (s since 1970)
+  uint16_t nblock;  // blocks in record
+  uint16_t nlost;   // records lost before this one (loop() too late)
+} spl_rec_s;
+
+typedef struct
+{
+  int16_t leq;      // rms over record
+  int16_t lmax;     // rms of loudest block
+  int16_t lmin;     // rms of quietest block
+  int16_t peak;     // largest sample
+  uint16_t nclip;   // samples at full scale
+  uint16_t fill;
+} spl_chan_s;
+
+/*
+ * sample format helpers
+ */
+static inline uint32_t sampleBytes(uint32_t fmt)
+{ return (fmt == FMT_PACK24)? 3 : (fmt == FMT_INT16)? 2 : 4;
+}
+
+// bytes per data block
+static inline uint32_t blockBytes(const header_s *hdr)
+{ return hdr->nch*hdr->nsamp*sampleBytes(hdr->fmt);
+}
+
+// 24 bit packed to 32 bit (sign extended); n must be multiple of 4
+static inline void unpack24(int32_t *dst, const uint8_t *src, uint32_t n)
+{ for(uint32_t ii=0; ii<n; ii++)
+  { dst[ii] = (int32_t)(((uint32_t)src[0] << 8) | ((uint32_t)src[1] << 16) | ((uint32_t)src[2] << 24)) >> 8;
+    src += 3;
+  }
+}
+
+#endif
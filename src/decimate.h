@@ -0,0 +1,124 @@
+/* wmxzAudio Library for Teensy 3.X
+ * Copyright (c) 2017, Walter Zimmer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice, development funding notice, and this permission
+ * notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+// decimate.h
+// integer decimation (2..8) with polyphase FIR low-pass filter
+// no teensy includes here, so it also builds on host
+//
+// only every m-th output of the FIR is computed, i.e. each output uses one
+// polyphase branch per input phase, which is the same as running the m
+// branches of ntpp taps on the m input phases and summing
+// coefficients are Q31, accumulation is 64 bit (SMLAL on Cortex-M4)
+// filter: windowed sinc (Blackman), 6 dB point at output Nyquist frequency,
+// flat to about 0.4 fs_out for ntpp=32; only the transition band aliases
+// delay line and phase are kept between calls, so blocks may have any size
+//
+#ifndef DECIMATE_H
+#define DECIMATE_H
+
+#include <stdint.h>
+#include <math.h>
+
+/*
+ * nch  number of channels
+ * ntpp number of taps per polyphase branch (filter length is ntpp*m)
+ */
+template <int nch, int ntpp>
+class Decimator
+{
+public:
+  enum { MMAX = 8, NTAP = ntpp*MMAX };
+
+  Decimator(void) : m(1), ntap(1), pos(0), phase(0) { coef[0] = 0x7fffffff; }
+
+  int init(int mfac);
+  int factor(void) { return m; }
+  /*
+   * src:  input samples, channel ich at src[ich], next sample at src[step]
+   * dst:  nch interleaved output samples
+   * nsamp number of input samples
+   * returns number of output samples (per channel)
+   */
+  int process(int32_t *dst, const int32_t *src, int nsamp, int step);
+
+private:
+  int m, ntap;
+  int pos;    // write index into delay line
+  int phase;  // input samples since last output
+  int32_t coef[NTAP];
+  int32_t hist[nch][2*NTAP]; // delay line, written twice so that window is contiguous
+};
+
+template <int nch, int ntpp>
+int Decimator<nch,ntpp>::init(int mfac)
+{
+  if(mfac < 1 || mfac > MMAX) return 0;
+  m = mfac;
+  ntap = ntpp*m;
+  pos = 0;
+  phase = 0;
+  for(int ich=0; ich<nch; ich++) for(int ii=0; ii<2*NTAP; ii++) hist[ich][ii] = 0;
+
+  if(m == 1) { ntap = 1; coef[0] = 0x7fffffff; return 1; }
+
+  // windowed sinc with cutoff at 0.5/m (relative to input rate)
+  float h[NTAP];
+  float sum = 0.0f;
+  float fc = 0.5f/m;
+  for(int ii=0; ii<ntap; ii++)
+  { float x = ii - 0.5f*(ntap-1);
+    float s = (x == 0.0f)? 2.0f*fc : sinf(2.0f*(float)M_PI*fc*x)/((float)M_PI*x);
+    float w = 0.42f - 0.5f*cosf(2.0f*(float)M_PI*ii/(ntap-1)) + 0.08f*cosf(4.0f*(float)M_PI*ii/(ntap-1));
+    h[ii] = s*w;
+    sum += h[ii];
+  }
+  // normalize to unity gain at DC; store reversed for convolution
+  for(int ii=0; ii<ntap; ii++)
+    coef[ntap-1-ii] = (int32_t) lrintf(h[ii]/sum * 2147483647.0f * 0.999f);
+  return 1;
+}
+
+template <int nch, int ntpp>
+int Decimator<nch,ntpp>::process(int32_t *dst, const int32_t *src, int nsamp, int step)
+{
+  int nout = 0;
+  for(int ii=0; ii<nsamp; ii++, src += step)
+  {
+    for(int ich=0; ich<nch; ich++)
+    { hist[ich][pos] = hist[ich][pos+ntap] = src[ich];
+    }
+    if(++pos >= ntap) pos = 0;
+    if(++phase < m) continue;
+    phase = 0;
+
+    // window of last ntap samples, oldest first
+    for(int ich=0; ich<nch; ich++)
+    { const int32_t *x = &hist[ich][pos];
+      int64_t acc = 0;
+      for(int kk=0; kk<ntap; kk++) acc += (int64_t) coef[kk] * x[kk];
+      *dst++ = (int32_t)(acc >> 31);
+    }
+    nout++;
+  }
+  return nout;
+}
+
+#endif
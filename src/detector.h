@@ -0,0 +1,112 @@
+/* wmxzAudio Library for Teensy 3.X
+ * Copyright (c) 2017, Walter Zimmer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice, development funding notice, and this permission
+ * notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+// detector.h
+// band energy detector for event triggered recording
+// no teensy includes here, so it also builds on host (tools/esmdetect)
+//
+// a biquad band-pass (flo..fhi) filters one channel, the mean power of each block
+// is compared with a slowly adapting noise floor (exponential average with time
+// constant tau); a block is a detection if its power exceeds the floor by snr dB
+// the floor adapts 16 times slower during detections, so that a long event
+// does not raise it quickly, but a permanent change of noise level is followed
+// single precision float (FPU of Cortex-M4F), about 6 operations per sample
+//
+#ifndef DETECTOR_H
+#define DETECTOR_H
+
+#include <stdint.h>
+#include <math.h>
+#include "store.h" // msbCorrect
+
+/*
+ * raw 1 if input is uncorrected ICS43432 data (MSB correction is done here)
+ */
+template <int raw>
+class Detector
+{
+public:
+  Detector(void) { init(44100, 128, 2000, 8000, 12, 10); }
+
+  /*
+   * fsamp  sampling frequency of input
+   * nsamp  samples per block
+   * flo,fhi band of interest (Hz)
+   * snr    detection threshold above noise floor (dB)
+   * tau    time constant of noise floor (s)
+   */
+  void init(float fsamp, int nsamp, float flo, float fhi, float snr, float tau)
+  { // band-pass (constant 0 dB peak gain), centered geometrically
+    float f0 = sqrtf(flo*fhi);
+    float q = f0/(fhi-flo);
+    float w0 = 2.0f*(float)M_PI*f0/fsamp;
+    float alpha = sinf(w0)/(2.0f*q);
+    float a0 = 1.0f + alpha;
+    b0 = alpha/a0;
+    a1 = -2.0f*cosf(w0)/a0;
+    a2 = (1.0f - alpha)/a0;
+    x1 = x2 = y1 = y2 = 0;
+    //
+    thresh = powf(10.0f, snr/10.0f);
+    float tblk = nsamp/fsamp;
+    adapt = tblk/tau; if(adapt > 1.0f) adapt = 1.0f;
+    warm = (uint32_t)(0.5f*tau/tblk) + 1; // blocks before first detection
+    noiseFloor = 0; power = 0;
+    nblock = ndetect = 0;
+  }
+
+  /*
+   * src   input samples, next sample at src[step]
+   * returns 1 if block is a detection
+   */
+  int16_t process(const int32_t *src, int nsamp, int step)
+  { float e = 0;
+    for(int ii=0; ii<nsamp; ii++)
+    { int32_t v = src[ii*step];
+      if(raw) v = msbCorrect(v);
+      float x = (float) v;
+      float y = b0*(x - x2) - a1*y1 - a2*y2;
+      x2 = x1; x1 = x;
+      y2 = y1; y1 = y;
+      e += y*y;
+    }
+    power = e/nsamp;
+    nblock++;
+    if(nblock == 1) noiseFloor = power;
+    int16_t det = (nblock > warm) && (power > thresh*noiseFloor);
+    noiseFloor += (det? adapt/16 : adapt)*(power - noiseFloor);
+    if(det) ndetect++;
+    return det;
+  }
+
+  float level(void) { return power; }       // power of last block
+  float noise(void) { return noiseFloor; }  // noise floor
+  uint32_t detections(void) { return ndetect; }
+
+private:
+  float b0, a1, a2;         // band-pass (b1=0, b2=-b0)
+  float x1, x2, y1, y2;     // filter state
+  float thresh, adapt;
+  float noiseFloor, power;
+  uint32_t warm, nblock, ndetect;
+};
+
+#endif
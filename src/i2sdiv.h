@@ -0,0 +1,125 @@
+/*
+ * WMXZ Teensy core library
+ * Copyright (c) 2017 Walter Zimmer.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+//i2sdiv.h
+// I2S clock dividers (master mode)
+//
+//  MCLK  = fsrc*(FRACT+1)/(DIVIDE+1)  FRACT 0..255, DIVIDE 0..4095, FRACT <= DIVIDE
+//  BCLK  = MCLK/2/(DIV+1)             DIV 0..255
+//  LRCLK = BCLK/(2*nbits)             two words per frame
+//
+// i2sDivSolve tries every FRACT and DIV (with the nearest DIVIDE) in integers and
+// keeps the smallest error; of equal errors the smallest FRACT (FRACT 0 is an
+// integer divider without fractional jitter) and then the smallest DIV
+// the source is the PLL (or system clock), which is F_CPU, except for 24 and 48 MHz
+// where the PLL runs at 96 MHz
+//
+// the solver is plain C (used by I2S.c) and constexpr in C++: i2sDivTable holds
+// the dividers of the standard rates for F_CPU at compile time, i2sDivLookup solves
+// other rates at run time (65536 steps, some ms)
+//
+// tools/esmi2sdiv sweeps all rates against all F_CPU and lists the exact ones
+//
+#ifndef I2SDIV_H
+#define I2SDIV_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+  #define I2SDIV_FN constexpr
+#else
+  #define I2SDIV_FN static inline
+#endif
+
+#define I2SDIV_NONE 1e9 // ppm of no solution
+
+typedef struct
+{
+  uint16_t fract;   // FRACT of I2S_MDR
+  uint16_t divide;  // DIVIDE of I2S_MDR
+  uint16_t div;     // DIV of I2S_RCR2/I2S_TCR2
+  uint16_t exact;   // rate is exact
+  double fs;        // resulting rate
+  double ppm;       // error of rate (I2SDIV_NONE if there is no solution)
+} i2s_div_s;
+
+I2SDIV_FN uint32_t i2sClockSource(uint32_t fcpu)
+{ return (fcpu == 24000000 || fcpu == 48000000)? 96000000 : fcpu;
+}
+
+I2SDIV_FN i2s_div_s i2sDivSolve(uint32_t fsrc, int nbits, uint32_t fs)
+{ i2s_div_s best = {0, 0, 0, 0, 0.0, I2SDIV_NONE};
+  double bestErr = 2.0;
+  if(!fs || !fsrc) return best;
+  for(uint32_t f1 = 1; f1 <= 256; f1++)
+  { uint64_t num = (uint64_t) fsrc*f1;
+    for(uint32_t b1 = 1; b1 <= 256; b1++)
+    { uint64_t den = (uint64_t) fs*4*nbits*b1; // exact if num == den*(DIVIDE+1)
+      uint64_t d1 = (num + den/2)/den;
+      if(d1 < f1 || d1 > 4096) continue;
+      int64_t err = (int64_t) num - (int64_t)(den*d1);
+      double rel = (double)(err < 0? -err : err)/(double)(den*d1);
+      if(rel < bestErr)
+      { bestErr = rel;
+        best.fract = (uint16_t)(f1-1); best.divide = (uint16_t)(d1-1); best.div = (uint16_t)(b1-1);
+        best.exact = (err == 0);
+        best.fs = (double) num/(double)(4*nbits*b1*d1);
+        best.ppm = (best.fs/fs - 1.0)*1e6;
+        if(!err) return best;
+      }
+    }
+  }
+  return best;
+}
+
+#ifdef __cplusplus
+  // standard rates, dividers for F_CPU are computed at compile time
+  constexpr uint32_t i2sRates[] = {8000, 11025, 16000, 22050, 24000, 32000, 44100, 48000,
+                                   88200, 96000, 176400, 192000};
+  #define I2S_NRATES (sizeof(i2sRates)/sizeof(i2sRates[0]))
+
+  #ifdef F_CPU
+    template <int nbits>
+    struct c_i2sDivTable
+    { static constexpr i2s_div_s table[I2S_NRATES] = {
+        i2sDivSolve(i2sClockSource(F_CPU), nbits, i2sRates[0]),  i2sDivSolve(i2sClockSource(F_CPU), nbits, i2sRates[1]),
+        i2sDivSolve(i2sClockSource(F_CPU), nbits, i2sRates[2]),  i2sDivSolve(i2sClockSource(F_CPU), nbits, i2sRates[3]),
+        i2sDivSolve(i2sClockSource(F_CPU), nbits, i2sRates[4]),  i2sDivSolve(i2sClockSource(F_CPU), nbits, i2sRates[5]),
+        i2sDivSolve(i2sClockSource(F_CPU), nbits, i2sRates[6]),  i2sDivSolve(i2sClockSource(F_CPU), nbits, i2sRates[7]),
+        i2sDivSolve(i2sClockSource(F_CPU), nbits, i2sRates[8]),  i2sDivSolve(i2sClockSource(F_CPU), nbits, i2sRates[9]),
+        i2sDivSolve(i2sClockSource(F_CPU), nbits, i2sRates[10]), i2sDivSolve(i2sClockSource(F_CPU), nbits, i2sRates[11])};
+    };
+    template <int nbits>
+    constexpr i2s_div_s c_i2sDivTable<nbits>::table[I2S_NRATES];
+
+    // dividers of fs for F_CPU (table or solved)
+    template <int nbits>
+    i2s_div_s i2sDivLookup(uint32_t fs)
+    { for(uint32_t ii=0; ii<I2S_NRATES; ii++) if(i2sRates[ii] == fs) return c_i2sDivTable<nbits>::table[ii];
+      return i2sDivSolve(i2sClockSource(F_CPU), nbits, fs);
+    }
+  #endif
+#endif
+
+#endif
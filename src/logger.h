@@ -23,35 +23,15 @@
 #ifndef LOGGER_H
 #define LOGGER_H
 
-typedef struct
-{
-  uint32_t rtc;
-  uint32_t t0;
-  uint32_t nch;
-  uint32_t fsamp;
-  uint32_t fsize;
-  uint32_t nsamp;
-  uint32_t hsize;
-  uint32_t nclst;
-  uint32_t fill[128-8];
-} header_s;
-
-/*
- * simple data pool (no lock-release)
- * T type of data 
- * nb number of data blocks
- * nd size of data block
- */
-template <typename T, int nb, int nd>
-class store
-{ T pool[nb*nd];
-
-  public:
-  store(void) {;}
-  T *fetch(int ii) {return &pool[ii*nd];}
-  void release(uint16_t ii) {;}
-};
+#include "binfile.h"
+#include "rate.h"
+#ifdef COMPRESS
+  #include "rice.h"
+#endif
 
+#ifdef BLOCK_INDEX
+  extern "C" volatile uint32_t rxCount; // I2S interrupt count (I2S.c)
+#endif
 
 #include "mfs.h"
 c_mFS mFS;
@@ -61,134 +41,479 @@ header_s header;
 class uSD_IF
 {
   public:
-  uSD_IF(void) {;}
+  uSD_IF(void)
+  {
+    #ifdef SD_TRACE
+      trace_s *rec = (trace_s *) traceRec;
+      rec->magic = TRACE_MAGIC; rec->nmagic = ~TRACE_MAGIC; rec->nent = 0; rec->res = 0;
+    #endif
+  }
   void init(void);
-  void reset(void) {fileStatus=0;}
+  void reset(void) {fileStatus=0; rotateDepthMax=0; resetRate();}
   int32_t save(char *fmt, int mxfn, int max_mb);
   int32_t save(int max_mb);
-  uint32_t overrun=0;
+  void printStats(void);
+  volatile uint32_t overrun=0; // incremented by producer (ISR)
+  volatile uint32_t queueMax=0; // queue high-water mark, updated by producer (ISR)
+  volatile uint32_t busyCount=0; // incremented by application if ISR finds processing busy
+  uint32_t copyCount=0; // bytes copied while draining
   uint32_t maxBlockSize=0;
+  uint32_t indexSize=0; // size of block index record
+  uint32_t blockSize=0; // size of data block (and of records)
+  uint32_t chunkBlocks=0; // number of blocks per write
+  uint32_t queueSize=0; // number of blocks in queue
+  uint32_t rotateDepth=0; // max queue depth after start of actual file
+  uint32_t rotateDepthMax=0; // same, over all files since start
   int16_t isRunning = 0; // tell upper classes 
+  void rateStamp(uint32_t nblk); // producer (ISR)
+  #ifdef TRIGGER
+    uint32_t trigPre=0;  // blocks kept before detection
+    uint32_t trigPost=0; // blocks written after detection
+    volatile uint32_t trigEnd=0; // index of first block after last detection window, set by producer
+  #endif
 
   private:
+  virtual uint32_t queued(void) =0;
   virtual void *drain(void) =0;
+  virtual void release(void) =0;
+  virtual void *blockIndex(int flush) =0;
+  virtual void *compress(void *src, uint32_t nin, uint32_t *nout) =0;
+  virtual void *record(void *src, uint32_t nbytes) =0;
+  virtual uint32_t consumed(void) =0;
+  #ifdef TRIGGER
+    virtual void skip(uint32_t n) =0;
+    uint32_t nskip=0, iskip=0; // blocks not written since last detection window
+  #endif
+  int16_t skipIdle(void);
+  int16_t putSkip(void);
+  int16_t put(void *src, uint32_t nbytes);
+  uint16_t startFile(void);
+  void prepareFile(char *filename, uint32_t maxLoggerCount);
+  void watchQueue(void);
+  void newStats(void);
+  void updateStats(void);
+  int16_t putData(void *src, uint32_t nbytes);
+  int16_t putStats(void);
+  void trace(uint32_t t0, uint32_t nbytes);
+  int16_t putTrace(int flush);
+  void resetRate(void);
+  void updateRate(void);
+  void newRate(void);
+  int16_t putRate(void);
   virtual int16_t write(void *src) =0;
   virtual void haveFinished(void)=0;
   uint16_t fileStatus = 0;
+  int16_t rotating = 0; // queue depth is watched until queue is drained
+  stat_s stat; // statistics of actual file
+  #ifdef SD_TRACE
+    uint32_t traceRec[128]; // trace record being filled (trace_s and entries)
+    uint32_t traceMax(void) // entries per record (record fits into a block)
+    { uint32_t n = blockSize/sizeof(uint32_t);
+      return ((n > 128)? 128 : n) - sizeof(trace_s)/sizeof(uint32_t);
+    }
+  #endif
   uint32_t ifn = 0;
   uint32_t loggerCount = 0;
   //
+  // measured rate, stamps are taken by producer and fitted by consumer (see rate.h)
+  volatile uint32_t rateCount=0; // number of stamps, published after stamp is written
+  uint32_t rateBlock=0, rateTsr=0, rateTpr=0; // last stamp
+  uint32_t rtcLast=0;   // RTC second of last stamp (producer)
+  uint32_t rateSeen=0;  // rateCount of last fitted stamp (consumer)
+  uint32_t fileBlock=0; // first block of actual file
+  c_rateFit runFit, fileFit, winFit; // since logger start, over file, drift window
+  double lastPpm=0, lastCentre=0; // previous drift window
+  float drift=0;
 };
 
 /*------- AudioRecorderLogger class and short methods -----------*/
 /*
  * inplements Buffered Logger
  * T type of data
- * nq number of data blocks to buffer
+ * the geometry is given at boot by configure(), all buffers (queue, write
+ * buffer, records) are carved from one arena (see acqConfig in myAPP.cpp)
+ * nq number of data blocks to buffer (must be power of 2)
  * nd size of data block
  * na number of data blocks in write buffer
+ *
+ * the queue is a single-producer/single-consumer ring
+ * producer is the ISR (reserve/commit or write), it owns head
+ * consumer is loop() (claim/consume or drain/release), it owns tail
+ * head and tail are free running counters, slot index is counter & (nq-1)
+ * each side publishes its counter with release and reads the other with acquire
+ *
+ * blocks dropped on overrun are announced by a gap record (gap_s) that is
+ * written by reserve() into the next free slot, ahead of the next data block
+ *
+ * with BLOCK_INDEX defined, the producer stamps each block with its sequence
+ * number, I2S interrupt count and cycle counter, and the first block of each
+ * drained chunk is entered into a block index record (idx_s) that uSD_IF
+ * writes in-band whenever it is full and at file close
+ *
+ * with COMPRESS defined, blocks are rice coded (rice.h) before they are written
+ * frames are collected in cbuf and written in multiples of 512 bytes
+ *
+ * files are rotated without stopping: while the queue is (nearly) empty, uSD_IF
+ * pre-opens and pre-allocates the next file and closes the previous one, so that
+ * at the switch only the header is written; the worst queue depth seen from the
+ * start of a file until the queue is drained again is kept in rotateDepth
+ *
+ * per file statistics (write latency histogram, queue high-water mark, overruns,
+ * busy ISR count) are appended to the file at close as stat_s record
+ *
+ * once per RTC second the producer stamps the number of samples received with
+ * the RTC time; the consumer fits the rate since logger start (written into each
+ * header with the time of the first sample) and over each file (rate_s record at
+ * close, see rate.h)
+ *
+ * with ZERO_COPY defined, drain() returns a pointer directly into the pool
+ * and the drained blocks stay reserved until uSD_IF calls release()
+ * only a run of na blocks that wraps around the end of the pool is copied
+ * (never happens if nq is a multiple of na)
  */
-template <typename T, int nq, int nd, int na>
+template <typename T>
 class Logger : public uSD_IF
 {
 public:
-  Logger (void) : head(0), tail(0), enabled(0)
-  { maxBlockSize = na*nd*sizeof(T);}
+  Logger (void) : head(0), tail(0), enabled(0), nDrain(0), nblock(0), ndrop(0), idrop(0),
+                  nq(0), nd(0), na(0), pool(0) {;}
+
+  static uint32_t arenaBytes(uint32_t nq, uint32_t nd, uint32_t na); // arena needed for geometry
+  int configure(uint8_t *arena, uint32_t nbytes, uint32_t nq, uint32_t nd, uint32_t na);
 
-  void start(void) { clear(); reset(); isRunning=1; enabled = 1; }
+  void start(void) { enabled = 0; clear(); reset(); isRunning=1; enabled = 1; }
   void stop(void) { isRunning=0; } // tell uSD_IF
   void stopnow(void) { isRunning=-1; } // tell uSD_IF
+  #ifdef TRIGGER
+    void trigger(void) { trigEnd = nblock + trigPost; } // producer (ISR) has detection in last block
+  #endif
   //
   void clear(void);
   //
-  void *drain(void);
+  // producer (ISR)
+  T *reserve(void);   // get next free block (to be filled by caller)
+  int16_t commit(void); // make reserved block available to drain
   int16_t write(void *src);
+  //
+  // consumer (loop), batch access
+  uint32_t available(void) { return load(&head) - tail; } // number of committed blocks
+  uint32_t queued(void) { return available(); }
+  T *claim(uint32_t n);   // first of n oldest blocks, 0 if not available or wrapping
+  T *block(uint32_t ii) { return fetch(tail + ii);} // ii-th oldest block
+  void consume(uint32_t n); // give n oldest blocks back to producer
+  //
+  void *drain(void);
+  void release(void);
+  void *blockIndex(int flush);
+  void *compress(void *src, uint32_t nin, uint32_t *nout);
+  void *record(void *src, uint32_t nbytes);
+  uint32_t consumed(void) { return cseq; }
+  #ifdef TRIGGER
+    void skip(uint32_t n) { consume(n); }
+  #endif
   void haveFinished(void) {enabled=0;} // got signal from uSD_IF
+  int16_t isEnabled(void) {return enabled;}
 
 private:
-  store<T,nq,nd> pool;
-  T* queue[nq];
-  int16_t head, tail, enabled;
+  volatile uint32_t head, tail;
+  volatile int16_t enabled;
+  uint32_t nDrain; // number of blocks drained but not yet released
+  //
+  uint32_t nblock;  // number of blocks offered by producer since start
+  uint32_t ndrop;   // number of blocks dropped since last gap record
+  uint32_t idrop;   // index of first dropped block
+  uint32_t cseq;    // index of block at tail (consumer)
 
-  T buffer[na*nd]; // for draining data
-};
+  uint32_t nq, nd, na; // geometry
+  T *pool;             // nq blocks of nd
+  T *fetch(uint32_t ii) { return pool + (ii & (nq-1))*nd; } // block of counter ii
 
-/*--------------- larger AudioRecorderLogger methods ------------------*/
-template <typename T, int nq, int nd, int na>
-void Logger<T,nq,nd,na>:: clear(void)
+  void stampBlock(uint32_t h, uint32_t seq)
   {
-    uint16_t t = tail;
-    while (t != head) {
-      if (++t >= nq) t = 0;
-      pool.release(t);
-      queue[t]=0; // remove address from queue
-    }
-    tail = t;
+    #ifdef BLOCK_INDEX
+      idx_entry_s *st = &stamp[h & (nq-1)];
+      st->seq = seq; st->rxcount = rxCount; st->cycles = ARM_DWT_CYCCNT; st->nblk = 1;
+    #endif
+  }
+
+  static uint32_t load(volatile uint32_t *x) { return __atomic_load_n(x, __ATOMIC_ACQUIRE);}
+  static void publish(volatile uint32_t *x, uint32_t v) { __atomic_store_n(x, v, __ATOMIC_RELEASE);}
+  static uint32_t align4(uint32_t n) { return (n + 3) & ~3u;}
+
+#ifdef BLOCK_INDEX
+  idx_entry_s *stamp;    // nq, written by producer for each slot
+  idx_entry_s entry;     // stamp of first block in chunk being written
+  T *irec;               // block index record (nd)
+  int16_t irecDone;      // record has been handed out for writing
+  void newIndex(void)
+  { for(uint32_t ii=0; ii<nd; ii++) irec[ii]=0;
+    idx_s *rec = (idx_s *) irec;
+    rec->magic = IDX_MAGIC; rec->nmagic = ~IDX_MAGIC; 
+    irecDone = 0;
   }
+#endif
+
+#ifdef COMPRESS
+  static_assert(sizeof(T) == 4, "Logger: COMPRESS needs 32 bit data");
+  // compressed frames, one chunk worst case plus what is left from last write
+  static uint32_t cbufBytes(uint32_t nd, uint32_t na) { return 512 + na*(nd*sizeof(T)+sizeof(rice_frame_s));}
+  uint8_t *cbuf;
+  uint32_t cbufCount = 0; // bytes in cbuf
+  uint32_t cbufDone = 0;  // bytes handed out for writing
+#endif
 
-template <typename T, int nq, int nd, int na>
-int16_t Logger<T,nq,nd,na>:: write(void *inp)
+  T *srec;   // statistics record (nd)
+  T *buffer; // for draining data (na*nd), with ZERO_COPY only if write buffer may wrap around queue
+  static uint32_t bufferBlocks(uint32_t nq, uint32_t na)
   {
-    int16_t h;
+    #ifdef ZERO_COPY
+      return (nq % na)? na : 0;
+    #else
+      return na;
+    #endif
+  }
+};
+
+/*--------------- larger AudioRecorderLogger methods ------------------*/
+template <typename T>
+uint32_t Logger<T>:: arenaBytes(uint32_t nq, uint32_t nd, uint32_t na)
+  { uint32_t block = nd*sizeof(T);
+    uint32_t n = nq*block + block + bufferBlocks(nq, na)*block; // pool, srec, buffer
+    #ifdef BLOCK_INDEX
+      n += nq*sizeof(idx_entry_s) + block;
+    #endif
+    #ifdef COMPRESS
+      n += align4(cbufBytes(nd, na));
+    #endif
+    return n;
+  }
+
+template <typename T>
+int Logger<T>:: configure(uint8_t *arena, uint32_t nbytes, uint32_t nq_, uint32_t nd_, uint32_t na_)
+  { // only to be called while producer is disabled
+    if(!nq_ || (nq_ & (nq_-1)) || !na_ || (nq_ < na_)) return 0; // nq power of 2, not smaller than na
+    uint32_t block = nd_*sizeof(T);
+    if((block & 3) || (block < sizeof(gap_s)) || (block < sizeof(stat_s)) || (block < sizeof(rate_s)))
+      return 0; // blocks also hold records
+    #ifdef BLOCK_INDEX
+      if(block < sizeof(idx_s)+sizeof(idx_entry_s)) return 0;
+    #endif
+    if(arenaBytes(nq_, nd_, na_) > nbytes) return 0;
+
+    nq = nq_; nd = nd_; na = na_;
+    pool = (T *) arena; arena += nq*block;
+    srec = (T *) arena; arena += block;
+    buffer = (T *) arena; arena += bufferBlocks(nq, na)*block;
+    #ifdef BLOCK_INDEX
+      stamp = (idx_entry_s *) arena; arena += nq*sizeof(idx_entry_s);
+      irec = (T *) arena; arena += block;
+      indexSize = nd*sizeof(T);
+    #endif
+    #ifdef COMPRESS
+      cbuf = arena; arena += align4(cbufBytes(nd, na));
+    #endif
+    maxBlockSize = na*nd*sizeof(T);
+    blockSize = nd*sizeof(T);
+    chunkBlocks = na;
+    queueSize = nq;
+    clear();
+    return 1;
+  }
+
+template <typename T>
+void Logger<T>:: clear(void)
+  { // only to be called while producer is disabled
+    head = 0;
+    publish(&tail,0);
+    nDrain = 0;
+    nblock = ndrop = idrop = 0;
+    cseq = 0;
+    #ifdef BLOCK_INDEX
+      newIndex();
+    #endif
+    #ifdef COMPRESS
+      cbufCount = cbufDone = 0;
+    #endif
+  }
 
+template <typename T>
+T * Logger<T>:: reserve(void)
+  {
     if(!enabled) return 0; // don't do anything
+    rateStamp(nblock+1); // blocks received with this one
     
-    h = head + 1;
-    if (h >= nq) h = 0;
-    if (h == tail) {  // disaster
+    uint32_t h = head;
+    uint32_t nfree = nq - (h - load(&tail));
+    if (nfree < (ndrop? 2u: 1u)) {  // disaster (need extra slot for gap record)
+      if(!ndrop) idrop = nblock;
+      ndrop++;
+      nblock++;
       overrun++;
+      queueMax = nq;
       // simply ignore new data
-      return -1;
+      return 0;
     } 
-    else 
-    { queue[h] = pool.fetch(h);
-      T *ptr = queue[h];
-      if(ptr)
-      { T *src = (T*) inp;
-        for(int ii=0; ii<nd; ii++) ptr[ii]=src[ii];
-        head = h;
-        return head;
-      }
-      else
-        return -1;
+    if(ndrop)
+    { // announce dropped blocks ahead of this one
+      T *ptr = fetch(h);
+      for(uint32_t ii=0; ii<nd; ii++) ptr[ii]=0;
+      gap_s *gap = (gap_s *) ptr;
+      gap->magic = GAP_MAGIC;
+      gap->nmagic = ~GAP_MAGIC;
+      gap->ndrop = ndrop;
+      gap->block = idrop;
+      gap->sample = (uint64_t) idrop * header.nsamp;
+      stampBlock(h, idrop);
+      publish(&head, ++h);
+      ndrop = 0;
     }
+    stampBlock(h, nblock++);
+    uint32_t used = h + 1 - load(&tail); // including this block
+    if(used > queueMax) queueMax = used;
+    return fetch(h);
+  }
+
+template <typename T>
+int16_t Logger<T>:: commit(void)
+  {
+    uint32_t h = head + 1;
+    publish(&head, h);
+    return h & (nq-1);
+  }
+
+template <typename T>
+int16_t Logger<T>:: write(void *inp)
+  {
+    if(!enabled) return 0; // don't do anything
+
+    T *ptr = reserve();
+    if(ptr)
+    { T *src = (T*) inp;
+      for(uint32_t ii=0; ii<nd; ii++) ptr[ii]=src[ii];
+      return commit();
+    }
+    else
+      return -1;
+  }
+
+template <typename T>
+T * Logger<T>:: claim(uint32_t n)
+  {
+    if(available() < n) return 0;
+    uint32_t t = tail & (nq-1);
+    if(t + n > nq) return 0; // blocks wrap around end of pool
+    return fetch(t);
+  }
+
+template <typename T>
+void Logger<T>:: consume(uint32_t n)
+  {
+    uint32_t t = tail;
+    for(uint32_t ii=0; ii<n; ii++)
+    { gap_s *gap = (gap_s *) fetch(t+ii);
+      // gap record stands for dropped blocks; it announces the block at tail, so a data
+      // block that merely starts with the magic pair (16/24 bit formats) counts as one
+      cseq += (isGap(gap) && gap->block == cseq)? gap->ndrop : 1;
+    }
+    publish(&tail, t+n);
   }
   
-template <typename T, int nq, int nd, int na>
-void * Logger<T,nq,nd,na>:: drain(void)
+template <typename T>
+void * Logger<T>:: drain(void)
   {
-    uint16_t n;
-    if(head>tail) n=head-tail; else n = nq + head -tail;
+    if(available() < na) return 0;
 
-    int16_t nb=na; // na is number of buffers to fetched from queue and written to disk
-    if(n>nb)
-    {
-      T *bptr = buffer;
-      //
-      uint16_t t = tail;
-      while(--nb>=0)
-      {
-        if (t != head) 
-        {
-          if (++t >= nq) t = 0;
-          
-          // copy to buffer     
-          { T *src = queue[t];
-            if(src)
-            { for(int jj=0; jj<nd; jj++) bptr[jj]=src[jj];
-              pool.release(t);
-              queue[t]=0;
-            }
-          }
-          tail = t;
-          bptr += nd;
-        }
-      }
-      return (void *)buffer;
+#ifdef BLOCK_INDEX
+    entry = stamp[tail & (nq-1)];
+    entry.nblk = na;
+#endif
+
+#ifdef ZERO_COPY
+    nDrain = na;
+    T *ptr = claim(na);
+    if(((nq % na)==0) || ptr) return (void *)ptr; // contiguous run in pool
+    //
+    // run wraps around end of pool, so collect in buffer
+    T *bptr = buffer;
+    for(uint32_t ii=0; ii<na; ii++)
+    { T *src = block(ii);
+      for(uint32_t jj=0; jj<nd; jj++) bptr[jj]=src[jj];
+      copyCount += nd*sizeof(T);
+      bptr += nd;
+    }
+    return (void *)buffer;
+#else
+    T *bptr = buffer;
+    for(uint32_t ii=0; ii<na; ii++)
+    { T *src = block(ii);
+      for(uint32_t jj=0; jj<nd; jj++) bptr[jj]=src[jj];
+      copyCount += nd*sizeof(T);
+      bptr += nd;
     }
+    consume(na);
+    return (void *)buffer;
+#endif
+  }
+
+template <typename T>
+void Logger<T>:: release(void)
+  { // free blocks that have been written to disk (only used with ZERO_COPY)
+    consume(nDrain);
+    nDrain = 0;
+  }
+
+template <typename T>
+void * Logger<T>:: blockIndex(int flush)
+  { // enter last drained chunk (flush==0) and return index record if due for writing
+#ifdef BLOCK_INDEX
+    const uint32_t nmax = (nd*sizeof(T) - sizeof(idx_s))/sizeof(idx_entry_s);
+    idx_s *rec = (idx_s *) irec;
+    idx_entry_s *ent = (idx_entry_s *) (rec+1);
+    if(irecDone) newIndex();
+    if(!flush) ent[rec->nent++] = entry;
+    if(rec->nent && (flush || (rec->nent == nmax)))
+    { irecDone = 1;
+      return (void *)irec;
+    }
+#endif
     return 0;
   }
 
+template <typename T>
+void * Logger<T>:: compress(void *src, uint32_t nin, uint32_t *nout)
+  { // returns data to be written (nout bytes) or 0; src==0 flushes compressor
+#ifdef COMPRESS
+    if(cbufDone)
+    { // keep what was not written last time
+      cbufCount -= cbufDone;
+      memmove(cbuf, cbuf+cbufDone, cbufCount);
+      cbufDone = 0;
+    }
+    if(src)
+    { T *ptr = (T *) src;
+      for(uint32_t ii=0; ii < nin/(nd*sizeof(T)); ii++, ptr += nd)
+        cbufCount += rice_encode(cbuf+cbufCount, ptr, header.nch, header.nsamp, isRecord(ptr));
+      *nout = cbufCount & ~511; // write full sectors only
+    }
+    else
+      *nout = cbufCount;
+    if(!*nout) return 0;
+    cbufDone = *nout;
+    return (void *)cbuf;
+#else
+    *nout = nin;
+    return src;
+#endif
+  }
+
+template <typename T>
+void * Logger<T>:: record(void *src, uint32_t nbytes)
+  { // copy record into (zero filled) block
+    uint8_t *ptr = (uint8_t *) srec;
+    for(uint32_t ii=0; ii<nd*sizeof(T); ii++) ptr[ii] = (ii<nbytes)? ((uint8_t *)src)[ii] : 0;
+    return (void *)srec;
+  }
+
 /*
  * ************** uSD_logger methods *****************
  * 
@@ -199,29 +524,278 @@ void uSD_IF::init(void)
   fileStatus=0;
 }
 
+int16_t uSD_IF::put(void *src, uint32_t nbytes)
+{ // (compress and) write data to file, src==0 flushes compressor
+  uint32_t nout;
+  uint8_t *buffer = (uint8_t *)compress(src, nbytes, &nout);
+  if(!buffer) return 1;
+  uint32_t t0 = micros();
+  if(!mFS.write(buffer, nout)) return 0;
+  trace(t0, nout);
+  return 1;
+}
+
+int16_t uSD_IF::putData(void *src, uint32_t nbytes)
+{ // put data and enter write latency into statistics
+  uint32_t t0 = micros();
+  int16_t ret = put(src, nbytes);
+  uint32_t dt = micros()-t0;
+  int ib = 31-__builtin_clz(dt | 1); // log2
+  if(ib >= STAT_NHIST) ib = STAT_NHIST-1;
+  stat.hist[ib]++;
+  stat.nwrite++;
+  stat.sumLatency += dt;
+  if(dt > stat.maxLatency) stat.maxLatency = dt;
+  return ret;
+}
+
+int16_t uSD_IF::skipIdle(void)
+{ // trigger mode: without detection keep only trigPre (up to trigPre+chunkBlocks-1) blocks
+  // returns 1 if nothing is to be written
+#ifdef TRIGGER
+  if(consumed() < trigEnd) return 0; // within detection window
+  uint32_t n = queued();
+  if(n >= trigPre + chunkBlocks)
+  { // skip whole chunks, so that drain() finds chunks aligned in queue (ZERO_COPY)
+    if(!nskip) iskip = consumed();
+    skip(((n - trigPre)/chunkBlocks)*chunkBlocks);
+    nskip = consumed() - iskip;
+  }
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+int16_t uSD_IF::putSkip(void)
+{ // announce blocks that were not written by a gap record
+#ifdef TRIGGER
+  if(!nskip) return 1;
+  gap_s gap;
+  memset(&gap, 0, sizeof(gap));
+  gap.magic = GAP_MAGIC;
+  gap.nmagic = ~GAP_MAGIC;
+  gap.ndrop = nskip;
+  gap.block = iskip;
+  gap.sample = (uint64_t) iskip * header.nsamp;
+  gap.cause = GAP_IDLE;
+  nskip = 0;
+  return put(record(&gap, sizeof(gap)), blockSize);
+#else
+  return 1;
+#endif
+}
+
+void uSD_IF::trace(uint32_t t0, uint32_t nbytes)
+{ // enter card operation (nbytes==0 for file operations) into latency trace
+#ifdef SD_TRACE
+  trace_s *rec = (trace_s *) traceRec;
+  if(rec->nent < traceMax()) traceRec[4 + rec->nent++] = TRACE_ENTRY(micros()-t0, nbytes);
+#endif
+}
+
+int16_t uSD_IF::putTrace(int flush)
+{ // write trace record when full, or when it has entries and flush is set
+#ifdef SD_TRACE
+  trace_s *rec = (trace_s *) traceRec;
+  if(rec->nent < (flush? 1 : traceMax())) return 1;
+  void *ptr = record(traceRec, sizeof(trace_s) + rec->nent*sizeof(uint32_t));
+  rec->nent = 0; // writing the record is first entry of next record
+  return put(ptr, blockSize);
+#else
+  return 1;
+#endif
+}
+
+void uSD_IF::rateStamp(uint32_t nblk)
+{ // producer (ISR): stamp received blocks with RTC time, once per RTC second
+  uint32_t tsr = RTC_TSR;
+  if(tsr == rtcLast) return;
+  uint32_t tpr = RTC_TPR;
+  if(RTC_TSR != tsr) { tsr = RTC_TSR; tpr = RTC_TPR; } // prescaler overflowed in between
+  rtcLast = tsr;
+  rateBlock = nblk; rateTsr = tsr; rateTpr = tpr & 0x7fff;
+  __atomic_store_n(&rateCount, rateCount+1, __ATOMIC_RELEASE);
+}
+
+void uSD_IF::resetRate(void)
+{ // logger (re)start, producer is disabled
+  rtcLast = RTC_TSR; // first stamp at next RTC second
+  rateCount = rateSeen = 0;
+  runFit.reset(header.fsamp);
+  fileFit.reset(header.fsamp);
+  winFit.reset(header.fsamp);
+  lastPpm = lastCentre = 0;
+  drift = 0;
+}
+
+void uSD_IF::updateRate(void)
+{ // consumer: enter new stamp into fits
+  uint32_t count, nblk, tsr, tpr;
+  do
+  { count = __atomic_load_n(&rateCount, __ATOMIC_ACQUIRE);
+    if(count == rateSeen) return;
+    nblk = rateBlock; tsr = rateTsr; tpr = rateTpr;
+  } while(__atomic_load_n(&rateCount, __ATOMIC_ACQUIRE) != count); // producer stamped meanwhile
+  rateSeen = count;
+  double x = (double) nblk*header.nsamp;
+  double t = tsr + (tpr + 0.5)/32768.0; // middle of prescaler tick
+  runFit.add(x, t);
+  fileFit.add(x, t);
+  winFit.add(x, t);
+  if(winFit.span() >= RATE_WINDOW)
+  { // drift from rates of consecutive windows
+    double tc = winFit.centre(), ppm = winFit.ppm();
+    if(lastCentre > 0) drift = (ppm - lastPpm)*3600.0/(tc - lastCentre);
+    lastPpm = ppm; lastCentre = tc;
+    winFit.reset(header.fsamp);
+  }
+}
+
+void uSD_IF::newRate(void)
+{ // new file: file fit starts, header gets run fit
+  fileBlock = consumed();
+  fileFit.reset(header.fsamp);
+  header.block = fileBlock;
+  header.npoint = runFit.points();
+  header.rate = runFit.rate();
+  header.tfirst = runFit.time((double) fileBlock*header.nsamp);
+  header.ppm = runFit.ppm();
+  header.drift = drift;
+}
+
+int16_t uSD_IF::putRate(void)
+{ // append measured rate record to file
+  updateRate();
+  rate_s rt;
+  memset(&rt, 0, sizeof(rt));
+  rt.magic = RATE_MAGIC;
+  rt.nmagic = ~RATE_MAGIC;
+  rt.npoint = fileFit.points();
+  rt.block = fileBlock;
+  rt.rate = fileFit.rate();
+  rt.tfirst = fileFit.time((double) fileBlock*header.nsamp);
+  rt.ppm = fileFit.ppm();
+  rt.rms = fileFit.rms()*1e6;
+  rt.span = fileFit.span();
+  rt.drift = drift;
+  rt.runRate = runFit.rate();
+  rt.runPpm = runFit.ppm();
+  rt.runPoint = runFit.points();
+  return put(record(&rt, sizeof(rt)), blockSize);
+}
+
+void uSD_IF::newStats(void)
+{
+  memset(&stat, 0, sizeof(stat));
+  stat.magic = STAT_MAGIC;
+  stat.nmagic = ~STAT_MAGIC;
+  stat.wbytes = maxBlockSize;
+  stat.queueSize = queueSize;
+  queueMax = 0;
+  busyCount = 0;
+}
+
+void uSD_IF::updateStats(void)
+{
+  stat.queueMax = queueMax;
+  stat.rotateDepth = rotateDepth;
+  stat.overrun = overrun;
+  stat.busy = busyCount;
+}
+
+int16_t uSD_IF::putStats(void)
+{ // append statistics record to file
+  updateStats();
+  return put(record(&stat, sizeof(stat)), blockSize);
+}
+
+void uSD_IF::printStats(void)
+{
+  updateStats();
+  Serial.printf("writes: %d x %d bytes  latency mean: %d us max: %d us\n\r",
+        stat.nwrite, stat.wbytes, stat.nwrite? stat.sumLatency/stat.nwrite : 0, stat.maxLatency);
+  Serial.printf("queue: max %d (rotation %d) of %d blocks  overrun: %d  busy: %d\n\r",
+        stat.queueMax, stat.rotateDepth, stat.queueSize, stat.overrun, stat.busy);
+  for(int ii=0; ii<STAT_NHIST; ii++)
+    if(stat.hist[ii]) Serial.printf(" %8d us: %d\n\r", 1<<ii, stat.hist[ii]);
+  Serial.printf("rate: %.4f Hz (%.3f ppm) from %d stamps, file %.3f ppm rms %.1f us, drift %.3f ppm/h\n\r",
+        runFit.rate(), runFit.ppm(), runFit.points(), fileFit.ppm(), fileFit.rms()*1e6, drift);
+}
+
 #include <time.h>
 struct tm seconds2tm(uint32_t tt);
 
-uint16_t generateFilename(char *dev, char *filename)
+uint16_t generateFilename(char *dev, char *filename, uint32_t tt)
 {
-  struct tm tx=seconds2tm(RTC_TSR);;
+  struct tm tx=seconds2tm(tt);
   sprintf(filename,"%s_%04d%02d%02d_%02d%02d%02d.bin",dev,
           tx.tm_year, tx.tm_mon, tx.tm_mday,
           tx.tm_hour, tx.tm_min, tx.tm_sec);
   return 1;
 }
 
+uint16_t generateFilename(char *dev, char *filename)
+{
+  return generateFilename(dev, filename, RTC_TSR);
+}
+
+uint16_t uSD_IF::startFile(void)
+{ // file is open, reset counters and write header
+  loggerCount=0;  // count successful transfers
+  overrun=0;      // count buffer overruns
+  copyCount=0;    // count copied bytes
+  rotating=1;     // watch queue until it is drained
+  rotateDepth=queued();
+  newStats();
+  newRate();
+  //
+  header.rtc = RTC_TSR;
+  uint32_t t0 = micros();
+  if (!mFS.write((uint8_t*)&header, sizeof(header_s)))
+    return 3; // close file on write failure
+  trace(t0, sizeof(header_s));
+  return 2; // flag as open
+}
+
+void uSD_IF::watchQueue(void)
+{ // queue depth after start of file (i.e. rotation)
+  if(!rotating) return;
+  uint32_t depth = queued();
+  if(depth > rotateDepth) rotateDepth = depth;
+  if(rotateDepth > rotateDepthMax) rotateDepthMax = rotateDepth;
+}
+
+void uSD_IF::prepareFile(char *filename, uint32_t maxLoggerCount)
+{ // called when queue is drained, does at most one file operation
+  rotating=0;
+  uint32_t t0 = micros();
+  if(mFS.finish()) { trace(t0, 0); return; }
+  if(mFS.hasNext()) return;
+  // name of next file is predicted start time of next file
+  uint32_t tt = RTC_TSR + (uint32_t)(((uint64_t)(maxLoggerCount-loggerCount)
+                                      *chunkBlocks*header.nsamp)/header.fsamp);
+  t0 = micros();
+  if(generateFilename((char *)parameters.name,filename,tt) && mFS.prepare(filename))
+  { trace(t0, 0);
+    #if DO_DEBUG > 0
+        Serial.printf("\n\r next: %s\n\r",filename);
+    #endif
+  }
+}
+
 int32_t uSD_IF::save(int max_mb )
 { // does also open/close a file when required
   //
   static uint16_t isLogging = 0; // flag to ensure single access to function
 
   char filename[80];
-  uint16_t nbuf = maxBlockSize;
+  uint32_t nbuf = maxBlockSize;
   uint32_t maxLoggerCount = (max_mb*1024*1024)/maxBlockSize;
 
   if (isLogging) return 1; // we are already busy (should not happen)
   isLogging = 1;
+  updateRate();
 
   if(fileStatus==0)
   { // open new file
@@ -230,27 +804,29 @@ int32_t uSD_IF::save(int max_mb )
       isLogging = 0; return 0; // tell calling loop() we have error
     } // end of all operations
 
+    uint32_t t0 = micros();
     mFS.open(filename);
+    trace(t0, 0);
     #if DO_DEBUG > 0
         Serial.printf(" %s\n\r",filename);
         Serial.printf(" %d blocks max: %d  MB\n\r",maxLoggerCount,max_mb);
     #endif
-    loggerCount=0;  // count successful transfers
-    overrun=0;      // count buffer overruns
-    //
-    if (!mFS.write((uint8_t*)&header, sizeof(header_s)))
-      fileStatus = 3; // close file on write failure
-    else
-      fileStatus = 2; // flag as open
+    fileStatus = startFile();
   }
 
   if(fileStatus==2)
   { 
     // write to file
-    uint8_t *buffer=(uint8_t*)drain();
+    watchQueue();
+    uint8_t *buffer = skipIdle()? 0 : (uint8_t*)drain();
     if(buffer)
     {
-      if (!mFS.write(buffer, nbuf)){ fileStatus = 3;} // close file on write failure
+      if (!putSkip()) { fileStatus = 3;}
+      if (!putData(buffer, nbuf)){ fileStatus = 3;} // close file on write failure
+      uint8_t *index = (uint8_t *)blockIndex(0);
+      if (index && !put(index, indexSize)) { fileStatus = 3;}
+      if (!putTrace(0)) { fileStatus = 3;}
+      release(); // blocks are on disk, so give them back to queue
       if(fileStatus == 2)
       { loggerCount++;
         if(loggerCount == maxLoggerCount)
@@ -264,6 +840,10 @@ int32_t uSD_IF::save(int max_mb )
         #endif
       }
     }
+    else if(isRunning>0)
+    { // queue is drained, so have time to prepare next file
+      prepareFile(filename, maxLoggerCount);
+    }
     if(isRunning<0) 
     { fileStatus=3; // flag to stop logging
       isRunning=0;  // tell close to finish to finish aquisition
@@ -273,16 +853,32 @@ int32_t uSD_IF::save(int max_mb )
   if(fileStatus==3)
   {
     //close file
-    mFS.close();
+    uint8_t *index = (uint8_t *)blockIndex(1);
+    if(index) put(index, indexSize);
+    putTrace(1);
+    putRate();
+    putStats();
+    put(0, 0); // flush compressor
     #if DO_DEBUG ==2
-        Serial.printf("\n\r overrun: (%d)\n\r",overrun);
+        Serial.printf("\n\r overrun: (%d) copied: %d kB queue: %d of %d (max %d)\n\r",
+              overrun, copyCount/1024, rotateDepth, queueSize, rotateDepthMax);
     #endif
-    //
-    fileStatus= 0; // flag file as closed   
+    if(isRunning>0 && mFS.swap())
+    { // continue with pre-opened file, previous file is closed later
+      fileStatus = startFile();
+    }
+    else
+    { uint32_t t0 = micros();
+      mFS.close();
+      trace(t0, 0);
+      mFS.discard();
+      fileStatus= 0; // flag file as closed   
+    }
   }
 
   if(isRunning==0) // we should stop logging
-  { haveFinished(); fileStatus = 4; 
+  { mFS.discard();
+    haveFinished(); fileStatus = 4; 
   }
 
   isLogging = 0;
@@ -299,6 +895,7 @@ int32_t uSD_IF::save(char *fmt, int mxfn, int max_mb )
 
   if (isLogging) return 0; // we are already busy (should not happen)
   isLogging = 1;
+  updateRate();
 
   if(fileStatus==4) { isLogging = 0; return 1; } // don't do anything anymore
 
@@ -318,6 +915,10 @@ int32_t uSD_IF::save(char *fmt, int mxfn, int max_mb )
 #endif    
     loggerCount=0;  // count successful transfers
     overrun=0;      // count buffer overruns
+    rotating=1;     // watch queue until it is drained
+    rotateDepth=queued();
+    newStats();
+    newRate();
     //
     fileStatus = 2; // flag as open
     isLogging = 0; return 1;
@@ -326,13 +927,19 @@ int32_t uSD_IF::save(char *fmt, int mxfn, int max_mb )
   if(fileStatus==2)
   { 
     // write to file
-    uint16_t nbuf = maxBlockSize;
+    uint32_t nbuf = maxBlockSize;
     uint32_t maxLoggerCount = (max_mb*1024*1024)/maxBlockSize;
-    uint8_t *buffer=(uint8_t*)drain();
+    watchQueue();
+    uint8_t *buffer = skipIdle()? 0 : (uint8_t*)drain();
     if(buffer)
     {
-      if (!mFS.write(buffer, nbuf))
+      if (!putSkip()) { fileStatus = 3;}
+      if (!putData(buffer, nbuf))
       { fileStatus = 3;} // close file on write failure
+      uint8_t *index = (uint8_t *)blockIndex(0);
+      if (index && !put(index, indexSize)) { fileStatus = 3;}
+      if (!putTrace(0)) { fileStatus = 3;}
+      release(); // blocks are on disk, so give them back to queue
       if(fileStatus == 2)
       {
         loggerCount++;
@@ -348,18 +955,45 @@ int32_t uSD_IF::save(char *fmt, int mxfn, int max_mb )
 #endif
       }
     }
+    else
+    { // queue is drained, so have time to close previous or to prepare next file
+      rotating=0;
+      if(!mFS.finish() && !mFS.hasNext() && (ifn < (unsigned)mxfn))
+      { sprintf(filename, fmt, (unsigned int)(ifn+1));
+        mFS.prepare(filename);
+      }
+    }
     if(fileStatus==2){ isLogging = 0; return 1; }
   }
 
   if(fileStatus==3)
   {
     //close file
-    mFS.close();
+    uint8_t *index = (uint8_t *)blockIndex(1);
+    if(index) put(index, indexSize);
+    putTrace(1);
+    putRate();
+    putStats();
+    put(0, 0); // flush compressor
 #if DO_DEBUG ==2
-    Serial.printf("\n\r(%d)\n\r",overrun);
+    Serial.printf("\n\r(%d) queue: %d of %d\n\r",overrun,rotateDepth,queueSize);
 #endif    
-    //
-    fileStatus= 0; // flag file as closed   
+    if(mFS.swap())
+    { // continue with pre-opened file, previous file is closed later
+      ifn++;
+      loggerCount=0;
+      overrun=0;
+      rotating=1;
+      rotateDepth=queued();
+      newStats();
+      newRate();
+      fileStatus = 2;
+    }
+    else
+    { mFS.close();
+      mFS.discard();
+      fileStatus= 0; // flag file as closed   
+    }
     isLogging = 0; return 1;
   }
   
@@ -397,25 +1031,38 @@ void logLightSensor(void)
 }
 #endif
 
-void storeConfig(void * ptr)
+/*
+ * Config.txt: six parameters (4 bytes each) and name (4 bytes), followed by the
+ * acquisition configuration (4 lines of 8 bytes), which older files do not have
+ */
+void storeConfig(void * ptr, acq_s *acq)
 { char text[32];
   uint16_t *data = (uint16_t *) ptr;
   mFS.open((char*)"Config.txt", O_CREAT|O_WRITE|O_TRUNC);
   for(int ii=0; ii<6; ii++)
     {sprintf(text,"%2d\r\n",data[ii]); mFS.write((uint8_t*)text,strlen(text));}
   mFS.write((uint8_t *)&data[6],4);
+  uint32_t acqData[4] = {acq->fsamp, acq->chanMask, acq->nq, acq->naud};
+  for(int ii=0; ii<4; ii++)
+    {sprintf(text,"%6d\r\n",(int) acqData[ii]); mFS.write((uint8_t*)text,strlen(text));}
   mFS.close();
   
 }
 
-void readConfig(void * ptr)
+void readConfig(void * ptr, acq_s *acq)
 {
   char text[32];
   uint16_t *data = (uint16_t *) ptr;
   if(!mFS.open((char*)"Config.txt",O_RDONLY)) return;
   for(int ii=0; ii<6; ii++)
-    {mFS.read((uint8_t*)text,4); sscanf(text,"%d",&data[ii]);}
+    {int val=0; mFS.read((uint8_t*)text,4); text[4]=0; sscanf(text,"%d",&val); data[ii]=val;}
   mFS.read((uint8_t*)&data[6],4);
+  if(mFS.size() >= 28+4*8)
+  { int acqData[4];
+    for(int ii=0; ii<4; ii++)
+      {mFS.read((uint8_t*)text,8); text[8]=0; sscanf(text,"%d",&acqData[ii]);}
+    acq->fsamp = acqData[0]; acq->chanMask = acqData[1]; acq->nq = acqData[2]; acq->naud = acqData[3];
+  }
   mFS.close();
 }
 
@@ -0,0 +1,175 @@
+/* wmxzAudio Library for Teensy 3.X
+ * Copyright (c) 2017, Walter Zimmer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice, development funding notice, and this permission
+ * notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+// ltsa.h
+// long-term spectral average (LTSA) of one channel
+// no teensy includes here, so it also builds on host
+//
+// the ISR copies samples into frames of nfft samples (put), loop() windows
+// (Hann) and transforms each frame and averages the power of the nfft/2 bins
+// over tavg seconds (process); the average is returned as a record of one
+// byte per bin (ltsa_rec_s, binfile.h), in LTSA_DBSTEP steps above LTSA_DBMIN,
+// 0 dB is a full scale (24 bit) sine
+// frames do not overlap; a frame that loop() could not take in time is lost
+// (counted in the record), the ISR never waits
+// FFT: CMSIS arm_rfft_fast_f32 on teensy, a radix-2 FFT on host
+//
+#ifndef LTSA_H
+#define LTSA_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "binfile.h"
+#include "store.h" // msbCorrect
+
+#ifdef __arm__
+  #define ARM_MATH_CM4
+  #include "arm_math.h"
+#endif
+
+/*
+ * raw  1 if input is uncorrected ICS43432 data (MSB correction is done here)
+ * nfft FFT length (power of 2, 32..4096 for CMSIS)
+ */
+template <int raw, int nfft>
+class c_ltsa
+{
+public:
+  enum { NBIN = nfft/2 };
+
+  c_ltsa(void) : fill(0), pos(0), ready(0), nlost(0), nframe(0), navg(1) {;}
+
+  void init(float fsamp, float tavg)
+  { for(int ii=0; ii<nfft; ii++) win[ii] = 0.5f - 0.5f*cosf(2.0f*(float)M_PI*ii/nfft);
+    float sw = 0; for(int ii=0; ii<nfft; ii++) sw += win[ii];
+    norm = 4.0f/(sw*sw)/(8388608.0f*8388608.0f); // full scale sine is 1
+    navg = (uint32_t)(tavg*fsamp/nfft + 0.5f); if(!navg) navg = 1;
+    memset(acc, 0, sizeof(acc));
+    nframe = 0; nlost = 0;
+    pos = 0; ready = 0;
+    #ifdef __arm__
+      arm_rfft_fast_init_f32(&rfft, nfft);
+    #endif
+  }
+
+  /*
+   * producer (ISR)
+   * src   input samples, next sample at src[step]
+   */
+  void put(const int32_t *src, int nsamp, int step)
+  { float *dst = frame[fill];
+    for(int ii=0; ii<nsamp; ii++)
+    { int32_t v = src[ii*step];
+      if(raw) v = msbCorrect(v);
+      dst[pos++] = (float) v;
+      if(pos == nfft)
+      { pos = 0;
+        if(ready) { nlost++; continue; } // loop() is late, overwrite this frame
+        ready = fill+1;
+        fill ^= 1;
+        dst = frame[fill];
+      }
+    }
+  }
+
+  /*
+   * consumer (loop)
+   * returns record with average (rtc to be filled in by caller) when tavg is complete, else 0
+   */
+  ltsa_rec_s *process(void)
+  { if(!ready) return 0;
+    const float *src = frame[ready-1];
+    for(int ii=0; ii<nfft; ii++) work[ii] = src[ii]*win[ii];
+    ready = 0; // frame may be reused by ISR
+    spectrum();
+    if(++nframe < navg) return 0;
+
+    ltsa_rec_s *rec = (ltsa_rec_s *) record;
+    uint8_t *level = (uint8_t *)(rec+1);
+    rec->rtc = 0;
+    rec->nframe = nframe;
+    rec->nlost = nlost > 0xffff? 0xffff : nlost;
+    float scale = norm/nframe;
+    for(int ii=0; ii<NBIN; ii++)
+    { float db = 10.0f*log10f(acc[ii]*scale + 1e-30f);
+      float lv = (db - LTSA_DBMIN)/LTSA_DBSTEP;
+      level[ii] = (lv < 0)? 0 : (lv > 255)? 255 : (uint8_t)(lv + 0.5f);
+      acc[ii] = 0;
+    }
+    nframe = 0; nlost = 0;
+    return rec;
+  }
+
+  uint32_t frames(void) { return navg; } // frames per record
+  uint32_t recordSize(void) { return sizeof(ltsa_rec_s) + NBIN; }
+
+private:
+  float frame[2][nfft];   // filled by ISR
+  int fill, pos;          // frame and sample being filled
+  volatile int ready;     // 1+index of frame waiting for loop(), 0 if none
+  volatile uint32_t nlost;
+  uint32_t nframe, navg;
+  float win[nfft];
+  float work[nfft];
+  float acc[NBIN];
+  float norm;
+  uint8_t record[sizeof(ltsa_rec_s) + NBIN] __attribute__((aligned(4)));
+
+#ifdef __arm__
+  arm_rfft_fast_instance_f32 rfft;
+  float out[nfft];
+
+  void spectrum(void)
+  { arm_rfft_fast_f32(&rfft, work, out, 0);
+    acc[0] += out[0]*out[0]; // DC (out[1] is Nyquist, not used)
+    for(int ii=1; ii<NBIN; ii++) acc[ii] += out[2*ii]*out[2*ii] + out[2*ii+1]*out[2*ii+1];
+  }
+#else
+  float im[nfft];
+
+  void spectrum(void)
+  { // in-place radix-2 FFT of real input
+    float *re = work;
+    for(int ii=0; ii<nfft; ii++) im[ii] = 0;
+    for(int ii=1, jj=0; ii<nfft; ii++)
+    { int bit = nfft >> 1;
+      for(; jj & bit; bit >>= 1) jj ^= bit;
+      jj ^= bit;
+      if(ii < jj) { float t = re[ii]; re[ii] = re[jj]; re[jj] = t; }
+    }
+    for(int len=2; len<=nfft; len<<=1)
+    { float ang = -2.0f*(float)M_PI/len;
+      for(int ii=0; ii<nfft; ii+=len)
+        for(int kk=0; kk<len/2; kk++)
+        { float wr = cosf(ang*kk), wi = sinf(ang*kk);
+          int a = ii+kk, b = ii+kk+len/2;
+          float tr = re[b]*wr - im[b]*wi, ti = re[b]*wi + im[b]*wr;
+          re[b] = re[a]-tr; im[b] = im[a]-ti;
+          re[a] += tr; im[a] += ti;
+        }
+    }
+    for(int ii=0; ii<NBIN; ii++) acc[ii] += re[ii]*re[ii] + im[ii]*im[ii];
+  }
+#endif
+};
+
+#endif
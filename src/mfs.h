@@ -23,81 +23,24 @@
 #define MFS_H
 /************************** File System Interface****************/
 #include "SdFs.h"
+#include <string.h>
 
 // Preallocate 40MB file.
 const uint64_t PRE_ALLOCATE_SIZE = 40ULL << 20;
 
 // Use FIFO SDIO or DMA_SDIO
-//#define SD_CONFIG SdioConfig(FIFO_SDIO)
-#define SD_CONFIG SdioConfig(DMA_SDIO)
+#ifdef RAW_WRITE
+  // raw streaming keeps a multi-sector write open across buffers (needs FIFO mode)
+  #define SD_CONFIG SdioConfig(FIFO_SDIO)
+  #define RAW_MODE 1
+#else
+  //#define SD_CONFIG SdioConfig(FIFO_SDIO)
+  #define SD_CONFIG SdioConfig(DMA_SDIO)
+  #define RAW_MODE 0
+#endif
 
 //--------------------- For File Time settings ------------------
-#include <time.h>
-#define EPOCH_YEAR 1970 //T3 RTC
-#define LEAP_YEAR(Y) (((EPOCH_YEAR+Y)>0) && !((EPOCH_YEAR+Y)%4) && ( ((EPOCH_YEAR+Y)%100) || !((EPOCH_YEAR+Y)%400) ) )
-static  const uint8_t monthDays[]={31,28,31,30,31,30,31,31,30,31,30,31}; 
-
-/*  int  tm_sec;
-  int tm_min;
-  int tm_hour;
-  int tm_mday;
-  int tm_mon;
-  int tm_year;
-  int tm_wday;
-  int tm_yday;
-  int tm_isdst;
-*/
-
-struct tm seconds2tm(uint32_t tt)
-{ struct tm tx;
-  tx.tm_sec   = tt % 60;    tt /= 60; // now it is minutes
-  tx.tm_min   = tt % 60;    tt /= 60; // now it is hours
-  tx.tm_hour  = tt % 24;    tt /= 24; // now it is days
-  tx.tm_wday  = ((tt + 4) % 7) + 1;   // Sunday is day 1 (tbv)
-
-  // tt is now days since EPOCH_Year (1970)
-  uint32_t year = 0;  
-  uint32_t days = 0;
-  while((unsigned)(days += (LEAP_YEAR(year) ? 366 : 365)) <= tt) year++;
-
-  tx.tm_year = 1970+year; // year is NOT offset from 1970 
-
-  // correct for last (actual) year
-  days -= (LEAP_YEAR(year) ? 366 : 365);
-  tt  -= days; // now tt is days in this year, starting at 0
-  
-  uint32_t mm=0;
-  uint32_t monthLength=0;
-  for (mm=0; mm<12; mm++) 
-  { monthLength = monthDays[mm];
-    if ((mm==1) & LEAP_YEAR(year)) monthLength++; 
-    if (tt<monthLength) break;
-    tt -= monthLength;
-  }
-  tx.tm_mon = mm + 1;   // jan is month 1  
-  tx.tm_mday = tt + 1;     // day of month
-  return tx;
-}
-
-uint32_t tm2seconds (struct tm *tx) 
-{
-  uint32_t tt;
-  tt=tx->tm_sec+tx->tm_min*60+tx->tm_hour*3600;  
-
-  // count days size epoch until previous midnight
-  uint32_t days=tx->tm_mday-1;
-
-  uint32_t mm=0;
-  uint32_t monthLength=0;
-  for (mm=0; mm<(tx->tm_mon-1); mm++) days+=monthDays[mm]; 
-  if(tx->tm_mon>2 && LEAP_YEAR(tx->tm_year-1970)) days++;
-
-  uint32_t years=0;
-  while(years++ < (tx->tm_year-1970)) days += (LEAP_YEAR(years) ? 366 : 365);
-  //  
-  tt+=(days*24*3600);
-  return tt;
-}
+#include "rtctime.h"
 
 // Call back for file timestamps.  Only called for file create and sync().
 void dateTime(uint16_t* date, uint16_t* time) {
@@ -121,9 +64,89 @@ class c_mFS
 {
   private:
   SdFs sd;
-  FsFile file;
+  FsFile fileA, fileB;
+  FsFile aux;             // small files that are appended to (e.g. LTSA)
+  FsFile *file = &fileA;  // file being written
+  FsFile *spare = &fileB; // pre-opened next file or previous file waiting to be closed
+  uint16_t spareStatus = 0; // 0: free, 1: next file open and pre-allocated, 2: previous file to be closed
+
+  // raw streaming: data go directly into the contiguous pre-allocated extent of the file
+  // the multi-sector write stays open on the card over many buffers and is only
+  // stopped for other file system operations
+  // raw sectors bypass the file system, so the length in the directory entry does not
+  // follow them and SdFat refuses seekSet() past it; raw writes are therefore limited to
+  // the length the file has after preAllocate() (FAT: the pre-allocated size), and on
+  // close seekSet() and truncate() set the length (public API only); where preAllocate()
+  // leaves the length at 0 (exFAT valid length), the file is written with FsFile::write
+  int16_t rawActive = 0;  // actual file is written raw
+  int16_t rawOpen = 0;    // multi-sector write is open
+  uint32_t rawSector = 0; // next sector to write
+  uint32_t rawEnd = 0;    // first sector after extent (or after file length)
+  uint32_t rawCount = 0;  // bytes in rawBuf
+  uint64_t rawBytes = 0;  // bytes written into actual file
+  uint8_t rawBuf[512] __attribute__((aligned(4))); // partial sector
+
+  uint16_t rawBegin(void)
+  { uint32_t bgn, end;
+    rawActive = rawOpen = 0;
+    rawCount = 0;
+    rawBytes = 0;
+    if(!RAW_MODE || !rawMode || !file->contiguousRange(&bgn, &end)) return 0;
+    uint64_t nsect = file->fileSize()/512; // sectors that seekSet() can reach
+    if(!nsect) return 0;
+    rawSector = bgn;
+    rawEnd = (nsect < (uint64_t)(end+1-bgn))? bgn + (uint32_t) nsect : end+1;
+    rawActive = 1;
+    return 1;
+  }
+
+  void rawStop(void)
+  { if(rawOpen) sd.card()->writeStop();
+    rawOpen = 0;
+  }
+
+  uint16_t rawPut(const uint8_t *src)
+  { if(rawSector >= rawEnd) return 0;
+    if(!rawOpen && !sd.card()->writeStart(rawSector)) return 0;
+    rawOpen = 1;
+    if(!sd.card()->writeData(src)) return 0;
+    rawSector++;
+    return 1;
+  }
+
+  uint16_t rawClose(void)
+  { // write partial sector, stop streaming and leave file position at end of data (truncate() sets length)
+    if(!rawActive) return 1;
+    rawActive = 0;
+    if(rawCount)
+    { memset(rawBuf+rawCount, 0, 512-rawCount);
+      if(!rawPut(rawBuf)) return 0;
+      rawCount = 0;
+    }
+    rawStop();
+    return file->seekSet(rawBytes); // within length, see rawBegin()
+  }
+
+  uint32_t rawWrite(uint8_t *buffer, uint32_t nbuf)
+  { uint32_t nn = nbuf;
+    if(rawCount)
+    { uint32_t nc = 512-rawCount; if(nc > nn) nc = nn;
+      memcpy(rawBuf+rawCount, buffer, nc);
+      rawCount += nc; buffer += nc; nn -= nc;
+      if(rawCount == 512)
+      { if(!rawPut(rawBuf)) return 0;
+        rawCount = 0;
+      }
+    }
+    for(; nn >= 512; nn -= 512, buffer += 512) if(!rawPut(buffer)) return 0;
+    if(nn) { memcpy(rawBuf, buffer, nn); rawCount = nn; }
+    rawBytes += nbuf;
+    return nbuf;
+  }
   
   public:
+    int16_t rawMode = RAW_MODE; // write data files raw (if contiguous), only with RAW_WRITE
+
     void init(void)
     { if(FS_started) return;
       if (!sd.begin(SD_CONFIG)) sd.errorHalt("begin failed");
@@ -135,43 +158,110 @@ class c_mFS
     
     void open(char * filename)
     {
-      if (!file.open(filename, O_CREAT | O_TRUNC |O_RDWR)) {
+      if (!file->open(filename, O_CREAT | O_TRUNC |O_RDWR)) {
         sd.errorHalt("file.open failed");
       }
-      if (!file.preAllocate(PRE_ALLOCATE_SIZE)) {
+      if (!file->preAllocate(PRE_ALLOCATE_SIZE)) {
         sd.errorHalt("file.preAllocate failed");    
       }
+      rawBegin();
     }
 
-    uint16_t open(char * filename, uint8_t flags)
+    uint16_t open(char * filename, int flags)
     {
-      return (uint16_t) file.open(filename, flags);
+      rawActive = 0;
+      return (uint16_t) file->open(filename, flags);
     }
 
     void close(void)
     {
-      file.truncate();
-      file.close();
+      if (!rawClose()) sd.errorHalt("raw close failed");
+      file->truncate();
+      file->close();
+    }
+
+    // file rotation without closing/opening files at the switch
+    // prepare() opens and pre-allocates the next file while the current one is written
+    // swap() makes the prepared file current, the previous file is closed by finish()
+    uint16_t hasNext(void) { return spareStatus == 1; }
+
+    uint16_t prepare(char * filename)
+    {
+      if(spareStatus) return 0;
+      rawStop();
+      if (!spare->open(filename, O_CREAT | O_TRUNC |O_RDWR)) return 0;
+      if (!spare->preAllocate(PRE_ALLOCATE_SIZE)) { spare->remove(); return 0; }
+      spareStatus = 1;
+      return 1;
+    }
+
+    uint16_t swap(void)
+    {
+      if(spareStatus != 1) return 0;
+      if (!rawClose()) sd.errorHalt("raw close failed");
+      FsFile *tmp = file; file = spare; spare = tmp;
+      spareStatus = 2;
+      rawBegin();
+      return 1;
+    }
+
+    uint16_t finish(void)
+    { // returns 1 if previous file had to be closed
+      if(spareStatus != 2) return 0;
+      rawStop();
+      spare->truncate();
+      spare->close();
+      spareStatus = 0;
+      return 1;
+    }
+
+    void discard(void)
+    { // close previous and remove unused next file
+      finish();
+      rawStop();
+      if(spareStatus == 1) { spare->remove(); spareStatus = 0; }
     }
 
     uint32_t write(uint8_t *buffer, uint32_t nbuf)
     {
-      if (nbuf != file.write(buffer, nbuf)) sd.errorHalt("write failed");
+      if(rawActive)
+      { // continue with file system if data would not fit into extent
+        if(rawSector + (rawCount+nbuf+511)/512 <= rawEnd)
+        { if (nbuf != rawWrite(buffer, nbuf)) sd.errorHalt("raw write failed");
+          return nbuf;
+        }
+        if (!rawClose()) sd.errorHalt("raw close failed");
+      }
+      if (nbuf != file->write(buffer, nbuf)) sd.errorHalt("write failed");
       return nbuf;
     }
 
     uint32_t read(uint8_t *buffer, uint32_t nbuf)
     {      
-      if ((int)nbuf != file.read(buffer, nbuf)) sd.errorHalt("read failed");
+      if ((int)nbuf != file->read(buffer, nbuf)) sd.errorHalt("read failed");
       return nbuf;
     }
 
+    uint32_t size(void) { return (uint32_t) file->fileSize(); }
+
+    uint16_t append(char *filename, void *head, uint32_t nhead, void *buffer, uint32_t nbuf)
+    { // append to file (head is written first if file is new), file is closed again
+      rawStop();
+      if (!aux.open(filename, O_CREAT | O_WRITE | O_APPEND)) return 0;
+      uint16_t ok = 1;
+      if (!aux.fileSize() && nhead != aux.write(head, nhead)) ok = 0;
+      if (ok && nbuf != aux.write(buffer, nbuf)) ok = 0;
+      aux.close();
+      return ok;
+    }
+
     void logText(char *filename, char * txt)
-    { int nbuf=0;
+    { size_t nbuf=0;
       char *ptr=txt; while(*ptr++) nbuf++; // length of text without trailing zero (?)
-      if (!file.open(filename, O_CREAT | O_WRITE |O_APPEND)) sd.errorHalt("logText file.open failed");
-      if (nbuf != file.write((uint8_t *)txt, nbuf)) sd.errorHalt("logText file.write failed");
-      file.close();
+      rawActive = 0;
+      if (!file->open(filename, O_CREAT | O_WRITE |O_APPEND)) sd.errorHalt("logText file.open failed");
+      if (nbuf != file->write((uint8_t *)txt, nbuf)) sd.errorHalt("logText file.write failed");
+      file->close();
     }
 };
 #endif
@@ -72,67 +72,154 @@ typedef struct
 parameters_s parameters={ON_TIME,OFF_TIME,T1,T2,T3,T4,"WMXZ"};
 uint16_t par_mods=0;
 
+// acquisition configuration (kept in Config.txt after parameters, changed in menu)
+// is applied at boot by acqConfig()
+typedef struct
+{
+  uint32_t fsamp;     // I2S sampling frequency
+  uint16_t chanMask;  // logged I2S slots (bit ii is slot ii)
+  uint16_t nq;        // blocks in logger queue (power of 2), 0: as many as fit (at least 256/channels)
+  uint16_t naud;      // blocks per write, 0: 64/channels (16 kB write buffer), queue holds at least two writes
+} acq_s;
+
 #define DO_DEBUG 2 
+//#define DO_PROFILE // measure cycles of ISR stages, reported every second by acqLoop (with DO_DEBUG)
+                     // instrumentation only: adds cycle counter reads to the ISR; enable here
+                     // or with -DDO_PROFILE (esmsim: make bin/esmsim SIMFLAGS=-DDO_PROFILE)
 
 #if ON_TIME >0
   #undef DO_DEBUG
   #define DO_DEBUG 2
 #endif
 
-// enable either logger
-// or USB_AUDIO
+// enable logger, USB_AUDIO (monitoring) or both
+// both sinks are fed from the same I2S block; logging has priority (USB is dropped
+// while the logger is short of time, see usbAudio_allowed)
 #define DO_LOGGER
+//#define DO_USB_AUDIO
 
-#ifndef DO_LOGGER
+#if !defined(DO_LOGGER) && !defined(DO_USB_AUDIO)
   #define DO_USB_AUDIO
 #endif
 
-// some definitions
-#define F_SAMP 44100 // tested with F_CPU=180MHz
-#define N_CHAN 1   // number of channels can be 1, 2, 4 // effects only logging
+// some definitions (may be given on command line, e.g. for host simulation)
+#ifndef F_SAMP
+  #define F_SAMP 44100 // tested with F_CPU=180MHz
+#endif
+#ifndef N_CHAN
+  #define N_CHAN 1   // number of channels can be 1, 2, 4 // effects only logging
+#endif
+// F_SAMP and N_CHAN (CHAN_MASK), NQ and NAUD are only the defaults of the
+// acquisition configuration (acq), which is read from Config.txt at boot
+#ifndef CHAN_MASK
+  #define CHAN_MASK ((N_CHAN==1)? 0x1 : (N_CHAN==2)? 0x3 : 0xF) // logged I2S slots
+#endif
+#ifndef NQ
+  #define NQ 0    // number of elements in queue (power of 2), 0: as many as fit into arena
+                  // but not fewer than the former compile time default 256/channels
+#endif
+#ifndef NAUD
+  #define NAUD 0  // blocks per write, 0: 64/channels (16 kB write buffer)
+#endif
 
 
 #ifdef DO_USB_AUDIO
   #define AUDIO_SHIFT 4 // shift to right (or attenuation)
   #define ICHAN_LEFT  0 // index for left usb_audio channel
   #define ICHAN_RIGHT 0 // index for right usb_audio channel
+  #define USB_HOLD 64   // I2S blocks USB stays dropped after the logger was short of time
 #endif
 
 #ifdef DO_LOGGER
-  // for AudioRecordLogger
-  #define NQ  (300/N_CHAN) // number of elements in queue
-  // NCH*NQ should be <300 (for about 200 kB RAM usage and 32 bit words) 
-  
+  // write directly from queue to disk (copy only when write buffer wraps around queue)
+  #define ZERO_COPY
+
+  // add block index records (sequence number, I2S interrupt count and cycle counter
+  // for each write buffer) to data stream
+  //#define BLOCK_INDEX
+
+  // lossless compression of blocks before writing to disk (replaces PACK_24)
+  //#define COMPRESS
+
+  // decimation of logged data by integer factor (2..8), 1 is no decimation
+  // (polyphase FIR low-pass, logged sampling frequency is F_SAMP/DECIMATE)
+  #ifndef DECIMATE
+    #define DECIMATE 1
+  #endif
+
+  // write directly into sectors of pre-allocated file (instead of FsFile::write)
+  //#define RAW_WRITE
+
+  // benchmark of uSD writes at startup (MB per pass)
+  //#define SD_BENCH 20
+
+  // add write latency trace records (duration of each card operation) to data stream
+  // (tools/esmtrace replays them to find the smallest NQ)
+  //#define SD_TRACE
+
+  // event triggered recording: blocks are written only from TRIG_PRE s before to
+  // TRIG_POST s after a detection (band energy, see detector.h), otherwise the queue
+  // holds the pre-trigger history and the card is idle; unwritten blocks are
+  // announced by gap records (cause GAP_IDLE)
+  //#define TRIGGER
+  #ifdef TRIGGER
+    #define TRIG_PRE  0.25f // s, must fit into nq-2*naud blocks (checked by acqConfig)
+    #define TRIG_POST 5.0f  // s
+    #define TRIG_FLO  2000  // Hz, band of detector
+    #define TRIG_FHI  8000  // Hz
+    #define TRIG_SNR  12    // dB above noise floor
+    #define TRIG_TAU  10    // s, time constant of noise floor
+  #endif
+
+  // long-term spectral average of the first logged channel: LTSA_TAVG s averages of
+  // LTSA_NFFT/2 bins (one byte each), appended to a daily file <name>_YYYYMMDD.lts
+  // with LTSA_ONLY no audio is written (only the spectrum files)
+  //#define DO_LTSA
+  #ifdef DO_LTSA
+    #define LTSA_NFFT  512
+    #define LTSA_TAVG  1.0f // s
+    #define LTSA_BATCH 8    // records per append
+    //#define LTSA_ONLY
+  #endif
+
+  // sound level meter of all logged channels: rms (Leq, loudest and quietest block),
+  // peak and clipped samples over SPL_TAVG s, appended to a daily file <name>_YYYYMMDD.spl
+  // with SPL_ONLY no audio is written (only the level files)
+  //#define DO_SPL
+  #ifdef DO_SPL
+    #define SPL_TAVG  1.0f // s
+    #define SPL_BATCH 120  // records per append
+    //#define SPL_ONLY
+  #endif
+  #if (defined(DO_SPL) && defined(SPL_ONLY)) || (defined(DO_LTSA) && defined(LTSA_ONLY))
+    #define NO_AUDIO // logger runs the schedule, but no audio stream is kept or written
+  #endif
+
   // for uSD_Logger
-  #define MAX_MB 40   // max (expected) file size in MB // is also file size if ON_TIME==0
+  #ifndef MAX_MB
+    #define MAX_MB 40   // max (expected) file size in MB // is also file size if ON_TIME==0
+  #endif
 #endif
 /***********************************************************************/
 #include "ICS43432.h" // defines also N_BITS
 
 // Note: 
-// change either F_CPU or F_SAMP if I2S setup fails to configure
-// i.e. there are no DMA interrupts and 'i2sInProcessing' is not running
-// typically this happens if the clock generation has a too high multiplier
-// e.g. F_CPU=168 MHz and F_SAMP =  96000 fails to run (cannot find proper dividers)
-//  but F_CPU=168 MHz and F_SAMP = 100000 runs fine
+// the I2S dividers are searched exhaustively for an exact rate (i2sdiv.h, dividers of
+// the standard rates are tables for F_CPU); if the rate cannot be met within ICS_MAX_PPM
+// acqSetup fails, tools/esmi2sdiv lists the F_CPU that give an exact rate
+// e.g. F_CPU=168 MHz and F_SAMP = 96000 is exact (FRACT 63, DIVIDE 874, DIV 0)
 //
 
 /********************** I2S parameters *******************************/
 c_ICS43432 ICS43432;
 #define MSB_CORRECTION
+#define PACK_24 // store only 24 significant bits (3 bytes) of MSB corrected samples
+//#define PACK_16 // store only upper 16 of the 24 significant bits (2 bytes, replaces PACK_24)
 
 extern "C" void i2sInProcessing(void * s, void * d);
 
 #define N_SAMP 128
-#if N_CHAN== 1
-  #define ICH 0 // is 0 for first channel
-#endif
-
-#if N_CHAN<=2
-  #define I2S_CHAN 2
-#else
-  #define I2S_CHAN 4
-#endif
+#define I2S_MAX 4 // most I2S channels (two data lines)
 
 #if N_BITS == 32
   typedef int32_t DATA_T;
@@ -140,9 +227,14 @@ extern "C" void i2sInProcessing(void * s, void * d);
   typedef int16_t DATA_T;
 #endif
 
-#define N_BUF (2 * I2S_CHAN * N_SAMP)    // dual buffer size for DMA 
+acq_s acq={F_SAMP, CHAN_MASK, NQ, NAUD};
+const acq_s acqDefault={F_SAMP, CHAN_MASK, NQ, NAUD};
 
-DATA_T i2s_rx_buffer[N_BUF];          // buffer for DMA
+// derived from acq by acqConfig()
+uint32_t nChan;    // logged channels
+uint32_t iChan;    // I2S slot of first logged channel
+uint32_t i2sChan;  // I2S channels (2 or 4)
+DATA_T *i2s_rx_buffer; // dual buffer for DMA (2*i2sChan*N_SAMP, in arena)
 
 
 //------------------------ Asynchronous Blink ------------------------------
@@ -169,23 +261,61 @@ uint32_t i2sProcCount=0;
 uint32_t i2sBusyCount=0;
 uint32_t i2sWriteErrorCount=0;
 
-inline void mCopy(int32_t *dst, int32_t *src, uint32_t len)
-{ for(uint32_t ii=0;ii<len;ii++) dst[ii]=src[ii];
+#include "profile.h"
+c_profile profIsr; // i2sInProcessing
+c_profile profMsb; // MSB correction
+c_profile profLog; // logger (extract, decimate, pack or copy into queue)
+c_profile profDec; // decimation (part of logger)
+c_profile profDet; // trigger detector
+c_profile profLts; // LTSA (frame copy in ISR)
+c_profile profSpl; // sound level meter
+c_profile profUsb; // usb audio (extract into ring)
+c_profile profRes; // usb audio resampler (audio update, after the ISR)
+#define I2S_BUDGET ((float)PROFILE_RATE*N_SAMP/acq.fsamp) // clock ticks between I2S interrupts
+
+#ifdef DO_PROFILE
+static void profPrint(const char *name, c_profile *prof, uint32_t nsamp=0)
+{ // nsamp > 0: also mean per sample (nsamp samples per call)
+  if(!prof->calls()) return;
+  Serial.printf("     %s: %d %d %d %s (%.1f%%)", name,
+          prof->min(), prof->mean(), prof->max(), PROFILE_UNIT,
+          100.0f*prof->mean()/I2S_BUDGET);
+  if(nsamp) Serial.printf(" %.1f per sample", (float)prof->mean()/nsamp);
+  Serial.printf("\n\r");
+  prof->reset();
+}
+
+#if defined(DO_LOGGER) && defined(DO_USB_AUDIO)
+static float profShare(c_profile *prof, uint32_t nisr)
+{ // percent of the time of nisr I2S interrupts
+  return nisr? 100.0f*prof->total()/((float)nisr*I2S_BUDGET) : 0.0f;
 }
+#endif
+#endif
+
+#ifdef DO_USB_AUDIO
+  inline void usbPrint(void); // USB audio state
+#endif
 
 inline uint16_t acqSetup(void)
 {
+  #ifdef DO_PROFILE
+    profileInit();
+  #endif
   // initialize and start ICS43432 interface
-  uint32_t fs = ICS43432.init(F_SAMP, i2s_rx_buffer, N_BUF, I2S_CHAN);
+  uint32_t fs = ICS43432.init(acq.fsamp, i2s_rx_buffer, 2*i2sChan*N_SAMP, i2sChan);
   if(fs>0)
   {
     #if DO_DEBUG>0
-      Serial.printf("Fsamp requested: %.3f kHz  got %.3f kHz\n\r" ,
-          F_SAMP/1000.0f, fs/1000.0f);
+      Serial.printf("Fsamp requested: %.3f kHz  got %.6f kHz (%.3f ppm)\n\r" ,
+          acq.fsamp/1000.0f, ICS43432.fs/1000.0, ICS43432.ppm);
       Serial.flush();
     #endif
     return 1;
   }
+  #if DO_DEBUG>0
+    Serial.printf("Fsamp %d Hz: no I2S dividers (nearest %.3f ppm)\n\r", acq.fsamp, ICS43432.ppm);
+  #endif
   return 0;
 }
 
@@ -210,21 +340,45 @@ inline void acqExit(void)
 }
 
 inline void acqLoop(void)
-{
+{ // called by loop(), also while logging (loggerLoop)
   static uint32_t t0=0;
   static uint32_t loopCount=0;
 
   uint32_t t1=millis();
   if (t1-t0>1000) // log to serial every second
   { static uint32_t icount=0;
+    // counts of the last second (the totals are kept, e.g. for the simulation)
+    static uint32_t proc0=0, busy0=0, error0=0;
+    uint32_t nproc=i2sProcCount-proc0, nbusy=i2sBusyCount-busy0, nerror=i2sWriteErrorCount-error0;
+    proc0+=nproc; busy0+=nbusy; error0+=nerror;
     #if DO_DEBUG>0
       Serial.printf("%4d %d %d %d %d %d %.3f kHz\n\r",
-            icount, loopCount, i2sProcCount,i2sBusyCount, i2sWriteErrorCount, 
-            N_SAMP,((float)N_SAMP*(float)i2sProcCount/1000.0f));
+            icount, loopCount, nproc, nbusy, nerror, 
+            N_SAMP,((float)N_SAMP*(float)nproc/1000.0f));
+      #ifdef DO_PROFILE
+        #if defined(DO_LOGGER) && defined(DO_USB_AUDIO)
+        { // both sinks together, of all I2S interrupts (USB is not run when dropped)
+          uint32_t nisr = profIsr.calls();
+          float plog = profShare(&profIsr, nisr) - profShare(&profUsb, nisr);
+          float pusb = profShare(&profUsb, nisr) + profShare(&profRes, nisr);
+          Serial.printf("     log+usb: %.1f%% + %.1f%% = %.1f%% of I2S budget\n\r", plog, pusb, plog+pusb);
+        }
+        #endif
+        // min mean max (mean relative to time between I2S interrupts)
+        profPrint("isr", &profIsr);
+        profPrint("msb", &profMsb);
+        profPrint("log", &profLog);
+        profPrint("dec", &profDec, nChan*N_SAMP); // input samples of logged channels
+        profPrint("det", &profDet);
+        profPrint("lts", &profLts);
+        profPrint("spl", &profSpl);
+        profPrint("usb", &profUsb);
+        profPrint("res", &profRes);
+      #endif
+      #ifdef DO_USB_AUDIO
+        usbPrint();
+      #endif
     #endif
-    i2sProcCount=0;
-    i2sBusyCount=0;
-    i2sWriteErrorCount=0;
     loopCount=0;
     t0=t1;
     icount++;
@@ -236,18 +390,198 @@ inline void acqLoop(void)
 /*******************Logger Interface*******************************************/
 #ifdef DO_LOGGER
   #include "logger.h"
-  // for uSD_Logger write buffer
-  // the sequence (64,32,16) is for 16kB write buffer
-  #if N_CHAN==1
-    #define NAUD 64
-  #elif N_CHAN==2
-    #define NAUD 32
-  #elif N_CHAN==4
-    #define NAUD 16
+  #ifdef SD_BENCH
+    #include "sdbench.h"
+  #endif
+  #if N_BITS != 32
+    #error "logger requires 32 bit I2S data"
+  #endif
+  #if defined(COMPRESS)
+    #define LOG_FMT FMT_RICE
+    typedef DATA_T LOG_T;
+  #elif defined(PACK_16)
+    // 2 bytes per sample
+    #define LOG_FMT FMT_INT16
+    typedef int16_t LOG_T;
+  #elif defined(PACK_24)
+    // 3 bytes per sample
+    #define LOG_FMT FMT_PACK24
+    typedef uint8_t LOG_T;
+  #else
+    #define LOG_FMT FMT_INT32
+    typedef DATA_T LOG_T;
+  #endif
+  Logger<LOG_T> logger; // geometry is set by acqConfig()
+
+  #if defined(MSB_CORRECTION) && (DECIMATE == 1) && !defined(NO_AUDIO)
+    #define STORE_MSB_CORRECTION // MSB correction is done by the store kernel (only logged channels)
+    #define STORE_RAW 1
+  #else
+    #define STORE_RAW 0
+  #endif
+
+  // fused MSB correction, channel extraction and store into the logger queue
+  #include "store.h"
+  #define STORE_FMT ((LOG_FMT == FMT_RICE)? FMT_INT32 : LOG_FMT) // queue of COMPRESS is 32 bit
+
+  #if DECIMATE > 1
+    #include "decimate.h"
+    #include <new>
+    void *decimator = 0;  // Decimator<nch,32> of configuration (in arena)
+    // decimated samples waiting to be logged (a full block plus output of one I2S block)
+    int32_t decBuffer[I2S_MAX*(N_SAMP+N_SAMP/2)];
+    int decCount=0;
+
+    template <int nch>
+    uint8_t *decimatorSetup(uint8_t *ptr)
+    { // 32 taps per polyphase branch
+      Decimator<nch, 32> *dec = new(ptr) Decimator<nch, 32>;
+      dec->init(DECIMATE);
+      decimator = dec;
+      decCount = 0;
+      return ptr + ((sizeof(Decimator<nch, 32>) + 7) & ~7);
+    }
+  #endif
+
+  /*
+   * logging of one I2S block, instantiated for each supported channel layout
+   * nch logged channels, nsrc I2S channels, src points to first logged slot
+   */
+  template <int nch, int nsrc>
+  void logBlockT(int32_t *src)
+  {
+    #if DECIMATE > 1
+      // decimate (filter state is kept between blocks) and log when a full block is available
+      PROF_START(profDec);
+      decCount += ((Decimator<nch, 32> *) decimator)->process(&decBuffer[nch*decCount], src, N_SAMP, nsrc);
+      PROF_STOP(profDec);
+
+      if(decCount >= N_SAMP)
+      {
+        void *logData = logger.reserve();
+        if(logData)
+        { c_store<nch, nch, STORE_FMT, 0>::store(logData, decBuffer, N_SAMP);
+          logger.commit();
+        }
+        else if(logger.isEnabled())
+        { // have write error
+          i2sWriteErrorCount++;
+        }
+        decCount -= N_SAMP;
+        for(int ii=0; ii<nch*decCount; ii++) decBuffer[ii]=decBuffer[nch*N_SAMP+ii];
+      }
+    #else
+      // correct, extract and store directly into queue (one pass)
+      void *logData = logger.reserve();
+      if(logData)
+      { c_store<nch, nsrc, STORE_FMT, STORE_RAW>::store(logData, src, N_SAMP);
+        logger.commit();
+      }
+      else if(logger.isEnabled())
+      { // have write error
+        i2sWriteErrorCount++;
+      }
+    #endif
+  }
+  void (*logBlock)(int32_t *src) = 0; // selected by acqConfig()
+
+  #ifdef TRIGGER
+    #include "detector.h"
+    #ifdef STORE_MSB_CORRECTION
+      Detector<1> detector; // sees uncorrected I2S data
+    #else
+      Detector<0> detector;
+    #endif
+  #endif
+
+  #if defined(DO_LTSA) || defined(DO_SPL)
+    void dayFile(char *filename, uint32_t day, const char *ext)
+    { // <name>_YYYYMMDD.<ext>
+      struct tm tx = seconds2tm(day*86400);
+      sprintf(filename, "%s_%04d%02d%02d.%s", (char *)parameters.name, tx.tm_year, tx.tm_mon, tx.tm_mday, ext);
+    }
+  #endif
+
+  #ifdef DO_LTSA
+    #include "ltsa.h"
+    #ifdef STORE_MSB_CORRECTION
+      c_ltsa<1, LTSA_NFFT> ltsa; // sees uncorrected I2S data
+    #else
+      c_ltsa<0, LTSA_NFFT> ltsa;
+    #endif
+    uint8_t ltsaBatch[LTSA_BATCH*(sizeof(ltsa_rec_s)+LTSA_NFFT/2)] __attribute__((aligned(4)));
+    uint32_t ltsaCount=0;  // records in batch
+    uint32_t ltsaDay=0;    // day of records in batch
+    uint32_t ltsaErrors=0;
+
+    void ltsaFlush(void)
+    { // append batch to file of the day
+      if(!ltsaCount) return;
+      char filename[40];
+      dayFile(filename, ltsaDay, "lts");
+      ltsa_header_s head;
+      memset(&head, 0, sizeof(head));
+      head.magic = LTSA_MAGIC; head.nmagic = ~LTSA_MAGIC;
+      head.fsamp = acq.fsamp; head.nfft = LTSA_NFFT; head.nbin = LTSA_NFFT/2;
+      head.nframe = ltsa.frames(); head.dbMin = LTSA_DBMIN; head.dbStep = LTSA_DBSTEP;
+      if(!mFS.append(filename, &head, sizeof(head), ltsaBatch, ltsaCount*ltsa.recordSize())) ltsaErrors++;
+      ltsaCount = 0;
+    }
+
+    void ltsaLoop(int16_t flush)
+    { // average spectra and write them in batches
+      ltsa_rec_s *rec = ltsa.process();
+      if(rec)
+      { rec->rtc = RTC_TSR;
+        if(ltsaCount && (rec->rtc/86400 != ltsaDay)) ltsaFlush();
+        ltsaDay = rec->rtc/86400;
+        memcpy(&ltsaBatch[ltsaCount*ltsa.recordSize()], rec, ltsa.recordSize());
+        if(++ltsaCount == LTSA_BATCH) ltsaFlush();
+      }
+      if(flush) ltsaFlush();
+    }
+  #endif
+
+  #ifdef DO_SPL
+    #include "spl.h"
+    #ifdef STORE_MSB_CORRECTION
+      c_spl<1, I2S_MAX> spl; // sees uncorrected I2S data
+    #else
+      c_spl<0, I2S_MAX> spl;
+    #endif
+    uint8_t splBatch[SPL_BATCH*(sizeof(spl_rec_s)+I2S_MAX*sizeof(spl_chan_s))] __attribute__((aligned(4)));
+    uint32_t splCount=0;  // records in batch
+    uint32_t splDay=0;    // day of records in batch
+    uint32_t splErrors=0;
+
+    void splFlush(void)
+    { // append batch to file of the day
+      if(!splCount) return;
+      char filename[40];
+      dayFile(filename, splDay, "spl");
+      spl_header_s head;
+      memset(&head, 0, sizeof(head));
+      head.magic = SPL_MAGIC; head.nmagic = ~SPL_MAGIC;
+      head.fsamp = acq.fsamp; head.nch = spl.channels(); head.nsamp = N_SAMP;
+      head.nblock = spl.blocks();
+      if(!mFS.append(filename, &head, sizeof(head), splBatch, splCount*spl.recordSize())) splErrors++;
+      splCount = 0;
+    }
+
+    void splLoop(int16_t flush)
+    { // collect level records and write them in batches
+      spl_rec_s *rec = spl.process();
+      if(rec)
+      { rec->rtc = RTC_TSR;
+        if(splCount && (rec->rtc/86400 != splDay)) splFlush();
+        splDay = rec->rtc/86400;
+        memcpy(&splBatch[splCount*spl.recordSize()], rec, spl.recordSize());
+        if(++splCount == SPL_BATCH) splFlush();
+      }
+      if(flush) splFlush();
+    }
   #endif
-  Logger<DATA_T, NQ, N_CHAN*N_SAMP, NAUD>  logger; 
 
-  DATA_T data1[N_SAMP];
   
 #endif
 
@@ -275,9 +609,10 @@ inline void acqLoop(void)
   
   #include "AudioInterface.h"   // contains function implementation
 
-  #define N_DAT (128*(F_SAMP/100)/441)  // number of samples per received DMA interrupt  
+  #define USB_FS_MAX 96000 // highest I2S rate for USB audio
+  #define N_DAT (128*USB_FS_MAX/44100+1)  // I2S samples per USB audio block
 
-  static uint32_t audioBuffer[3*N_DAT]; // 3 buffers for audio xfer (need at least 2)
+  static uint32_t audioBuffer[4*N_DAT]; // stereo frames, room for the latency target and two blocks owed
   c_buff audioStore(audioBuffer,sizeof(audioBuffer)/4);
   
   AudioInterface  interface(&audioStore,F_SAMP);
@@ -285,10 +620,16 @@ inline void acqLoop(void)
   AudioConnection patchCord1(interface,0,usb,0);
   AudioConnection patchCord2(interface,1,usb,1); 
 
-  inline void mExtract(int16_t *dst, int32_t *src, uint32_t len);
-  inline void usbAudio_write(int16_t *buf, uint32_t len);
+  #ifdef STORE_MSB_CORRECTION
+    #define USB_RAW 1 // I2S block is shared with the logger and not corrected in place
+  #else
+    #define USB_RAW 0
+  #endif
+
+  uint32_t usbDropCount=0; // I2S blocks not given to USB audio
 
-  int16_t dst16[I2S_CHAN * N_SAMP];  // buffer for onward processing
+  inline int usbAudio_allowed(void);
+  template <int raw> inline void usbAudio_write(const int32_t *src, uint32_t len);
 
 #endif
 
@@ -300,35 +641,64 @@ void i2sInProcessing(void * s, void * d)
 	static uint16_t is_I2S=0;
 
 	i2sProcCount++;
-	if(is_I2S) {i2sBusyCount++; return;}
+	if(is_I2S)
+	{ i2sBusyCount++;
+	  #ifdef DO_LOGGER
+	    logger.busyCount++;
+	  #endif
+	  return;
+	}
 	is_I2S=1;
+	PROF_START(profIsr);
  
 	int32_t *src = (int32_t *) d;
 
 	// for ICS43432 need first shift left to get correct MSB
 	// shift 8bit to right to get data-LSB to bit 0
-  #ifdef MSB_CORRECTION
-  	for(int ii=0; ii<I2S_CHAN*N_SAMP;ii++) { src[ii]<<=1; src[ii]>>=8;}
+  #if defined(MSB_CORRECTION) && !defined(STORE_MSB_CORRECTION)
+    PROF_START(profMsb);
+  	for(uint32_t ii=0; ii<i2sChan*N_SAMP;ii++) { src[ii]<<=1; src[ii]>>=8;}
+    PROF_STOP(profMsb);
   #endif
 
-	#ifdef DO_LOGGER
-    #if N_CHAN==1
-      DATA_T *logData = data1; 
-      for(int ii=0; ii< N_SAMP; ii++) logData[ii]=src[ICH+2*ii];
-    #else
-      DATA_T *logData = src;
+	#if defined(DO_LOGGER) && !defined(NO_AUDIO)
+    PROF_START(profLog);
+    logBlock(src+iChan);
+    PROF_STOP(profLog);
+  #endif
+
+  #ifdef DO_LOGGER
+    #ifdef TRIGGER
+      PROF_START(profDet);
+      if(detector.process(src+iChan, N_SAMP, i2sChan)) logger.trigger(); // first logged channel
+      PROF_STOP(profDet);
+    #endif
+
+    #ifdef DO_LTSA
+      PROF_START(profLts);
+      ltsa.put(src+iChan, N_SAMP, i2sChan); // first logged channel
+      PROF_STOP(profLts);
+    #endif
+
+    #ifdef DO_SPL
+      PROF_START(profSpl);
+      spl.put(src+iChan, N_SAMP, i2sChan);
+      PROF_STOP(profSpl);
     #endif
-		if(logger.write(logData)<0) //store always original data
-    { // have write error
-      i2sWriteErrorCount++;
-    }
 	#endif
 
 	#ifdef DO_USB_AUDIO
-    mExtract(dst16,src,ICS_CHAN*N_SAMP);
-		usbAudio_write(dst16,N_SAMP);
+    // after logging and from the same block (read only)
+    if(usbAudio_allowed())
+    { PROF_START(profUsb);
+      usbAudio_write<USB_RAW>(src,N_SAMP);
+      PROF_STOP(profUsb);
+    }
+    else
+      usbDropCount++;
 	#endif
 
+  PROF_STOP(profIsr);
   is_I2S=0;
   // 
   #ifdef DO_USB_AUDIO
@@ -341,26 +711,63 @@ void i2sInProcessing(void * s, void * d)
  * ********************************************************************************
  */
 #ifdef DO_USB_AUDIO
-	static int16_t waveform[2*N_SAMP]; // store for stereo usb-audio data
+	#include "store.h" // msbCorrect
 
 	inline void usbAudio_init(void)
 	{	AudioMemory(8);
+		interface.init(&audioStore, acq.fsamp);
+		#ifdef DO_PROFILE
+			interface.profile(&profRes);
+		#endif
+	}
+
+	inline int usbAudio_allowed(void)
+	{	// logging has priority: USB is dropped for USB_HOLD blocks whenever an I2S
+		// interrupt found the ISR busy or the logger queue fills (SD card is late)
+		static uint32_t hold=0, busy=0;
+		int late = (i2sBusyCount != busy);
+		busy = i2sBusyCount;
+		#ifdef DO_LOGGER
+			// backlog beyond the blocks the trigger keeps; drop above half of the
+			// remaining queue, resume below a quarter
+			uint32_t keep = 0;
+			#ifdef TRIGGER
+				keep = logger.trigPre;
+			#endif
+			uint32_t used = logger.available();
+			uint32_t room = (logger.queueSize > keep)? logger.queueSize - keep : 0;
+			uint32_t backlog = (used > keep)? used - keep : 0;
+			late |= backlog > (hold? room/4 : room/2);
+		#endif
+		if(late) hold = USB_HOLD;
+		else if(hold) hold--;
+		return !hold;
 	}
 
-	inline void usbAudio_write(int16_t *buf, uint32_t len)
-	{	// prepare data for USB-Audio
-		// extract data from I2S buffer
-		for(int ii=0; ii<len; ii++)
-		{	waveform[2*ii]  =(buf[ICHAN_LEFT +ii*I2S_CHAN]);
-			waveform[2*ii+1]=(buf[ICHAN_RIGHT+ii*I2S_CHAN]);
+	template <int raw>
+	inline void usbAudio_write(const int32_t *src, uint32_t len)
+	{	// slots ICHAN_LEFT and ICHAN_RIGHT of the I2S block to stereo frames in one pass
+		// (MSB correction if raw, scale, saturate to 16 bit), then onto audioStore
+		uint32_t frames[N_SAMP];
+		for(uint32_t ii=0; ii<len; ii++)
+		{	int32_t l = src[ICHAN_LEFT +ii*i2sChan];
+			int32_t r = src[ICHAN_RIGHT+ii*i2sChan];
+			if(raw) { l = msbCorrect(l); r = msbCorrect(r); }
+			l >>= AUDIO_SHIFT; r >>= AUDIO_SHIFT;
+			l = (l > 32767)? 32767 : (l < -32768)? -32768 : l;
+			r = (r > 32767)? 32767 : (r < -32768)? -32768 : r;
+			frames[ii] = (uint16_t) l | ((uint32_t)(uint16_t) r << 16);
 		}
-		// put data onto audioStore
-		audioStore.put((uint32_t *) waveform, N_SAMP); //  2x 16-bit channels
+		audioStore.put(frames, len); //  2x 16-bit channels
+	}
+
+	inline void usbPrint(void)
+	{	// once per second with the profiles
+		static uint32_t drop0=0;
+		Serial.printf("     usb: %d ppm, %d underruns, %d blocks dropped\n\r",
+				interface.ppm(), interface.underrun(), usbDropCount-drop0);
+		drop0 = usbDropCount;
 	}
- 
-   inline void mExtract(int16_t *dst, int32_t *src, uint32_t len)
-  { for(uint32_t ii=0;ii<len;ii++) dst[ii]=(src[ii]>>AUDIO_SHIFT);
-  }
 
 #endif
 
@@ -370,8 +777,31 @@ void i2sInProcessing(void * s, void * d)
 	{
 		header.nch = nch;
 		header.nsamp = nsamp;
-		header.fsamp = fsamp;
-    logger.init();
+		header.fsamp = fsamp/DECIMATE;
+		header.flags = HDR_GAPS | HDR_STATS | HDR_RATE;
+		header.fmt = LOG_FMT;
+    #ifdef BLOCK_INDEX
+      header.flags |= HDR_INDEX;
+    #endif
+    #ifdef SD_TRACE
+      header.flags |= HDR_TRACE;
+    #endif
+    #ifdef BLOCK_INDEX
+      // enable cycle counter
+      ARM_DEMCR |= ARM_DEMCR_TRCENA;
+      ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+    #endif
+    #ifdef TRIGGER
+      detector.init(fsamp, nsamp, TRIG_FLO, TRIG_FHI, TRIG_SNR, TRIG_TAU);
+      logger.trigPre = (uint32_t)(TRIG_PRE*fsamp/DECIMATE/nsamp);
+      logger.trigPost = (uint32_t)(TRIG_POST*fsamp/DECIMATE/nsamp);
+    #endif
+    #ifdef DO_LTSA
+      ltsa.init(fsamp, LTSA_TAVG);
+    #endif
+    #ifdef DO_SPL
+      spl.init(fsamp, nsamp, SPL_TAVG, nch);
+    #endif
 	}
  
   inline void loggerStart(void)
@@ -392,8 +822,104 @@ void i2sInProcessing(void * s, void * d)
       logger.stop();
   }
 
-	inline uint16_t loggerLoop(void){  return logger.save(MAX_MB);	}
+	inline uint16_t loggerLoop(void)
+  { 
+    #ifdef NO_AUDIO
+      int32_t ret = (logger.isRunning > 0)? 1 : -1; // no audio files
+    #else
+      int32_t ret = logger.save(MAX_MB);
+    #endif
+    #ifdef DO_LTSA
+      ltsaLoop(ret < 0); // write last records when logger has finished
+    #endif
+    #ifdef DO_SPL
+      splLoop(ret < 0);
+    #endif
+    acqLoop(); // ISR counts and profile
+    return ret;
+  }
+  inline void loggerStats(void){ logger.printStats(); }
+#endif
+
+/*************************** Acquisition configuration *******************************/
+// one arena holds the DMA buffer, the decimator and all logger buffers
+// the default is the former static usage: DMA buffer (4 kB), a queue of 256 single
+// channel blocks (32 kB per byte of sample) and room for records and options
+#ifndef ARENA_KB
+  #ifdef DO_LOGGER
+    #ifdef BLOCK_INDEX
+      #define ARENA_IDX_KB 6
+    #else
+      #define ARENA_IDX_KB 0
+    #endif
+    #ifdef COMPRESS
+      #define ARENA_CMP_KB 34
+    #else
+      #define ARENA_CMP_KB 0
+    #endif
+    #define ARENA_KB (4 + 32*c_store<1,1,STORE_FMT,0>::BYTES + 2 + ARENA_IDX_KB + ARENA_CMP_KB + 12*(DECIMATE>1))
+  #else
+    #define ARENA_KB 4
+  #endif
 #endif
+static uint8_t arena[ARENA_KB*1024] __attribute__((aligned(8)));
+
+/*
+ * sets up buffers and logging path for acq
+ * channel masks are single slots, the slot pairs 0x3 and 0xC or all four slots
+ * returns 0 if acq is not supported or does not fit into arena
+ */
+int acqConfig(void)
+{ uint32_t mask = acq.chanMask;
+  if(mask != 0x1 && mask != 0x2 && mask != 0x4 && mask != 0x8 &&
+     mask != 0x3 && mask != 0xC && mask != 0xF) return 0;
+  if(acq.fsamp < 8000 || acq.fsamp > 384000) return 0;
+  nChan = __builtin_popcount(mask);
+  iChan = __builtin_ctz(mask);
+  i2sChan = (mask & 0xC)? 4 : 2;
+
+  uint8_t *ptr = arena;
+  i2s_rx_buffer = (DATA_T *) ptr; ptr += 2*i2sChan*N_SAMP*sizeof(DATA_T);
+
+  #if defined(DO_LOGGER) && !defined(NO_AUDIO)
+    #if DECIMATE > 1
+      #define ACQ_CASE(nch, nsrc) logBlock = logBlockT<nch, nsrc>; ptr = decimatorSetup<nch>(ptr); break
+    #else
+      #define ACQ_CASE(nch, nsrc) logBlock = logBlockT<nch, nsrc>; break
+    #endif
+    switch(nChan*10 + i2sChan)
+    { case 12: ACQ_CASE(1, 2);
+      case 14: ACQ_CASE(1, 4);
+      case 22: ACQ_CASE(2, 2);
+      case 24: ACQ_CASE(2, 4);
+      case 44: ACQ_CASE(4, 4);
+      default: return 0;
+    }
+    #undef ACQ_CASE
+
+    uint32_t nd = nChan*N_SAMP*c_store<1,1,STORE_FMT,0>::BYTES/sizeof(LOG_T);
+    uint32_t na = acq.naud? acq.naud : 64/nChan;
+    uint32_t nb = arena + sizeof(arena) - ptr;
+    uint32_t nq = acq.nq;
+    if(!nq)
+    { nq = 1<<15;
+      while((nq > 2*na) && (logger.arenaBytes(nq, nd, na) > nb)) nq >>= 1;
+      if(nq < 256/nChan) return 0; // arena (ARENA_KB) too small for the default depth
+    }
+    if(nq < 2*na) return 0; // one write buffer is filled while the other is written
+    if(!logger.configure(ptr, nb, nq, nd, na)) return 0; // also if write buffer does not fit into arena
+    #if DO_DEBUG>0
+    { uint32_t block = logger.blockSize, used = (ptr-arena) + logger.arenaBytes(nq, nd, na);
+      Serial.printf("queue %d blocks of %d bytes (%d kB), write %d blocks (%d kB), arena %d of %d kB\n\r",
+            nq, block, nq*block/1024, na, na*block/1024, used/1024, ARENA_KB);
+    }
+    #endif
+    #ifdef TRIGGER
+      if(TRIG_PRE*acq.fsamp/DECIMATE/N_SAMP + 2*na > nq) return 0; // pre-trigger history must fit into queue
+    #endif
+  #endif
+  return 1;
+}
 
 /*
  * ************************** Arduino compatible Setup********************************
@@ -445,8 +971,8 @@ void setup(void)
     SERIALX.begin(9600);
 
     #ifdef DO_LOGGER
-      loggerSetup(N_CHAN, F_SAMP, N_SAMP);
-      readConfig(&parameters);
+      logger.init();
+      readConfig(&parameters, &acq);
     #endif
     printAll();
 
@@ -461,8 +987,7 @@ void setup(void)
     if(parMods)
     {
       #ifdef DO_LOGGER
-        loggerSetup(N_CHAN, F_SAMP, N_SAMP);
-        storeConfig(&parameters);
+        storeConfig(&parameters, &acq);
       #endif
       printAll();
     }
@@ -472,12 +997,21 @@ void setup(void)
   else
   {
     #ifdef DO_LOGGER
-      loggerSetup(N_CHAN, F_SAMP, N_SAMP);
-      readConfig(&parameters);
+      logger.init();
+      readConfig(&parameters, &acq);
       // for debugging
       doBlink(1500,500);
     #endif
   }
+
+  int acqOk = acqConfig();
+  if(!acqOk)
+  { acq = acqDefault; // e.g. unsupported Config.txt
+    acqOk = acqConfig();
+  }
+  #ifdef DO_LOGGER
+    loggerSetup(nChan, acq.fsamp, N_SAMP);
+  #endif
   
 	#ifdef DO_USB_AUDIO
 		usbAudio_init();
@@ -492,6 +1026,11 @@ void setup(void)
     pinMode(13,HIGH);
 		while(!Serial) blink(500);
 		Serial.println("ESM Logger and Monitor");
+    Serial.printf("channels: %d (mask 0x%x)\n\r", nChan, acq.chanMask);
+    #ifdef DO_LOGGER
+      Serial.printf("queue: %d blocks of %d bytes, %d per write\n\r",
+          logger.queueSize, logger.blockSize, logger.chunkBlocks);
+    #endif
   #else
     // blink for 1 second
     doBlink(1000,100);
@@ -503,7 +1042,11 @@ void setup(void)
 	#endif
   #endif
 
-	haveAcq=acqSetup();
+  #if defined(DO_LOGGER) && defined(SD_BENCH)
+    sdBench(SD_BENCH);
+  #endif
+
+	haveAcq=acqOk && acqSetup();
  loopStatus=0;
  doHibernate=0;
  #if ON_TIME > 0
@@ -536,7 +1079,7 @@ void loop(void)
       if(loopStatus==0) loopStatus=2;
     #endif
     
-    if((loopStatus==2) && (millis()>(parameters.on_time*60+3)*1000))  //
+    if((loopStatus==2) && (millis()>(parameters.on_time*60+3)*1000u))  //
     { doHibernate=1; 
       #ifdef DO_LOGGER
         loggerStop(1);
@@ -545,9 +1088,11 @@ void loop(void)
     
     #ifdef DO_LOGGER
       if(loopStatus==2)
-      { int16_t stat = loggerLoop();
+      { int16_t stat = loggerLoop(); // reports ISR counts and profile (acqLoop)
         if(stat <= 0 ) loopStatus=1; 
       } // we get signal of closed file
+    #else
+      acqLoop(); // USB audio only
     #endif
       
 #else
@@ -557,6 +1102,7 @@ void loop(void)
       #ifdef DO_LOGGER
         case 2: if(loopStatus==1) {loggerStart(); loopStatus=2;} break;
         case 3: if(loopStatus==2) {loggerStop(0);  loopStatus=2;} break;
+        case 6: loggerStats(); break;
       #endif
       case 4: if(loopStatus==1) {acqStop(); loopStatus=0;} break;
       case 5: if(loopStatus==2) 
@@ -569,6 +1115,7 @@ void loop(void)
       default:
     	#ifdef DO_LOGGER
         if(loopStatus==2){ if(!loggerLoop()) loopStatus=1; }
+        else if(loopStatus==1) acqLoop();
     	#else
     		acqLoop();
     	#endif
@@ -586,6 +1133,7 @@ void printMenu(void)
   Serial.println("s Stop Logger");
   Serial.println("e End Aquisition");
   Serial.println("h End Aquisition and Hibernate");
+  Serial.println("l List Logger Statistics");
   Serial.println("x Exit Program");
   Serial.println();
 }
@@ -595,7 +1143,7 @@ int menu(void)
   if(!Serial.available()) return 0; // no command
   char c=Serial.read();
   
-  if (strchr("?xabseh", c))
+  if (strchr("?xabsehl", c))
   { switch (c)
     {
       case '?': printMenu(); return 0; // exit program
@@ -605,13 +1153,14 @@ int menu(void)
       case 's': return 3; // stop logger (after finishing file)
       case 'e': return 4; // end aqusisition
       case 'h': return 5; // hibernate (after finishing file)
+      case 'l': return 6; // list logger statistics
     }
   }
   return 0;
 }
 
 /**************** FOR Tim's Menu ***************************************/
-#include <time.h>
+#include "rtctime.h"
 static uint32_t getRTC(void) {return RTC_TSR;}
 static void setRTC(uint32_t tt)
 {
@@ -735,6 +1284,10 @@ void check_hibernate( parameters_s *par, int flag)
 ? v\n:  ESM_Logger reports "third_hour" value
 ? f\n:  ESM_Logger reports "last_hour" value
 ? n\n:  ESM_Logger reports "name" value
+? s\n:  ESM_Logger reports sampling frequency
+? c\n:  ESM_Logger reports channel mask
+? q\n:  ESM_Logger reports queue blocks
+? w\n:  ESM_Logger reports blocks per write
 ? d\n:  ESM_Logger reports date
 ? t\n:  ESM_Logger reports time
 ? l\n:  ESM_Logger reports lux
@@ -755,14 +1308,19 @@ static void printAll(void)
   SERIALX.printf("%c %2d third_hour\n\r",  'v',parameters.third_hour);
   SERIALX.printf("%c %2d last_hour\n\r",   'f',parameters.last_hour);
   SERIALX.printf("%c %s name\n\r",         'n',parameters.name);
+  SERIALX.printf("%c %d fsamp\n\r",        's',acq.fsamp);
+  SERIALX.printf("%c %d channel mask\n\r", 'c',acq.chanMask);
+  SERIALX.printf("%c %d queue blocks\n\r", 'q',acq.nq);
+  SERIALX.printf("%c %d write blocks\n\r", 'w',acq.naud);
   SERIALX.printf("%c %s date\n\r",         'd',getDate(text));
   SERIALX.printf("%c %s time\n\r",         't',getTime(text));
   SERIALX.printf("%c %s mac address\n\r",  'm',encode_mac(text));
   SERIALX.println();
   SERIALX.println("exter 'a' to print this");
-  SERIALX.println("exter '?c' to read value c=(g,p,i,u,v,f,n,d,t,m)");
+  SERIALX.println("exter '?c' to read value c=(g,p,i,u,v,f,n,s,c,q,w,d,t,m)");
   SERIALX.println("  e.g.: ?i will print first hour");
-  SERIALX.println("exter '!cval' to read value c=(g,p,i,u,v,f,n,d,t) and val is new value");
+  SERIALX.println("exter '!cval' to read value c=(g,p,i,u,v,f,n,s,c,q,w,d,t) and val is new value");
+  SERIALX.println("  acquisition (s,c,q,w) is used from next start, q,w 0 is automatic");
   SERIALX.println("  e.g.: !i10 will set first hour to 10");
   SERIALX.println("exter 'xval' to exit menu (x is delay in minutes, -1 means immediate)");
   SERIALX.println("  e.g.: x10 will exit and hibernate for 10 minutes");
@@ -775,7 +1333,7 @@ static void doMenu1(void)
     while(!SERIALX.available());
     char c=SERIALX.read();
     
-    if (strchr("gpiuvfndtlm", c))
+    if (strchr("gpiuvfnscqwdtlm", c))
     { switch (c)
       {
         case 'g': SERIALX.printf("%02d\r\n",parameters.on_time); break;
@@ -785,6 +1343,10 @@ static void doMenu1(void)
         case 'v': SERIALX.printf("%02d\r\n",parameters.third_hour);break;
         case 'f': SERIALX.printf("%02d\r\n",parameters.last_hour);break;
         case 'n': SERIALX.printf("%s\r\n",parameters.name);break;  // could be (unique) mac address
+        case 's': SERIALX.printf("%d\r\n",acq.fsamp);break;
+        case 'c': SERIALX.printf("%d\r\n",acq.chanMask);break;
+        case 'q': SERIALX.printf("%d\r\n",acq.nq);break;
+        case 'w': SERIALX.printf("%d\r\n",acq.naud);break;
         case 'd': SERIALX.printf("%s\r\n",getDate(text));break;
         case 't': SERIALX.printf("%s\r\n",getTime(text));break;
         #if USE_LUX==1
@@ -803,6 +1365,10 @@ static void doMenu1(void)
 ! v val\n:       ESM_Logger sets "third_hour" value
 ! f val\n:       ESM_Logger sets "last_hour" value
 ! n val\n:       ESM_Logger sets "name" value 
+! s val\n:       ESM_Logger sets sampling frequency (Hz)
+! c val\n:       ESM_Logger sets channel mask (1,2,4,8: one slot, 3,12: pair, 15: all)
+! q val\n:       ESM_Logger sets queue blocks (power of 2, 0: as many as fit)
+! w val\n:       ESM_Logger sets blocks per write (0: 64/channels)
 ! d datestring\n ESM_Logger sets date
 ! t timestring\n ESM_Logger sets time
 ! x delay\n      ESM_Logger exits menu and hibernates for the amount given in delay
@@ -813,7 +1379,7 @@ static void doMenu2(void)
     char c=SERIALX.read();
     uint16_t year,month,day,hour,minutes,seconds;
     
-    if (strchr("gpiuvfndt", c))
+    if (strchr("gpiuvfnscqwdt", c))
     { switch (c)
       {
         case 'g': parameters.on_time     =SERIALX.parseInt(); break;
@@ -824,6 +1390,10 @@ static void doMenu2(void)
         case 'f': parameters.last_hour   =SERIALX.parseInt();break;
         case 'n': for(int ii=0; ii<4;ii++) parameters.name[ii] = SERIALX.read();
                   parameters.name[4]=0; break;
+        case 's': acq.fsamp       =SERIALX.parseInt();break;
+        case 'c': acq.chanMask    =SERIALX.parseInt();break;
+        case 'q': acq.nq          =SERIALX.parseInt();break;
+        case 'w': acq.naud        =SERIALX.parseInt();break;
         case 'd':     
                   year= SERIALX.parseInt();
                   month= SERIALX.parseInt();
@@ -0,0 +1,92 @@
+/* wmxzAudio Library for Teensy 3.X
+ * Copyright (c) 2017, Walter Zimmer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice, development funding notice, and this permission
+ * notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+// profile.h
+// min/mean/max duration of code stages (e.g. parts of an ISR)
+// on teensy the DWT cycle counter is used (unit is cpu cycles),
+// in host builds (also the simulation, SIM_HOST) a steady clock (unit is ns)
+//
+// usage:  c_profile prof;  PROF_START(prof); ...; PROF_STOP(prof);
+//         with DO_PROFILE undefined the macros are empty
+// statistics are updated by the measured code (ISR) and read/reset by loop(),
+// a reset may lose the sample of an interrupt that runs at the same time
+//
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+
+#if defined(ARM_DWT_CYCCNT) && !defined(SIM_HOST)
+  #define PROFILE_UNIT "cycles"
+  #define PROFILE_RATE F_CPU  // ticks per second
+  static inline uint32_t profileClock(void) { return ARM_DWT_CYCCNT; }
+  static inline void profileInit(void)
+  { // enable cycle counter
+    ARM_DEMCR |= ARM_DEMCR_TRCENA;
+    ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+  }
+#else
+  #include <chrono>
+  #define PROFILE_UNIT "ns"
+  #define PROFILE_RATE 1000000000
+  static inline uint32_t profileClock(void)
+  { return (uint32_t) std::chrono::duration_cast<std::chrono::nanoseconds>
+              (std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+  static inline void profileInit(void) {}
+#endif
+
+class c_profile
+{
+public:
+  c_profile(void) { reset(); }
+
+  inline void start(void) { t0 = profileClock(); }
+  inline void stop(void) { add(profileClock()-t0); }
+  inline void add(uint32_t dt)
+  { if(dt < dmin) dmin = dt;
+    if(dt > dmax) dmax = dt;
+    sum += dt;
+    count++;
+  }
+  void reset(void) { dmin = 0xffffffff; dmax = 0; sum = 0; count = 0; }
+
+  uint32_t min(void)  { return count? dmin : 0; }
+  uint32_t max(void)  { return dmax; }
+  uint32_t mean(void) { return count? (uint32_t)(sum/count) : 0; }
+  uint32_t calls(void) { return count; }
+  uint64_t total(void) { return sum; }
+
+private:
+  uint32_t t0;
+  volatile uint32_t dmin, dmax, count;
+  volatile uint64_t sum;
+};
+
+#ifdef DO_PROFILE
+  #define PROF_START(p) (p).start()
+  #define PROF_STOP(p)  (p).stop()
+#else
+  #define PROF_START(p)
+  #define PROF_STOP(p)
+#endif
+
+#endif
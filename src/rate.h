@@ -0,0 +1,88 @@
+/* wmxzAudio Library for Teensy 3.X
+ * Copyright (c) 2017, Walter Zimmer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice, development funding notice, and this permission
+ * notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+// rate.h
+// sampling rate measured against the RTC: straight line fit of stamp time over sample count
+// no teensy includes here, so it also builds on host
+//
+// a stamp is the number x of samples received (since logger start) and the RTC time t
+// (seconds and 32768 Hz prescaler, i.e. 30.5 us resolution) when they were received
+// the fit is done on the deviation from the nominal rate, y = (t-t0) - (x-x0)/fnom,
+// with running means and co-moments, so that double precision holds for months of
+// stamps and also the residual (some us) of a line over days of seconds
+// with one stamp per second the slope of an hour is known to about 0.01 ppm
+//
+#ifndef RATE_H
+#define RATE_H
+
+#include <stdint.h>
+#include <math.h>
+
+#define RATE_WINDOW 600.0 // s, stamps per rate of drift estimate (about 0.02 ppm/h)
+
+class c_rateFit
+{
+public:
+  c_rateFit(void) : fnom(1.0) { reset(1.0); }
+
+  void reset(double fsamp)
+  { fnom = fsamp; n = 0;
+    x0 = t0 = mx = my = cxx = cxy = cyy = 0.0; tlast = 0.0;
+  }
+
+  void add(double x, double t)
+  { if(!n) { x0 = x; t0 = t; }
+    x -= x0;
+    double y = (t - t0) - x/fnom;
+    n++;
+    double dx = x - mx; mx += dx/n;
+    double dy = y - my; my += dy/n;
+    cxx += dx*(x - mx);
+    cxy += dx*(y - my);
+    cyy += dy*(y - my);
+    tlast = t;
+  }
+
+  uint32_t points(void) { return n; }
+  double slope(void) { return (n > 1 && cxx > 0.0)? cxy/cxx : 0.0; } // s per sample beyond 1/fnom
+  double rate(void) { return 1.0/(1.0/fnom + slope()); }
+  double ppm(void) { return (rate()/fnom - 1.0)*1e6; }
+  double span(void) { return n? tlast - t0 : 0.0; }
+  double centre(void) { return t0 + my + mx/fnom; } // mean stamp time
+  double rms(void) // residual in s
+  { if(n < 3 || cxx <= 0.0) return 0.0;
+    double ss = cyy - cxy*cxy/cxx;
+    return (ss > 0.0)? sqrt(ss/(n-2)) : 0.0;
+  }
+  double time(double x) // RTC time when sample x was received, 0 if not measured
+  { if(!n) return 0.0;
+    x -= x0;
+    return t0 + my + slope()*(x - mx) + x/fnom;
+  }
+
+private:
+  double fnom;
+  uint32_t n;
+  double x0, t0, tlast;
+  double mx, my, cxx, cxy, cyy;
+};
+
+#endif
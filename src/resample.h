@@ -0,0 +1,228 @@
+/* wmxzAudio Library for Teensy 3.X
+ * Copyright (c) 2017, Walter Zimmer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice, development funding notice, and this permission
+ * notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+// resample.h
+// stereo resampler of the USB audio path (AudioInterface): I2S rate to 44.1 kHz
+// no teensy includes here, so it also builds on host (tools/esmresample)
+//
+// c_buff is the ring of stereo frames (two int16 in one word, left in the lower half)
+// between the I2S ISR (put) and the audio update (c_resample); each side owns its
+// free running counter (fill is nw - nr) and its position, which wraps at the ring
+// length, so no frame is read past the end of the ring
+//
+// c_resample is a polyphase FIR (windowed sinc, RS_NTAP taps, RS_NPH phases, linear
+// interpolation between neighbouring phases) on a Q32.32 input position: the integer
+// part is the oldest frame of the filter, the fraction selects the phase; the position
+// is kept from block to block, so the phase is continuous and any ratio holds to 2^-32
+// coefficients are Q20 (RS_QBITS) in 32 bit, each phase has unity gain at DC; sum of
+// |coef| reaches 2.4 when interpolating, so the products are summed in 64 bit (SMLAL on
+// the teensy); with Q15 the rounding of the coefficients, which changes with the phase,
+// limited THD+N to about -83 dB
+// filter: Blackman window, 6 dB point at half the lower of both rates, so it is the
+// anti-alias filter when decimating and the anti-image filter when interpolating
+//
+// the ratio follows the latency: the consumer is paced by the sink (USB frames), so a
+// clock difference between I2S and USB moves the ring fill; the caller passes what the
+// sink has taken but not yet got (owed), so the latency (fill less owed) does not jump
+// with the block granularity; a PI controller on the smoothed latency error corrects
+// the nominal step by up to RS_MAXPPM (in steps of 2^-24, 0.06 ppm)
+// the sink position is known to a USB frame only (1 ms), and where the I2S interrupts
+// are commensurate with the frames (e.g. 32 kHz: 4 ms), this error does not average
+// but drifts as a sawtooth with the clock difference; so the loop starts fast (gear 0,
+// some seconds) to acquire, then halves its bandwidth every gear (RS_GEARBLK blocks,
+// doubling) up to RS_GEARS, where it tracks within a few ppm; the smoothing of the
+// latency error doubles with every gear as well, so the loop keeps its shape and the
+// proportional part does not pass the 1 ms steps of the sawtooth on to the ratio
+//
+// achieved (tools/esmresample, tones of 997 and 3091 Hz at -1 dBFS, 16 bit): THD below
+// -115 dB, THD+N -88 dB or better with 100 ppm of clock difference and -86 dB or
+// better from 30 to 900 ppm, at all rates; the sawtooth is only followed by the loop
+// where it is slow, at 32 kHz with a few ppm (period of some minutes): there THD+N of
+// the higher tone reaches -76 dB
+//
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <stdint.h>
+#include <math.h>
+
+class c_buff
+{
+	volatile uint32_t nw; // frames written (producer)
+	volatile uint32_t nr; // frames read (consumer)
+	uint32_t iw, ir;      // positions in buffer
+	uint32_t * buffer;
+	uint32_t mbuf;	// buffer length
+public:
+	uint32_t overrun; // frames dropped by put
+	//
+	c_buff(uint32_t *data, uint32_t len) 
+	{	buffer=data; mbuf=len; nw=nr=0; iw=ir=0; overrun=0; for(uint32_t ii=0; ii<mbuf; ii++) buffer[ii]=0; };
+	uint16_t put(uint32_t * data, uint16_t len);
+	uint32_t size(void) {return mbuf;}
+	uint32_t available(void) {return __atomic_load_n(&nw, __ATOMIC_ACQUIRE) - nr;}
+	uint32_t peek(uint32_t k) {uint32_t ii = ir + k; return buffer[(ii < mbuf)? ii : ii - mbuf];} // k < available()
+	void consume(uint32_t n);
+	uint32_t get_top() {return nw;}
+	uint32_t get_bot() {return nr;}
+};
+
+inline uint16_t c_buff::put(uint32_t * data, uint16_t len)
+{ // producer (ISR), all or nothing
+  if(len > mbuf - (nw - __atomic_load_n(&nr, __ATOMIC_ACQUIRE))) { overrun += len; return 0; }
+  for(uint32_t ii=0; ii<len; ii++)
+  { buffer[iw] = data[ii];
+    if(++iw == mbuf) iw = 0;
+  }
+  __atomic_store_n(&nw, nw + len, __ATOMIC_RELEASE);
+  return len;
+}
+
+inline void c_buff::consume(uint32_t n)
+{ // consumer, n <= available()
+  ir += n;
+  while(ir >= mbuf) ir -= mbuf;
+  __atomic_store_n(&nr, nr + n, __ATOMIC_RELEASE);
+}
+
+#define RS_NTAP   32     // taps
+#define RS_PHBITS 5
+#define RS_QBITS  20     // fraction bits of coefficients
+#define RS_NPH    (1<<RS_PHBITS) // phases
+#define RS_MAXPPM 1000   // largest ratio correction
+#define RS_MARGIN 2      // ms of input kept in the ring beyond the filter length
+#define RS_SMOOTH 6      // latency error is smoothed over 2^(RS_SMOOTH+gear) blocks (twice)
+#define RS_KP     840    // proportional gain of gear 0 (2^-24 per output sample of error)
+#define RS_KI     9      // integral time of gear 0 (2^RS_KI blocks)
+#define RS_GEARS  6      // each gear halves the loop bandwidth
+#define RS_GEARBLK 2048  // blocks in gear 0, doubling with each gear
+
+class c_resample
+{
+public:
+	c_resample(void) : fin(1), fout(1) {;}
+
+	void init(uint32_t fsin, uint32_t fsout);
+	/*
+	 * left, right: nout output samples each
+	 * owed: output samples the sink has taken but not yet got, after this block
+	 * returns 0 (and does not consume) if the ring does not hold enough frames
+	 */
+	int process(c_buff *src, int16_t *left, int16_t *right, uint32_t nout, int32_t owed);
+	void reset(void) { frac = 0; primed = 0; lastOverrun = 0; relock(); }
+	int32_t ppm(void) { return (int32_t)(((int64_t)(step - nominal)*1000000)/(int64_t)nominal); }
+	uint32_t underrun = 0; // blocks not delivered
+	uint32_t target = 0;   // latency the controller steers to (input frames)
+	uint32_t gear = 0;     // 0: acquiring .. RS_GEARS: tracking
+
+private:
+	uint32_t fin, fout;
+	uint64_t nominal;  // fin/fout, Q32.32
+	uint32_t outPerIn; // fout/fin, Q16
+	uint64_t step;     // corrected ratio
+	uint32_t frac;     // phase of next output (Q32)
+	int32_t primed;    // ring was filled to target
+	int32_t efill1, efill; // smoothed latency error (Q8 output samples)
+	int64_t integ;     // integral of smoothed error (Q8 samples x blocks)
+	uint32_t ngear;    // blocks in this gear
+	uint32_t lastOverrun; // c_buff::overrun when last seen
+	void relock(void) { efill1 = efill = 0; integ = 0; step = nominal; gear = ngear = 0; }
+	int32_t coef[(RS_NPH+1)*RS_NTAP]; // phase p at coef[p*RS_NTAP], phase RS_NPH for interpolation
+};
+
+inline void c_resample::init(uint32_t fsin, uint32_t fsout)
+{
+	fin = fsin; fout = fsout;
+	nominal = (((uint64_t) fin << 32) + fout/2)/fout;
+	outPerIn = (((uint64_t) fout << 16) + fin/2)/fin;
+	target = RS_NTAP + fin*RS_MARGIN/1000;
+	reset();
+	// windowed sinc, cutoff (6 dB) at half the lower rate, relative to input rate
+	float fc = 0.5f*((fout < fin)? (float) fout/fin : 1.0f);
+	for(int ip=0; ip<=RS_NPH; ip++)
+	{ float h[RS_NTAP], sum = 0.0f;
+	  for(int kk=0; kk<RS_NTAP; kk++)
+	  { float x = kk - (RS_NTAP/2 - 1) - (float) ip/RS_NPH; // output lies between taps NTAP/2-1 and NTAP/2
+	    float s = (x == 0.0f)? 2.0f*fc : sinf(2.0f*(float)M_PI*fc*x)/((float)M_PI*x);
+	    float u = 0.5f + x/RS_NTAP; // 0..1 over window
+	    float w = 0.42f - 0.5f*cosf(2.0f*(float)M_PI*u) + 0.08f*cosf(4.0f*(float)M_PI*u);
+	    h[kk] = s*w;
+	    sum += h[kk];
+	  }
+	  for(int kk=0; kk<RS_NTAP; kk++) coef[ip*RS_NTAP+kk] = (int32_t) lrintf(h[kk]/sum*(float)(1<<RS_QBITS));
+	}
+}
+
+inline int c_resample::process(c_buff *src, int16_t *left, int16_t *right, uint32_t nout, int32_t owed)
+{
+	uint32_t avail = src->available();
+	if(src->overrun != lastOverrun)
+	{ // sink stalled and producer found ring full: restart from target fill
+	  lastOverrun = src->overrun;
+	  if(avail > target) { src->consume(avail - target); avail = target; }
+	  relock();
+	}
+	if(!primed)
+	{ if(avail < target) { underrun++; return 0; }
+	  primed = 1;
+	}
+	// frames needed for nout outputs
+	uint64_t need = (((uint64_t) frac + step*(nout-1)) >> 32) + RS_NTAP;
+	if(avail < need) { primed = 0; underrun++; return 0; } // wait until refilled
+	//
+	uint32_t pos = 0;
+	for(uint32_t ii=0; ii<nout; ii++)
+	{ uint32_t ip = frac >> (32-RS_PHBITS);                     // phase
+	  int32_t fr = (int32_t)((frac >> (32-RS_PHBITS-15)) & 0x7fff); // between phases ip and ip+1, Q15
+	  const int32_t *c0 = &coef[ip*RS_NTAP], *c1 = c0 + RS_NTAP;
+	  int64_t accl = 0, accr = 0;
+	  for(int kk=0; kk<RS_NTAP; kk++)
+	  { int32_t c = c0[kk] + (int32_t)(((int64_t)(c1[kk] - c0[kk])*fr) >> 15);
+	    uint32_t w = src->peek(pos+kk);
+	    accl += (int64_t) c*(int16_t) w;
+	    accr += (int64_t) c*(int16_t)(w >> 16);
+	  }
+	  accl = (accl + (1<<(RS_QBITS-1))) >> RS_QBITS; accr = (accr + (1<<(RS_QBITS-1))) >> RS_QBITS;
+	  left[ii]  = (accl > 32767)? 32767 : (accl < -32768)? -32768 : accl;
+	  right[ii] = (accr > 32767)? 32767 : (accr < -32768)? -32768 : accr;
+	  uint64_t p = (uint64_t) frac + step;
+	  pos += (uint32_t)(p >> 32);
+	  frac = (uint32_t) p;
+	}
+	src->consume(pos);
+	//
+	// steer ratio to keep latency at target: ring fill less what the sink is owed
+	int32_t err = (int32_t)(((int64_t)(int32_t)(src->available() - target)*outPerIn) >> 8) - (owed << 8);
+	efill1 += (err - efill1) >> (RS_SMOOTH+gear);
+	efill += (efill1 - efill) >> (RS_SMOOTH+gear);
+	if(gear < RS_GEARS && ++ngear == ((uint32_t) RS_GEARBLK << gear))
+	{ gear++; ngear = 0; integ *= 4; } // keeps the integral part of corr
+	const int64_t cmax = (int64_t) RS_MAXPPM*16777216/1000000;
+	const int64_t imax = (cmax << (RS_KI+2*gear+8))/RS_KP; // integral alone may correct RS_MAXPPM
+	integ += efill;
+	integ = (integ > imax)? imax : (integ < -imax)? -imax : integ;
+	int64_t corr = (((int64_t) RS_KP*efill) >> (gear+8)) + ((RS_KP*integ) >> (RS_KI+2*gear+8));
+	corr = (corr > cmax)? cmax : (corr < -cmax)? -cmax : corr;
+	step = nominal + (int64_t)(nominal >> 24)*corr;
+	return 1;
+}
+
+#endif
@@ -0,0 +1,226 @@
+/* wmxzAudio Library for Teensy 3.X
+ * Copyright (c) 2017, Walter Zimmer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice, development funding notice, and this permission
+ * notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+// rice.h
+// lossless compression of Logger blocks (FLAC like)
+// shared between firmware and (linux) host tools, so no teensy includes here
+//
+// each Logger block is encoded into one frame that can be decoded on its own
+//   frame header (8 bytes): sync word, payload length, type, number of channels
+//   RICE_RAW   payload is the block as is (used for records and incompressible data)
+//   RICE_FIXED payload is a bit stream with, for each channel,
+//      2 bit predictor order (0..2, fixed polynomial predictor as in FLAC)
+//      5 bit rice parameter k
+//      order warm-up samples (32 bit)
+//      zigzag mapped residuals, rice coded (quotient unary, k bit remainder)
+//      a quotient of RICE_QMAX is an escape and is followed by the 32 bit value
+//   the payload is padded to a multiple of 4 bytes (frames stay word aligned)
+//
+#ifndef RICE_H
+#define RICE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define RICE_SYNC  0x4352534Du // "MSRC"
+#define RICE_RAW   0
+#define RICE_FIXED 1
+#define RICE_QMAX  24
+
+typedef struct
+{
+  uint32_t sync;
+  uint16_t nbytes; // payload bytes
+  uint8_t  type;
+  uint8_t  nch;
+} rice_frame_s;
+
+/*------------------------- bit writer -----------------------------*/
+class c_riceOut
+{
+  uint8_t *ptr, *end;
+  uint32_t acc;   // pending bits (msb first)
+  int nacc;       // number of pending bits
+public:
+  int overflow;
+  c_riceOut(uint8_t *dst, uint32_t maxbytes) : ptr(dst), end(dst+maxbytes), acc(0), nacc(0), overflow(0) {;}
+
+  inline void put(uint32_t val, int nbits) // nbits <= 24
+  { acc = (acc << nbits) | (val & ((1u<<nbits)-1));
+    nacc += nbits;
+    while(nacc >= 8)
+    { nacc -= 8;
+      if(ptr < end) *ptr++ = (uint8_t)(acc >> nacc); else overflow = 1;
+    }
+  }
+  inline void put32(uint32_t val) { put(val >> 16, 16); put(val & 0xffff, 16);}
+  inline void ones(int n) { while(n > 16) { put(0xffff,16); n -= 16;} put((1u<<n)-1, n);}
+  uint8_t *flush(void) { if(nacc) put(0, 8-nacc); while(((uintptr_t)ptr) & 3) put(0, 8); return ptr;}
+};
+
+/*------------------------- bit reader -----------------------------*/
+class c_riceIn
+{
+  const uint8_t *ptr, *end;
+  uint32_t acc;
+  int nacc;
+public:
+  int underflow;
+  c_riceIn(const uint8_t *src, uint32_t nbytes) : ptr(src), end(src+nbytes), acc(0), nacc(0), underflow(0) {;}
+
+  inline uint32_t get(int nbits) // nbits <= 24
+  { while(nacc < nbits)
+    { acc = (acc << 8) | ((ptr < end)? *ptr++ : (underflow=1, 0));
+      nacc += 8;
+    }
+    nacc -= nbits;
+    return (acc >> nacc) & ((1u<<nbits)-1);
+  }
+  inline uint32_t get32(void) { uint32_t hi = get(16); return (hi << 16) | get(16);}
+  inline int ones(int nmax) { int n=0; while(n < nmax && get(1)) n++; return n;}
+};
+
+static inline uint32_t rice_zigzag(int32_t x) { return ((uint32_t)x << 1) ^ (uint32_t)(x >> 31);}
+static inline int32_t rice_unzigzag(uint32_t u) { return (int32_t)((u >> 1) ^ (0u - (u & 1)));}
+
+// residual of fixed predictor (modulo 2^32, so also exact for full 32 bit data)
+template <typename T>
+static inline int32_t rice_residual(const T *x, int nch, int order)
+{ uint32_t x0 = (uint32_t)(int32_t) x[0];
+  if(order == 0) return (int32_t) x0;
+  uint32_t x1 = (uint32_t)(int32_t) x[-nch];
+  if(order == 1) return (int32_t)(x0 - x1);
+  uint32_t x2 = (uint32_t)(int32_t) x[-2*nch];
+  return (int32_t)(x0 - 2*x1 + x2);
+}
+
+/*
+ * encode one block of nch interleaved channels with nsamp samples each
+ * dst must be word aligned and hold at least sizeof(rice_frame_s) + nch*nsamp*sizeof(T) bytes
+ * isRaw forces a RICE_RAW frame (used for records)
+ * returns number of bytes written
+ */
+template <typename T>
+uint32_t rice_encode(uint8_t *dst, const T *src, int nch, int nsamp, int isRaw)
+{
+  rice_frame_s *frame = (rice_frame_s *) dst;
+  uint32_t nraw = nch*nsamp*sizeof(T);
+  frame->sync = RICE_SYNC;
+  frame->nch = nch;
+
+  if(!isRaw)
+  {
+    c_riceOut out(dst+sizeof(rice_frame_s), nraw); // never larger than raw
+    for(int ich=0; ich<nch && !out.overflow; ich++)
+    {
+      const T *x = src+ich;
+      // select predictor order with smallest sum of absolute residuals
+      uint64_t sum[3] = {0,0,0};
+      for(int ii=2; ii<nsamp; ii++)
+      { sum[0] += rice_zigzag(rice_residual(x+ii*nch, nch, 0));
+        sum[1] += rice_zigzag(rice_residual(x+ii*nch, nch, 1));
+        sum[2] += rice_zigzag(rice_residual(x+ii*nch, nch, 2));
+      }
+      int order = (sum[1] < sum[0])? 1 : 0;
+      if(sum[2] < sum[order]) order = 2;
+
+      // rice parameter from mean residual
+      uint32_t mean = (nsamp > 2)? (uint32_t)(sum[order] / (nsamp-2)) : 0;
+      int k = 0; while(k < 30 && (mean >> (k+1))) k++;
+
+      out.put(order, 2);
+      out.put(k, 5);
+      for(int ii=0; ii<order; ii++) out.put32((uint32_t)(int32_t)x[ii*nch]);
+      for(int ii=order; ii<nsamp; ii++)
+      { uint32_t u = rice_zigzag(rice_residual(x+ii*nch, nch, order));
+        uint32_t q = u >> k;
+        if(q < RICE_QMAX)
+        { out.ones(q); out.put(0,1);
+          if(k > 24) { out.put(u >> 24, k-24); out.put(u, 24);} else if(k) out.put(u, k);
+        }
+        else
+        { out.ones(RICE_QMAX); out.put32(u);
+        }
+      }
+    }
+    uint8_t *end = out.flush();
+    if(!out.overflow)
+    { frame->type = RICE_FIXED;
+      frame->nbytes = end - (dst+sizeof(rice_frame_s));
+      return sizeof(rice_frame_s) + frame->nbytes;
+    }
+  }
+  frame->type = RICE_RAW;
+  frame->nbytes = nraw;
+  memcpy(dst+sizeof(rice_frame_s), src, nraw);
+  return sizeof(rice_frame_s) + nraw;
+}
+
+/*
+ * decode one frame into nsamp samples of nch channels (int32)
+ * RICE_RAW frames are copied as is (nbytes to dst)
+ * returns number of bytes consumed, 0 on error
+ */
+static inline uint32_t rice_decode(int32_t *dst, const uint8_t *src, uint32_t nbytes, int nsamp)
+{
+  const rice_frame_s *frame = (const rice_frame_s *) src;
+  if(nbytes < sizeof(rice_frame_s) || frame->sync != RICE_SYNC) return 0;
+  if(nbytes < sizeof(rice_frame_s) + frame->nbytes) return 0;
+  const uint8_t *payload = src+sizeof(rice_frame_s);
+  int nch = frame->nch;
+
+  if(frame->type == RICE_RAW)
+  { memcpy(dst, payload, frame->nbytes);
+  }
+  else if(frame->type == RICE_FIXED)
+  {
+    c_riceIn in(payload, frame->nbytes);
+    for(int ich=0; ich<nch; ich++)
+    {
+      int32_t *x = dst+ich;
+      int order = in.get(2);
+      int k = in.get(5);
+      if(order > 2) return 0;
+      for(int ii=0; ii<order; ii++) x[ii*nch] = (int32_t) in.get32();
+      for(int ii=order; ii<nsamp; ii++)
+      { uint32_t u;
+        uint32_t q = in.ones(RICE_QMAX);
+        if(q < RICE_QMAX)
+        { if(k > 24) { u = in.get(k-24) << 24; u |= in.get(24);} else u = k? in.get(k) : 0;
+          u |= q << k;
+        }
+        else
+          u = in.get32();
+        // prediction in modulo 2^32 arithmetic, as in encoder
+        uint32_t r = (uint32_t) rice_unzigzag(u);
+        if(order > 0) r += (uint32_t) x[(ii-1)*nch];
+        if(order > 1) r += (uint32_t) x[(ii-1)*nch] - (uint32_t) x[(ii-2)*nch];
+        x[ii*nch] = (int32_t) r;
+      }
+    }
+    if(in.underflow) return 0;
+  }
+  else
+    return 0;
+  return sizeof(rice_frame_s) + frame->nbytes;
+}
+
+#endif
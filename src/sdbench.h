@@ -0,0 +1,80 @@
+/* wmxzAudio Library for Teensy 3.X
+ * Copyright (c) 2017, Walter Zimmer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice, development funding notice, and this permission
+ * notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+// sdbench.h
+// sustained write rate and write latency of the uSD card
+// compares file system writes (FsFile::write) with raw streaming (c_mFS::rawMode)
+// each pass writes nmb MB in buffers of BENCH_BUF bytes into pre-allocated file bench.bin
+// latency of each buffer write is histogrammed in BENCH_BIN us bins
+//
+// raw pass runs only with RAW_WRITE defined (FIFO_SDIO), so that both passes
+// use the same SDIO configuration
+//
+#ifndef SDBENCH_H
+#define SDBENCH_H
+
+#define BENCH_BUF  (16*1024)
+#define BENCH_BIN  50    // us
+#define BENCH_NBIN 1000  // last bin collects all longer writes
+
+static void sdBenchPass(int16_t raw, uint32_t nmb, uint8_t *buffer, uint32_t *hist)
+{
+  uint32_t nbuf = (nmb*1024*1024)/BENCH_BUF;
+  uint32_t tmax = 0;
+  for(int ii=0; ii<BENCH_NBIN; ii++) hist[ii]=0;
+
+  mFS.rawMode = raw;
+  mFS.open((char *)"bench.bin");
+  uint32_t t0 = micros();
+  for(uint32_t ii=0; ii<nbuf; ii++)
+  { uint32_t t1 = micros();
+    mFS.write(buffer, BENCH_BUF);
+    uint32_t dt = micros()-t1;
+    if(dt > tmax) tmax = dt;
+    uint32_t ib = dt/BENCH_BIN; if(ib >= BENCH_NBIN) ib = BENCH_NBIN-1;
+    hist[ib]++;
+  }
+  mFS.close();
+  float sec = (micros()-t0)*1e-6f; // includes close
+
+  // 99.9th percentile (upper edge of bin)
+  uint32_t nn = 0, ib;
+  for(ib=0; ib<BENCH_NBIN-1; ib++) { nn += hist[ib]; if(nn*1000 >= nbuf*999) break; }
+
+  Serial.printf("%s: %.2f MB/s  99.9%%: <%d us  max: %d us  (%d x %d bytes)\n\r",
+        raw? "raw ": "file", (float)nmb/sec, (ib+1)*BENCH_BIN, tmax, nbuf, BENCH_BUF);
+}
+
+void sdBench(uint32_t nmb)
+{
+  static uint8_t buffer[BENCH_BUF] __attribute__((aligned(4)));
+  static uint32_t hist[BENCH_NBIN];
+  for(int ii=0; ii<BENCH_BUF; ii++) buffer[ii]=ii;
+
+  int16_t rawMode = mFS.rawMode;
+  sdBenchPass(0, nmb, buffer, hist);
+  #ifdef RAW_WRITE
+    sdBenchPass(1, nmb, buffer, hist);
+  #endif
+  mFS.rawMode = rawMode;
+}
+
+#endif
@@ -0,0 +1,157 @@
+/* wmxzAudio Library for Teensy 3.X
+ * Copyright (c) 2017, Walter Zimmer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice, development funding notice, and this permission
+ * notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+// spl.h
+// sound level meter: rms, peak and clipped samples of each channel
+// no teensy includes here, so it also builds on host
+//
+// the ISR accumulates the energy, largest and smallest sample and clip count of
+// each block (put), blocks are summed over tavg seconds; loop() converts the sums
+// into a record of levels in dB (process, spl_rec_s and spl_chan_s in binfile.h)
+// the ISR never waits: a record that loop() has not taken in time is lost (counted)
+// the sum of squares is kept with full 24 bit resolution (one SMLAL per sample on
+// the M4), so the quiet end of the range is limited by the microphone, not the meter
+//
+#ifndef SPL_H
+#define SPL_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "binfile.h"
+#include "store.h" // msbCorrect
+
+#define SPL_FS   8388608.0f // full scale of 24 bit data
+#define SPL_CLIP 0x7FFF00   // |sample| counted as clipped
+
+/*
+ * raw  1 if input is uncorrected ICS43432 data (MSB correction is done here)
+ * nmax most channels (the channels are given at init)
+ */
+template <int raw, int nmax>
+class c_spl
+{
+public:
+  c_spl(void) : nblk(1), iblk(0), ready(0), nlost(0), nsamp(0), nch(1) {;}
+
+  void init(float fsamp, uint32_t blockSamples, float tavg, int nchan)
+  { nsamp = blockSamples;
+    nch = (nchan < 1)? 1 : (nchan > nmax)? nmax : nchan;
+    nblk = (uint32_t)(tavg*fsamp/nsamp + 0.5f); if(!nblk) nblk = 1;
+    iblk = 0; ready = 0; nlost = 0;
+    clear(acc);
+  }
+
+  /*
+   * producer (ISR)
+   * src   first channel of nsamp interleaved samples, next sample at src[step]
+   *       channel ic starts at src[ic]
+   */
+  void put(const int32_t *src, int ns, int step)
+  { for(int ic=0; ic<nch; ic++)
+    { const int32_t *ptr = src+ic;
+      int64_t sum = 0;
+      int32_t mx = 0, mn = 0;
+      uint32_t nc = 0;
+      for(int ii=0; ii<ns; ii++)
+      { int32_t v = *ptr; ptr += step;
+        if(raw) v = msbCorrect(v);
+        sum += (int64_t) v*v;
+        if(v > mx) mx = v;
+        if(v < mn) mn = v;
+        nc += (v >= SPL_CLIP) + (v <= -SPL_CLIP);
+      }
+      sums_s *a = &acc[ic];
+      a->sum += sum;
+      if(sum > a->max) a->max = sum;
+      if(sum < a->min) a->min = sum;
+      if(mx > a->peak) a->peak = mx;
+      if(-mn > a->peak) a->peak = -mn;
+      a->nclip += nc;
+    }
+    if(++iblk < nblk) return;
+    if(ready) nlost++; // loop() is late, drop these sums
+    else { memcpy(done, acc, nch*sizeof(sums_s)); ready = 1; }
+    clear(acc);
+    iblk = 0;
+  }
+
+  /*
+   * consumer (loop)
+   * returns record (rtc to be filled in by caller) when tavg is complete, else 0
+   */
+  spl_rec_s *process(void)
+  { if(!ready) return 0;
+    spl_rec_s *rec = (spl_rec_s *) record;
+    spl_chan_s *chan = (spl_chan_s *)(rec+1);
+    rec->rtc = 0;
+    rec->nblock = nblk;
+    rec->nlost = nlost > 0xffff? 0xffff : nlost;
+    float ref = SPL_FS*SPL_FS/2; // mean square of full scale sine
+    for(int ic=0; ic<nch; ic++)
+    { const sums_s *a = &done[ic];
+      chan[ic].leq  = level((float) a->sum/((float)nsamp*nblk)/ref);
+      chan[ic].lmax = level((float) a->max/nsamp/ref);
+      chan[ic].lmin = level((float) a->min/nsamp/ref);
+      chan[ic].peak = level((float) a->peak*a->peak/(SPL_FS*SPL_FS));
+      chan[ic].nclip = a->nclip > 0xffff? 0xffff : a->nclip;
+      chan[ic].fill = 0;
+    }
+    nlost = 0;
+    ready = 0; // sums may be reused by ISR
+    return rec;
+  }
+
+  uint32_t blocks(void) { return nblk; } // blocks per record
+  int channels(void) { return nch; }
+  uint32_t recordSize(void) { return sizeof(spl_rec_s) + nch*sizeof(spl_chan_s); }
+
+private:
+  typedef struct
+  { int64_t sum, max, min; // energy of record, of loudest and quietest block
+    int32_t peak;
+    uint32_t nclip;
+  } sums_s;
+
+  sums_s acc[nmax];       // filled by ISR
+  sums_s done[nmax];      // waiting for loop()
+  uint32_t nblk, iblk;    // blocks per record, blocks in acc
+  volatile int ready;
+  volatile uint32_t nlost;
+  uint32_t nsamp;
+  int nch;
+  uint8_t record[sizeof(spl_rec_s) + nmax*sizeof(spl_chan_s)] __attribute__((aligned(4)));
+
+  void clear(sums_s *a)
+  { for(int ic=0; ic<nch; ic++)
+    { a[ic].sum = a[ic].max = 0; a[ic].min = INT64_MAX;
+      a[ic].peak = 0; a[ic].nclip = 0;
+    }
+  }
+
+  static int16_t level(float ms) // 0.01 dB, power ratio ms
+  { if(ms <= 0) return SPL_MIN;
+    float db = 1000.0f*log10f(ms);
+    return (db < SPL_MIN)? SPL_MIN : (db > 32767)? 32767 : (int16_t) lrintf(db);
+  }
+};
+
+#endif
@@ -0,0 +1,142 @@
+/* wmxzAudio Library for Teensy 3.X
+ * Copyright (c) 2017, Walter Zimmer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice, development funding notice, and this permission
+ * notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+// store.h
+// fused MSB correction, channel extraction and store of I2S blocks
+// no teensy includes here, so it also builds on host
+//
+// replaces the separate passes of i2sInProcessing (correct all I2S words in place,
+// extract the logged channel, copy into the logger queue): every logged sample
+// is loaded once, corrected and written in the logged format, typically directly
+// into a block of the queue (Logger::reserve)
+// unlogged channels are not touched, so consumers of the raw I2S buffer
+// (detector, LTSA, SPL) must do the correction themselves (their raw template flag)
+//
+// on Cortex-M4 the correction is one SBFX per sample and two 16 bit samples are
+// combined with one PKHTB (DSP extension); the loops are unrolled by 4 samples so
+// loads and stores of consecutive words can pair
+// store() and storeRef() (plain C, one sample at a time) give identical bytes,
+// see tools/esmstorebench
+//
+#ifndef STORE_H
+#define STORE_H
+
+#include <stdint.h>
+#include "binfile.h"
+
+// ICS43432 word to 24 bit sample: drop the leading (wrong) bit and the 7 unused bits
+static inline int32_t msbCorrect(int32_t x)
+{
+#if defined(__ARM_ARCH_7EM__)
+  int32_t y;
+  asm("sbfx %0, %1, #7, #24" : "=r" (y) : "r" (x));
+  return y;
+#else
+  return (int32_t)((uint32_t) x << 1) >> 8;
+#endif
+}
+
+// two 24 bit samples (bits 8..31 of a and b) to 16 bit pair, a in lower half
+static inline uint32_t pack16(uint32_t a, uint32_t b)
+{
+#if defined(__ARM_ARCH_7EM__)
+  uint32_t y;
+  asm("pkhtb %0, %1, %2, asr #16" : "=r" (y) : "r" (b), "r" (a));
+  return y;
+#else
+  return (b & 0xffff0000u) | (a >> 16);
+#endif
+}
+
+/*
+ * nch  logged channels (1, 2 or 4)
+ * nsrc interleaved channels of the source: 2 or 4 for I2S data (nch adjacent
+ *      channels are extracted if nch < nsrc), nch for data in logged layout (decimated)
+ * fmt  FMT_INT32, FMT_PACK24 or FMT_INT16 (upper 16 of the 24 bits)
+ * raw  1 if the source is uncorrected ICS43432 data, 0 if 24 bit samples
+ */
+template <int nch, int nsrc, int fmt, int raw>
+class c_store
+{
+  static_assert(nch == nsrc || ((nch == 1 || nch == 2) && nsrc == 4) || (nch == 1 && nsrc == 2), "c_store: channels");
+  static_assert(fmt == FMT_INT32 || fmt == FMT_PACK24 || fmt == FMT_INT16, "c_store: format");
+  enum { ADV = (nch == nsrc)? 4 : (4/nch)*nsrc }; // source words per 4 samples
+
+  // k-th (0..3) of 4 consecutive logged samples
+  static inline int32_t in(const int32_t *src, int k) { return (nch == nsrc)? src[k] : src[(k/nch)*nsrc + k%nch]; }
+  // sample aligned to the top (24 significant bits in bits 8..31)
+  static inline uint32_t top(int32_t x) { return raw? (uint32_t) x << 1 : (uint32_t) x << 8; }
+  // 24 bit sample
+  static inline int32_t val(int32_t x) { return raw? msbCorrect(x) : x; }
+
+public:
+  enum { BYTES = (fmt == FMT_PACK24)? 3 : (fmt == FMT_INT16)? 2 : 4 }; // per sample
+
+  /*
+   * src first logged channel of nsamp frames (e.g. I2S buffer + first logged slot)
+   * dst nch*nsamp samples (multiple of 4), word aligned
+   */
+  static void store(void *dst, const int32_t *src, int nsamp)
+  { const int n = nch*nsamp;
+    if(fmt == FMT_INT32)
+    { int32_t *out = (int32_t *) dst;
+      for(int ii=0; ii<n; ii+=4)
+      { int32_t a = in(src,0), b = in(src,1), c = in(src,2), d = in(src,3);
+        out[0] = val(a); out[1] = val(b); out[2] = val(c); out[3] = val(d);
+        src += ADV; out += 4;
+      }
+    }
+    else if(fmt == FMT_PACK24)
+    { // 4 samples into 3 words
+      uint32_t *out = (uint32_t *) dst;
+      for(int ii=0; ii<n; ii+=4)
+      { uint32_t a = val(in(src,0)), b = val(in(src,1)), c = val(in(src,2)), d = val(in(src,3));
+        out[0] = (a & 0xffffff) | (b << 24);
+        out[1] = ((b >> 8) & 0xffff) | (c << 16);
+        out[2] = ((c >> 16) & 0xff) | (d << 8);
+        src += ADV; out += 3;
+      }
+    }
+    else
+    { // 4 samples into 2 words
+      uint32_t *out = (uint32_t *) dst;
+      for(int ii=0; ii<n; ii+=4)
+      { out[0] = pack16(top(in(src,0)), top(in(src,1)));
+        out[1] = pack16(top(in(src,2)), top(in(src,3)));
+        src += ADV; out += 2;
+      }
+    }
+  }
+
+  // reference: same result as store(), one sample at a time, little endian bytes
+  static void storeRef(void *dst, const int32_t *src, int nsamp)
+  { uint8_t *out = (uint8_t *) dst;
+    for(int ii=0; ii<nsamp; ii++)
+      for(int ich=0; ich<nch; ich++)
+      { int32_t x = src[ii*nsrc + ich];
+        int32_t v = raw? (int32_t)((uint32_t) x << 1) >> 8 : x;
+        if(fmt == FMT_INT16) v >>= 8;
+        for(int kk=0; kk<BYTES; kk++) *out++ = (uint8_t)((uint32_t) v >> (8*kk));
+      }
+  }
+};
+
+#endif
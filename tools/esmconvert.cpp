@@ -0,0 +1,269 @@
+// Copyright 2017 by Walter Zimmer
+//
+// esmconvert.cpp
+// converts ESM_Logger .bin files into WAV or FLAC files (one output per input)
+//
+// usage: esmconvert [options] file.bin ...
+//   -f wav|flac  output format (default wav)
+//   -o dir       output directory (default: next to the input file)
+//   -b bits      output bits per sample 16, 24 or 32 (default 24, 16 for FMT_INT16 files)
+//   -j threads   worker threads (default: number of cpus)
+//   -n           do not fill gaps of dropped blocks with zeros
+//   -v           one line per file
+//
+// the output is the time line of c_esmFile (esmfile.h): all sample formats,
+// records removed, overrun gaps filled with zeros (idle gaps of trigger mode are
+// not), the unwritten tail of files that were not closed (power loss) cut
+//
+// a pool of threads with work stealing first opens each file (only records and
+// tail are read) and then converts ranges of frames in parallel: WAV ranges are
+// written in place (pwrite), FLAC ranges are encoded independently (numbered
+// frames) and concatenated when the file is done
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <vector>
+#include <deque>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <chrono>
+
+#include "esmfile.h"
+#include "flac.h"
+#include "wav.h"
+
+#define RANGE_FRAMES 64   // FLAC frames (of FLAC_BLOCK samples) per task
+#define FLAC_BLOCK   4096
+
+static struct
+{ int flac = 0, bits = 0, threads = 0, fill = 1, verbose = 0;
+  const char *outDir = 0;
+} cfg;
+
+static std::mutex printLock;
+static std::atomic<uint64_t> totalIn(0), totalOut(0);
+static std::atomic<int> nerror(0);
+
+/*------------------------- work stealing pool -----------------------------*/
+// each worker takes tasks from the back of its own queue and, when that is empty,
+// steals from the front of the others; tasks may push new tasks (to their worker)
+class c_pool
+{
+public:
+  typedef std::function<void(void)> task_t;
+
+  c_pool(int n) : queue(n), lock(n), pending(0), next(0) {;}
+
+  void push(task_t task) // from a task: own queue, else round robin
+  { int w = (self >= 0)? self : (next++ % (int) queue.size());
+    pending++;
+    std::lock_guard<std::mutex> lg(lock[w]);
+    queue[w].push_back(std::move(task));
+  }
+
+  void run(void)
+  { std::vector<std::thread> threads;
+    for(size_t w=1; w<queue.size(); w++) threads.emplace_back(&c_pool::worker, this, (int) w);
+    worker(0);
+    for(auto &t: threads) t.join();
+  }
+
+private:
+  std::vector<std::deque<task_t>> queue;
+  std::vector<std::mutex> lock;
+  std::atomic<long> pending;  // pushed but not finished
+  std::atomic<int> next;
+  static thread_local int self;
+
+  bool take(int w, task_t &task, bool own)
+  { std::lock_guard<std::mutex> lg(lock[w]);
+    if(queue[w].empty()) return false;
+    if(own) { task = std::move(queue[w].back()); queue[w].pop_back(); }
+    else { task = std::move(queue[w].front()); queue[w].pop_front(); }
+    return true;
+  }
+
+  void worker(int w)
+  { self = w;
+    int n = queue.size();
+    while(pending > 0)
+    { task_t task;
+      bool have = take(w, task, true);
+      for(int ii=1; !have && ii<n; ii++) have = take((w+ii)%n, task, false);
+      if(!have) { std::this_thread::sleep_for(std::chrono::microseconds(200)); continue; }
+      task();
+      pending--;
+    }
+  }
+};
+thread_local int c_pool::self = -1;
+
+/*------------------------- one input file -----------------------------*/
+struct job_s
+{ std::string outName;
+  c_esmFile file;
+  uint32_t outBits = 24;
+  std::atomic<int> remaining;           // range tasks not done
+  int fd = -1;                          // output (WAV)
+  uint32_t dataOffset = 0;              // WAV header size
+  std::vector<std::vector<uint8_t>> chunks; // encoded ranges (FLAC)
+  std::vector<uint32_t> fmin, fmax;     // frame sizes of ranges (FLAC)
+};
+
+static void fetch(job_s *job, int32_t *dst, uint64_t s0, uint64_t s1)
+{ // time line samples s0..s1-1 (interleaved), scaled to output bits
+  job->file.read(dst, s0, s1);
+  uint64_t n = (s1-s0)*job->file.channels();
+  int shift = (int) job->outBits - (int) job->file.bits();
+  if(shift > 0) for(uint64_t ii=0; ii<n; ii++) dst[ii] = (int32_t)((uint32_t) dst[ii] << shift);
+  if(shift < 0) for(uint64_t ii=0; ii<n; ii++) dst[ii] >>= -shift;
+}
+
+/*------------------------- output -----------------------------*/
+static void finish(job_s *job)
+{ // last range of file is done
+  c_esmFile *f = &job->file;
+  if(cfg.flac)
+  { c_flacEnc enc;
+    enc.init(job->file.channels(), job->file.fsamp(), job->outBits, FLAC_BLOCK);
+    uint32_t fmin = 0xffffff, fmax = 0;
+    for(size_t ii=0; ii<job->chunks.size(); ii++)
+    { fmin = std::min(fmin, job->fmin[ii]); fmax = std::max(fmax, job->fmax[ii]); }
+    std::vector<uint8_t> head;
+    enc.header(head, job->file.samples(), fmin, fmax);
+    FILE *fout = fopen(job->outName.c_str(), "wb");
+    int ok = fout && fwrite(head.data(), 1, head.size(), fout) == head.size();
+    for(auto &c: job->chunks) ok = ok && fwrite(c.data(), 1, c.size(), fout) == c.size();
+    if(fout) fclose(fout);
+    if(!ok) { perror(job->outName.c_str()); nerror++; }
+    for(auto &c: job->chunks) totalOut += c.size();
+    job->chunks.clear();
+  }
+  else
+  { if(close(job->fd)) { perror(job->outName.c_str()); nerror++; }
+    totalOut += job->dataOffset + f->samples()*f->channels()*job->outBits/8;
+  }
+  totalIn += f->bytes();
+  if(cfg.verbose || f->nbad)
+  { std::lock_guard<std::mutex> lg(printLock);
+    printf("%s: %.1f s, %u ch, %u Hz", job->outName.c_str(), (double) f->samples()/f->fsamp(),
+        f->channels(), f->fsamp());
+    if(f->ngap) printf(", %u dropped blocks (%u zero filled)", f->ngap, f->nfill);
+    if(f->nidle) printf(", %u idle blocks", f->nidle);
+    if(f->ncut) printf(", %u blocks cut at end", f->ncut);
+    if(f->nbad) printf(", %u damaged frames", f->nbad);
+    printf("\n");
+  }
+  delete job;
+}
+
+static void convert(job_s *job, uint32_t irange)
+{ uint64_t per = (uint64_t) RANGE_FRAMES*FLAC_BLOCK;
+  uint64_t s0 = irange*per, s1 = std::min(s0 + per, job->file.samples());
+  uint32_t nch = job->file.channels();
+  std::vector<int32_t> buf((s1-s0)*nch);
+  fetch(job, buf.data(), s0, s1);
+
+  if(cfg.flac)
+  { c_flacEnc enc;
+    enc.init(nch, job->file.fsamp(), job->outBits, FLAC_BLOCK);
+    std::vector<uint8_t> &out = job->chunks[irange];
+    for(uint64_t s = s0; s < s1; s += FLAC_BLOCK)
+    { int n = (int) std::min<uint64_t>(FLAC_BLOCK, s1 - s);
+      enc.encode(out, &buf[(s-s0)*nch], n, (uint32_t)(s/FLAC_BLOCK));
+    }
+    job->fmin[irange] = enc.minFrame; job->fmax[irange] = enc.maxFrame;
+  }
+  else
+  { uint32_t bps = job->outBits/8;
+    std::vector<uint8_t> out(buf.size()*bps);
+    wav_pack(out.data(), buf.data(), buf.size(), job->outBits);
+    if(pwrite(job->fd, out.data(), out.size(), job->dataOffset + s0*nch*bps) != (ssize_t) out.size())
+    { perror(job->outName.c_str()); nerror++; }
+  }
+  if(--job->remaining == 0) finish(job);
+}
+
+static std::string outputName(const char *in)
+{ std::string name(in);
+  std::string dir;
+  size_t slash = name.rfind('/');
+  if(slash != std::string::npos) { dir = name.substr(0, slash+1); name = name.substr(slash+1); }
+  if(cfg.outDir) dir = std::string(cfg.outDir) + "/";
+  size_t dot = name.rfind('.');
+  if(dot != std::string::npos) name = name.substr(0, dot);
+  return dir + name + (cfg.flac? ".flac" : ".wav");
+}
+
+static void openJob(c_pool *pool, const char *name)
+{ job_s *job = new job_s;
+  job->outName = outputName(name);
+  if(!job->file.open(name, cfg.fill))
+  { fprintf(stderr,"%s: %s\n", name, job->file.error); nerror++; delete job; return; }
+  job->outBits = cfg.bits? cfg.bits : job->file.bits();
+
+  uint64_t per = (uint64_t) RANGE_FRAMES*FLAC_BLOCK;
+  uint32_t nrange = (uint32_t)((job->file.samples() + per - 1)/per);
+  if(!nrange) { fprintf(stderr,"%s: no data\n",name); delete job; return; }
+  if(!cfg.flac)
+  { uint8_t hdr[WAV_HEADER_MAX];
+    job->dataOffset = wav_header(hdr, job->file.channels(), job->file.fsamp(), job->outBits, job->file.samples());
+    if(!wav_fits(job->file.channels(), job->outBits, job->file.samples()))
+    { fprintf(stderr,"%s: too large for WAV\n",name); nerror++; delete job; return; }
+    job->fd = ::open(job->outName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(job->fd < 0 || pwrite(job->fd, hdr, job->dataOffset, 0) != job->dataOffset)
+    { perror(job->outName.c_str()); nerror++;
+      if(job->fd >= 0) close(job->fd);
+      delete job; return;
+    }
+  }
+  else
+  { job->chunks.resize(nrange); job->fmin.resize(nrange); job->fmax.resize(nrange);
+  }
+  job->remaining = nrange;
+  // the own queue is worked from the back: push last range first
+  for(uint32_t ii=nrange; ii-- > 0; ) pool->push([job, ii]() { convert(job, ii); });
+}
+
+int main(int argc, char *argv[])
+{
+  int opt;
+  while((opt = getopt(argc, argv, "f:o:b:j:nv")) != -1)
+  { switch(opt)
+    { case 'f': cfg.flac = !strcmp(optarg, "flac"); break;
+      case 'o': cfg.outDir = optarg; break;
+      case 'b': cfg.bits = atoi(optarg); break;
+      case 'j': cfg.threads = atoi(optarg); break;
+      case 'n': cfg.fill = 0; break;
+      case 'v': cfg.verbose = 1; break;
+      default: optind = argc+1; break;
+    }
+  }
+  if(optind >= argc || (cfg.bits && cfg.bits != 16 && cfg.bits != 24 && cfg.bits != 32))
+  { fprintf(stderr,"usage: esmconvert [-f wav|flac] [-o dir] [-b 16|24|32] [-j threads] [-n] [-v] file.bin ...\n");
+    return 1;
+  }
+  int nthreads = cfg.threads? cfg.threads : std::max(1u, std::thread::hardware_concurrency());
+
+  auto t0 = std::chrono::steady_clock::now();
+  c_pool pool(nthreads);
+  for(int ii=optind; ii<argc; ii++)
+  { std::string name(argv[ii]);
+    pool.push([&pool, name]() { openJob(&pool, name.c_str()); });
+  }
+  pool.run();
+  double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+  printf("# %d files, %.1f MB in, %.1f MB out, %.2f s, %.1f MB/s (%d threads)%s\n",
+      argc-optind, totalIn/1048576.0, totalOut/1048576.0, sec, totalIn/1048576.0/sec, nthreads,
+      nerror? ", with errors" : "");
+  return nerror? 1 : 0;
+}
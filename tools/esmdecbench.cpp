@@ -0,0 +1,89 @@
+// Copyright 2017 by Walter Zimmer
+//
+// esmdecbench.cpp
+// host benchmark and check of the decimation filter (src/decimate.h)
+//
+// usage: esmdecbench [nblocks]
+//   for each factor 2..8 and 1, 2, 4 channels runs nblocks I2S blocks
+//   (128 samples, I2S interleaved as in i2sInProcessing) through the decimator
+//   and prints cycles (x86 time stamp counter) and ns per block,
+//   pass band gain at 0.4 fs_out and worst alias gain (stop band, >= 0.6 fs_out)
+//   host cycles are only indicative, on the teensy acqLoop prints the
+//   measured cycles per block (and per sample) every second while logging
+//   when DECIMATE > 1
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+  #include <x86intrin.h>
+  static inline uint64_t cycles(void) { return __rdtsc();}
+#else
+  static inline uint64_t cycles(void) { return 0;}
+#endif
+
+#include "decimate.h"
+
+#define N_SAMP 128
+#define NTPP   32
+
+// gain of decimator for a full scale sine at frequency f (relative to input rate)
+template <int nch>
+static double toneGain(Decimator<nch,NTPP> &dec, int m, double f)
+{
+  dec.init(m);
+  int nin = 64*N_SAMP;
+  int i2sChan = (nch <= 2)? 2 : 4;
+  std::vector<int32_t> src(i2sChan*nin), dst(nch*nin);
+  for(int ii=0; ii<nin; ii++)
+    for(int ich=0; ich<i2sChan; ich++) src[i2sChan*ii+ich] = (int32_t) lrint(8388607.0*sin(2*M_PI*f*ii));
+  int nout = 0;
+  for(int ii=0; ii<nin; ii+=N_SAMP)
+    nout += dec.process(&dst[nch*nout], &src[i2sChan*ii], N_SAMP, i2sChan);
+  // rms of second half (after filter settled)
+  double sum = 0;
+  for(int ii=nout/2; ii<nout; ii++) sum += (double)dst[nch*ii]*dst[nch*ii];
+  return sqrt(2.0*sum/(nout-nout/2))/8388607.0;
+}
+
+template <int nch>
+static void bench(int nblocks)
+{
+  static Decimator<nch,NTPP> dec;
+  int i2sChan = (nch <= 2)? 2 : 4;
+  std::vector<int32_t> src(i2sChan*N_SAMP), dst(nch*N_SAMP);
+  for(int ii=0; ii<i2sChan*N_SAMP; ii++) src[ii] = (rand() & 0xffffff) - 0x800000;
+
+  for(int m=2; m<=8; m++)
+  {
+    dec.init(m);
+    int nout = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    uint64_t c0 = cycles();
+    for(int ii=0; ii<nblocks; ii++)
+      nout += dec.process(dst.data(), src.data(), N_SAMP, i2sChan);
+    uint64_t c1 = cycles();
+    auto t1 = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double,std::nano>(t1-t0).count();
+
+    double pass = toneGain<nch>(dec, m, 0.4/m);
+    double alias = 0;
+    for(double f=0.6/m; f<0.5; f+=0.02/m) { double g = toneGain<nch>(dec, m, f); if(g>alias) alias=g;}
+
+    printf("%3d %3d %4d %10.0f %10.1f %8.2f %8.1f   (%d out)\n", nch, m, NTPP*m,
+        (double)(c1-c0)/nblocks, ns/nblocks, 20*log10(pass), 20*log10(alias+1e-12), nout);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  int nblocks = (argc>1)? atoi(argv[1]) : 10000;
+  printf("nch   m taps  cyc/block   ns/block  pass dB alias dB\n");
+  bench<1>(nblocks);
+  bench<2>(nblocks);
+  bench<4>(nblocks);
+  return 0;
+}
@@ -0,0 +1,69 @@
+// Copyright 2017 by Walter Zimmer
+//
+// esmdecode.cpp
+// decodes an ESM_Logger .bin file with rice coded frames (FMT_RICE)
+// into a .bin file with 32 bit samples (FMT_INT32)
+//
+// usage: esmdecode in.bin out.bin
+//   gap and block index records are kept
+//   damaged frames are skipped by searching the next sync word
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include "binfile.h"
+#include "rice.h"
+
+int main(int argc, char *argv[])
+{
+  if(argc<3) { fprintf(stderr,"usage: esmdecode in.bin out.bin\n"); return 1;}
+
+  FILE *fid = fopen(argv[1],"rb");
+  if(!fid) { perror(argv[1]); return 1;}
+
+  header_s header;
+  if(fread(&header,sizeof(header),1,fid)!=1) { fprintf(stderr,"%s: no header\n",argv[1]); return 1;}
+  if(!header.nch || !header.nsamp) { fprintf(stderr,"%s: bad header\n",argv[1]); return 1;}
+  if(header.fmt != FMT_RICE) { fprintf(stderr,"%s: not rice coded (fmt %u)\n",argv[1],header.fmt); return 1;}
+
+  // frames are small, so simply read rest of file
+  std::vector<uint8_t> data;
+  uint8_t tmp[65536];
+  size_t nr;
+  while((nr=fread(tmp,1,sizeof(tmp),fid))>0) data.insert(data.end(),tmp,tmp+nr);
+  fclose(fid);
+
+  FILE *fout = fopen(argv[2],"wb");
+  if(!fout) { perror(argv[2]); return 1;}
+
+  header.fmt = FMT_INT32;
+  fwrite(&header,sizeof(header),1,fout);
+
+  uint32_t nd = header.nch*header.nsamp; // samples per block
+  std::vector<int32_t> out(nd);
+
+  uint64_t nframes = 0, nraw = 0, nskipped = 0;
+  size_t pos = 0;
+  while(pos + sizeof(rice_frame_s) <= data.size())
+  {
+    uint32_t nb = rice_decode(out.data(), &data[pos], data.size()-pos, header.nsamp);
+    if(!nb)
+    { // lost sync (or zero padded end of file); frames are word aligned
+      pos += 4; nskipped += 4;
+      continue;
+    }
+    if(((rice_frame_s *)&data[pos])->type == RICE_RAW) nraw++;
+    fwrite(out.data(),sizeof(int32_t),nd,fout);
+    pos += nb;
+    nframes++;
+  }
+  fprintf(stderr,"%s: %llu frames (%llu raw) %llu bytes skipped, ratio %.2f\n", argv[1],
+      (unsigned long long)nframes, (unsigned long long)nraw, (unsigned long long)nskipped,
+      data.size()? (double)(nframes*nd*sizeof(int32_t))/data.size() : 0.0);
+
+  fclose(fout);
+  return 0;
+}
@@ -0,0 +1,134 @@
+// Copyright 2017 by Walter Zimmer
+//
+// esmdetect.cpp
+// runs the trigger detector (detector.h) over ESM_Logger .bin files
+// to choose its parameters and to measure its speed and trigger rate
+//
+// usage: esmdetect [options] file.bin ...
+//   -l Hz     lower band edge (default 2000)
+//   -u Hz     upper band edge (default 8000)
+//   -s dB     threshold above noise floor (default 12)
+//   -t sec    time constant of noise floor (default 10)
+//   -b sec    pre-trigger time (default 0.25)
+//   -a sec    post-trigger time (default 5)
+//   -c ich    channel (default 0)
+//   -v        list events (start time, duration, peak level above floor)
+//
+// files are processed in sequence with one detector, as on the teensy;
+// the detector sees the logged data (blocks of the file), gaps are skipped
+// the recorded fraction is what TRIGGER would write with the given pre/post times
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <vector>
+#include <chrono>
+
+#include "esmfile.h"
+#include "detector.h"
+
+static struct
+{ float flo = 2000, fhi = 8000, snr = 12, tau = 10;
+  float pre = 0.25f, post = 5;
+  int ich = 0, verbose = 0;
+} cfg;
+
+static Detector<0> detector;
+static int haveInit = 0;
+static double tsum = 0;        // ns in detector
+static uint64_t nblocks = 0, ndetect = 0, nrecord = 0, nevents = 0;
+static uint64_t lastDetect = 0, recEnd = 0; // block indices
+static double evStart = 0, evPeak = 0;
+static uint32_t preBlocks = 0, postBlocks = 0;
+static double tblk = 0;
+static uint32_t nsamp = 0;
+
+static void block(const int32_t *data, const header_s *hdr)
+{
+  auto t0 = std::chrono::steady_clock::now();
+  int16_t det = detector.process(data + cfg.ich, hdr->nsamp, hdr->nch);
+  tsum += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+
+  if(det)
+  { double snr = 10*log10(detector.level()/detector.noise());
+    if(nblocks >= recEnd)
+    { // new event, blocks from nblocks-pre are written
+      if(nevents && cfg.verbose)
+        printf("event %10.3f s %8.3f s %6.1f dB\n", evStart, (lastDetect+1)*tblk-evStart, evPeak);
+      uint64_t bgn = (nblocks > preBlocks)? nblocks-preBlocks : 0;
+      if(bgn < recEnd) bgn = recEnd;
+      nrecord += nblocks - bgn;
+      nevents++;
+      evStart = nblocks*tblk; evPeak = snr;
+    }
+    if(snr > evPeak) evPeak = snr;
+    recEnd = nblocks + 1 + postBlocks;
+    lastDetect = nblocks;
+    ndetect++;
+  }
+  if(nblocks < recEnd) nrecord++;
+  nblocks++;
+}
+
+static int process(const char *name)
+{
+  c_esmFile file;
+  if(!file.open(name, 0)) { fprintf(stderr,"%s: %s\n",name,file.error); return 0;} // gaps are skipped
+  const header_s *hdr = &file.hdr;
+  if(cfg.ich >= (int) hdr->nch) { fprintf(stderr,"%s: no channel %d\n",name,cfg.ich); return 0;}
+  if(!haveInit)
+  { detector.init(hdr->fsamp, hdr->nsamp, cfg.flo, cfg.fhi, cfg.snr, cfg.tau);
+    tblk = (double) hdr->nsamp/hdr->fsamp;
+    nsamp = hdr->nsamp;
+    preBlocks = (uint32_t)(cfg.pre/tblk);
+    postBlocks = (uint32_t)(cfg.post/tblk);
+    haveInit = 1;
+  }
+
+  std::vector<int32_t> buf(hdr->nch*hdr->nsamp);
+  for(uint64_t t = 0; t + hdr->nsamp <= file.samples(); t += hdr->nsamp)
+  { file.read(buf.data(), t, t + hdr->nsamp);
+    block(buf.data(), hdr);
+  }
+  return 1;
+}
+
+int main(int argc, char *argv[])
+{
+  int opt;
+  while((opt = getopt(argc, argv, "l:u:s:t:b:a:c:v")) != -1)
+  { switch(opt)
+    { case 'l': cfg.flo = atof(optarg); break;
+      case 'u': cfg.fhi = atof(optarg); break;
+      case 's': cfg.snr = atof(optarg); break;
+      case 't': cfg.tau = atof(optarg); break;
+      case 'b': cfg.pre = atof(optarg); break;
+      case 'a': cfg.post = atof(optarg); break;
+      case 'c': cfg.ich = atoi(optarg); break;
+      case 'v': cfg.verbose = 1; break;
+      default: optind = argc+1; break;
+    }
+  }
+  if(optind >= argc)
+  { fprintf(stderr,"usage: esmdetect [-l Hz] [-u Hz] [-s dB] [-t sec] [-b sec] [-a sec] [-c ich] [-v] file.bin ...\n");
+    return 1;
+  }
+  for(int ii=optind; ii<argc; ii++) process(argv[ii]);
+  if(!nblocks) { fprintf(stderr,"esmdetect: no data\n"); return 1;}
+  if(nevents && cfg.verbose)
+    printf("event %10.3f s %8.3f s %6.1f dB\n", evStart, (lastDetect+1)*tblk-evStart, evPeak);
+
+  double hours = nblocks*tblk/3600.0;
+  printf("# band %.0f-%.0f Hz, threshold %.1f dB, floor %.1f s, pre %.2f s, post %.2f s\n",
+      cfg.flo, cfg.fhi, cfg.snr, cfg.tau, cfg.pre, cfg.post);
+  printf("# %.3f h of data, %llu blocks, %llu detections, %llu events (%.1f per hour)\n",
+      hours, (unsigned long long)nblocks, (unsigned long long)ndetect,
+      (unsigned long long)nevents, nevents/hours);
+  printf("# recorded %.2f %% of blocks\n", 100.0*nrecord/nblocks);
+  printf("# detector %.0f ns per block (%.2f ns per sample, host)\n",
+      tsum/nblocks, tsum/nblocks/nsamp);
+  return 0;
+}
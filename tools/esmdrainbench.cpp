@@ -0,0 +1,106 @@
+// Copyright 2017 by Walter Zimmer
+//
+// esmdrainbench.cpp
+// host benchmark of Logger::drain() (src/logger.h): bytes copied while draining
+//
+// usage: esmdrainbench [-t sec] [-f fs] [-c nch] [-n nq] [-w naud]
+//   -t sec   audio time per channel count (default 600)
+//   -f fs    sampling rate (default 44100)
+//   -c nch   logged channels 1, 2 or 4 (default: all three)
+//   -n nq    queue blocks (default as acqConfig: as many as fit into the default arena)
+//   -w naud  blocks per write (default 64/nch)
+//
+// the makefile builds it twice: esmdrainbench with ZERO_COPY (as myAPP.cpp) and
+// esmdrainbench_copy without, where drain() copies each write buffer (as before
+// the zero-copy mode); ZERO_COPY still copies a write buffer that wraps around the
+// end of the queue, which happens when nq is not a multiple of naud (e.g. -w 48)
+//
+// producer and consumer alternate as ISR and loop(): one I2S block of 24 bit packed
+// samples (PACK_24) is reserved, filled and committed, and whenever naud blocks are
+// queued they are drained and released (mFS.write is left out)
+// prints bytes copied per second of audio, ns per drained write buffer and its share
+// of the real-time budget (ns of audio); the drained data are compared with what was
+// produced, exit code 1 on mismatch
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <chrono>
+#include <vector>
+
+#define N_SAMP 128
+#include "loggerhost.h" // src/logger.h
+
+#define ARENA_BYTES ((4 + 32*3 + 2)*1024) // default ARENA_KB of myAPP.cpp with PACK_24
+
+static uint8_t pattern(uint32_t blk, uint32_t ii) { return (uint8_t)(blk*131 + ii); }
+
+int main(int argc, char *argv[])
+{
+  double tsim = 600;
+  uint32_t fs = 44100, nchOne = 0, nqOpt = 0, naOpt = 0;
+  int opt;
+  while((opt = getopt(argc, argv, "t:f:c:n:w:")) != -1)
+  { switch(opt)
+    { case 't': tsim = atof(optarg); break;
+      case 'f': fs = atoi(optarg); break;
+      case 'c': nchOne = atoi(optarg); break;
+      case 'n': nqOpt = atoi(optarg); break;
+      case 'w': naOpt = atoi(optarg); break;
+      default: fprintf(stderr,"usage: esmdrainbench [-t sec] [-f fs] [-c nch] [-n nq] [-w naud]\n"); return 1;
+    }
+  }
+  std::vector<uint32_t> chans = {1, 2, 4};
+  if(nchOne) chans.assign(1, nchOne);
+  std::vector<uint8_t> arena(ARENA_BYTES + 8);
+
+  int nbad = 0;
+  #ifdef ZERO_COPY
+    printf("# ZERO_COPY, fs %u Hz, %.0f s of audio per run\n", fs, tsim);
+  #else
+    printf("# copying drain, fs %u Hz, %.0f s of audio per run\n", fs, tsim);
+  #endif
+  printf("# nch    nq  naud   block   copied kB/s   copied %%   ns/write   budget %%\n");
+  for(auto nch: chans)
+  { Logger<uint8_t> logger;
+    uint32_t i2sChan = (nch == 4)? 4 : 2;
+    uint32_t nb = ARENA_BYTES - 2*i2sChan*N_SAMP*4; // less DMA buffer
+    uint32_t nd = nch*N_SAMP*3;
+    uint32_t na = naOpt? naOpt : 64/nch;
+    uint32_t nq = nqOpt;
+    if(!nq) for(nq = 1<<15; (nq > na) && (logger.arenaBytes(nq, nd, na) > nb); nq >>= 1) ;
+    if(!logger.configure(arena.data(), nb, nq, nd, na))
+    { printf("%5u  geometry nq %u naud %u does not fit into arena, skipped\n", nch, nq, na); continue; }
+    header.nsamp = N_SAMP;
+    logger.start();
+
+    uint64_t nblk = (uint64_t)(tsim*fs/N_SAMP), nwrite = 0, ndrained = 0;
+    double ns = 0;
+    for(uint64_t kk=0; kk<nblk; kk++)
+    { uint8_t *ptr = logger.reserve(); // ISR
+      for(uint32_t ii=0; ii<nd; ii++) ptr[ii] = pattern((uint32_t)kk, ii);
+      logger.commit();
+      if(logger.available() < na) continue;
+      auto t0 = std::chrono::steady_clock::now(); // loop()
+      uint8_t *data = (uint8_t *) logger.drain();
+      auto t1 = std::chrono::steady_clock::now();
+      for(uint32_t jj=0; jj<na && !nbad; jj++)
+        for(uint32_t ii=0; ii<nd; ii++)
+          if(data[jj*nd+ii] != pattern((uint32_t)(ndrained+jj), ii)) { nbad++; break; }
+      auto t2 = std::chrono::steady_clock::now();
+      logger.release();
+      ns += std::chrono::duration<double, std::nano>(t1 - t0).count()
+          + std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t2).count();
+      ndrained += na;
+      nwrite++;
+    }
+    double tau = (double) nblk*N_SAMP/fs;
+    double written = (double) ndrained*nd;
+    printf("%5u %5u %5u %7u   %11.1f   %8.1f   %8.0f   %8.4f\n", nch, nq, na, nd,
+        logger.copyCount/tau/1024.0, 100.0*logger.copyCount/(written? written : 1),
+        nwrite? ns/nwrite : 0.0, 100.0*ns/(tau*1e9));
+  }
+  printf("# check: %s\n", nbad? "failed" : "ok");
+  return nbad? 1 : 0;
+}
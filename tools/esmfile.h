@@ -0,0 +1,291 @@
+// Copyright 2017 by Walter Zimmer
+//
+// esmfile.h
+// memory mapped reader of ESM_Logger .bin files for the (linux) host tools
+//
+//   c_esmFile file;
+//   if(!file.open("WMXZ_20170714_024000.bin")) { fprintf(stderr,"%s\n",file.error); ...}
+//   // zero copy: one call per contiguous piece of [t0,t1)
+//   file.forEach(t0, t1, [&](const c_esmBlock &blk)
+//   { c_esmChan x = blk.chan(1);          // channel 1, blk.n samples, strided
+//     for(uint32_t ii=0; ii<x.size(); ii++) sum += x[ii];
+//   });
+//   // or copy a range (interleaved int32, or one channel)
+//   file.read(buf, t0, t1);
+//
+// the time line of a file is its samples (per channel) without in-band records;
+// dropped blocks of overrun gaps are zeros (unless opened with fillGaps=0), idle
+// gaps of trigger mode only with fillGaps=2 (the time line is then real time, zeros
+// cost nothing as they are not stored); the tail of a file that was not closed
+// (power loss) is cut: an incomplete last block and trailing all-zero blocks of
+// the pre-allocated file, or for FMT_RICE everything after the last valid frame
+//
+// open() only reads records and the tail, samples are touched when they are used
+// views point into the mapping (FMT_INT32, FMT_INT16 and FMT_PACK24, the latter is
+// unpacked by the view on access); FMT_RICE frames are decoded block by block into
+// a buffer of the caller of forEach(), so several threads can read one file
+// forEach() drops the pages it has passed from memory, so files larger than RAM
+// can be streamed
+//
+#ifndef ESMFILE_H
+#define ESMFILE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vector>
+#include <algorithm>
+
+#include "binfile.h"
+#include "rice.h"
+
+// one channel of interleaved samples (no copy)
+class c_esmChan
+{
+public:
+  c_esmChan(const uint8_t *p, uint32_t nsamp, uint32_t strideBytes, uint32_t format)
+    : ptr(p), n(nsamp), stride(strideBytes), fmt(format) {;}
+
+  inline int32_t operator[](size_t ii) const
+  { const uint8_t *p = ptr + ii*stride;
+    if(fmt == FMT_PACK24) return ((int32_t)(p[0] | (p[1] << 8) | (p[2] << 16)) << 8) >> 8;
+    if(fmt == FMT_INT16) return *(const int16_t *) p;
+    return *(const int32_t *) p;
+  }
+  uint32_t size(void) const { return n; }
+  // direct access, if samples are int32 (FMT_INT32, decoded FMT_RICE, gaps): p[ii*step()]
+  const int32_t *int32(void) const { return (fmt == FMT_INT32)? (const int32_t *) ptr : 0; }
+  uint32_t step(void) const { return stride/sizeof(int32_t); }
+
+private:
+  const uint8_t *ptr;
+  uint32_t n, stride, fmt;
+};
+
+// contiguous piece of the time line (all channels)
+struct c_esmBlock
+{
+  uint64_t t0;          // first sample (per channel) on the time line
+  uint32_t n;           // samples per channel
+  uint32_t nch;
+  uint32_t fmt;         // sample format of ptr (FMT_INT32 for decoded frames and gaps)
+  const uint8_t *ptr;   // first sample of channel 0
+  int isGap;            // zeros of dropped blocks
+
+  c_esmChan chan(uint32_t ich) const
+  { uint32_t bs = sampleBytes(fmt);
+    if(isGap) return c_esmChan(ptr, n, 0, FMT_INT32);
+    return c_esmChan(ptr + ich*bs, n, nch*bs, fmt);
+  }
+};
+
+class c_esmFile
+{
+public:
+  enum { SEG_DATA, SEG_RICE, SEG_ZERO };
+  typedef struct
+  { uint64_t out;     // first sample (per channel) on the time line
+    uint64_t pos;     // byte offset in file
+    uint32_t nsamp;   // samples per channel
+    uint32_t type;
+  } seg_s;
+
+  header_s hdr;
+  const char *error = 0;
+  // blocks dropped on overrun, idle (trigger mode), zero filled, cut at end (approx. for FMT_RICE), damaged
+  uint32_t ngap = 0, nidle = 0, nfill = 0, ncut = 0, nbad = 0;
+  std::vector<uint64_t> records;  // byte offsets of in-band records (after the frame header for FMT_RICE)
+
+  c_esmFile(void) { memset(&hdr, 0, sizeof(hdr)); }
+  ~c_esmFile(void) { close(); }
+  c_esmFile(const c_esmFile &) = delete;
+  c_esmFile &operator=(const c_esmFile &) = delete;
+
+  int open(const char *name, int fillGaps = 1)
+  { close();
+    int fd = ::open(name, O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st)) { error = "cannot open"; if(fd >= 0) ::close(fd); return 0; }
+    size = st.st_size;
+    if(size < sizeof(header_s)) { error = "no header"; ::close(fd); return 0; }
+    map = (const uint8_t *) mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(map == MAP_FAILED) { map = 0; error = "cannot map"; return 0; }
+    madvise((void *) map, size, MADV_SEQUENTIAL);
+
+    memcpy(&hdr, map, sizeof(hdr));
+    if(!hdr.nch || hdr.nch > 8 || !hdr.nsamp || !hdr.fsamp || hdr.fmt > FMT_RICE)
+    { error = "bad header"; close(); return 0; }
+    fill = fillGaps;
+    scan();
+    return 1;
+  }
+
+  void close(void)
+  { if(map) munmap((void *) map, size);
+    map = 0; size = 0; nsamp = 0;
+    segs.clear(); records.clear();
+    ngap = nidle = nfill = ncut = nbad = 0;
+  }
+
+  uint64_t samples(void) const { return nsamp; } // per channel
+  uint32_t channels(void) const { return hdr.nch; }
+  uint32_t fsamp(void) const { return hdr.fsamp; }
+  uint32_t bits(void) const { return (hdr.fmt == FMT_INT16)? 16 : 24; }
+  const uint8_t *data(void) const { return map; }
+  size_t bytes(void) const { return size; }
+  const std::vector<seg_s> &segments(void) const { return segs; }
+
+  /*
+   * calls fn(const c_esmBlock &) for the contiguous pieces of [t0,t1) in order
+   * (at most MAX_PIECE samples); pages of the mapping before the actual piece
+   * are released
+   */
+  template <typename F>
+  void forEach(uint64_t t0, uint64_t t1, F fn) const
+  { if(t1 > nsamp) t1 = nsamp;
+    if(t0 >= t1) return;
+    std::vector<int32_t> block;
+    static const int32_t zero = 0;
+    uint32_t bs = sampleBytes(hdr.fmt);
+    uint64_t released = ~0ull;
+    auto seg = std::upper_bound(segs.begin(), segs.end(), t0,
+        [](uint64_t t, const seg_s &g) { return t < g.out; }) - 1;
+    for(uint64_t t = t0; t < t1; )
+    { if(t >= seg->out + seg->nsamp) seg++;
+      uint64_t i0 = t - seg->out;
+      uint32_t n = (uint32_t)(std::min<uint64_t>(seg->out + seg->nsamp, t1) - t);
+      c_esmBlock blk = { t, n, hdr.nch, hdr.fmt, 0, 0 };
+      uint64_t pos = seg->pos;
+      if(seg->type == SEG_ZERO) { blk.ptr = (const uint8_t *) &zero; blk.fmt = FMT_INT32; blk.isGap = 1; }
+      else if(seg->type == SEG_DATA)
+      { if(blk.n > MAX_PIECE) blk.n = n = MAX_PIECE;
+        pos += i0*hdr.nch*bs;
+        blk.ptr = map + pos;
+      }
+      else
+      { block.resize(hdr.nch*hdr.nsamp);
+        if(!rice_decode(block.data(), map + pos, size - pos, hdr.nsamp))
+          memset(block.data(), 0, block.size()*sizeof(int32_t));
+        blk.ptr = (const uint8_t *) &block[i0*hdr.nch];
+        blk.fmt = FMT_INT32;
+      }
+      if(seg->type != SEG_ZERO)
+      { // streaming: drop pages that this call has passed
+        uint64_t page = pos & ~(uint64_t)(sysconf(_SC_PAGESIZE)-1);
+        if(released == ~0ull) released = page;
+        if(page - released > RELEASE_BYTES)
+        { madvise((void *)(map + released), page - released, MADV_DONTNEED);
+          released = page;
+        }
+      }
+      fn(blk);
+      t += n;
+    }
+  }
+
+  // copy [t0,t1) as interleaved int32 (all channels), returns samples per channel
+  uint64_t read(int32_t *dst, uint64_t t0, uint64_t t1) const
+  { uint64_t n0 = 0;
+    forEach(t0, t1, [&](const c_esmBlock &blk)
+    { for(uint32_t ich=0; ich<blk.nch; ich++)
+      { c_esmChan x = blk.chan(ich);
+        int32_t *d = dst + (blk.t0-t0)*blk.nch + ich;
+        for(uint32_t ii=0; ii<blk.n; ii++) d[ii*blk.nch] = x[ii];
+      }
+      n0 += blk.n;
+    });
+    return n0;
+  }
+
+  // copy [t0,t1) of one channel
+  uint64_t read(int32_t *dst, uint32_t ich, uint64_t t0, uint64_t t1) const
+  { uint64_t n0 = 0;
+    forEach(t0, t1, [&](const c_esmBlock &blk)
+    { c_esmChan x = blk.chan(ich);
+      int32_t *d = dst + (blk.t0-t0);
+      for(uint32_t ii=0; ii<blk.n; ii++) d[ii] = x[ii];
+      n0 += blk.n;
+    });
+    return n0;
+  }
+
+private:
+  enum { RELEASE_BYTES = 64 << 20, MAX_PIECE = 1 << 16 }; // bytes, samples
+  const uint8_t *map = 0;
+  size_t size = 0;
+  int fill = 1;
+  uint64_t nsamp = 0;
+  std::vector<seg_s> segs;
+
+  void addSeg(uint32_t type, uint64_t pos, uint32_t ns)
+  { // merge contiguous data blocks and zero fills
+    if(!segs.empty())
+    { seg_s &last = segs.back();
+      uint64_t nb = (uint64_t) last.nsamp*hdr.nch*sampleBytes(hdr.fmt);
+      if(type == last.type && ((type == SEG_DATA && pos == last.pos + nb) || type == SEG_ZERO))
+      { last.nsamp += ns; nsamp += ns; return; }
+    }
+    seg_s seg = { nsamp, pos, ns, type };
+    segs.push_back(seg);
+    nsamp += ns;
+  }
+
+  void record(uint64_t pos)
+  { // gap records stand for the first of ndrop dropped blocks
+    records.push_back(pos);
+    if(!isGap(map + pos)) return;
+    const gap_s *gap = (const gap_s *)(map + pos);
+    if(gap->cause == GAP_IDLE) nidle += gap->ndrop; else ngap += gap->ndrop;
+    if(!fill || (gap->cause == GAP_IDLE && fill < 2)) return;
+    addSeg(SEG_ZERO, 0, gap->ndrop*hdr.nsamp);
+    nfill += gap->ndrop;
+  }
+
+  void scan(void)
+  { // time line, no sample data is read
+    size_t pos = sizeof(header_s);
+    if(hdr.fmt == FMT_RICE)
+    { size_t lastGood = pos;
+      while(pos + sizeof(rice_frame_s) <= size)
+      { const rice_frame_s *frame = (const rice_frame_s *) &map[pos];
+        if(frame->sync != RICE_SYNC || pos + sizeof(rice_frame_s) + frame->nbytes > size)
+        { pos += 4; continue; } // search next frame (or end of data)
+        if(pos != lastGood)
+        { // skipped bytes: damaged frame or unwritten tail
+          size_t ii; for(ii=lastGood; ii<pos && !map[ii]; ii++) ;
+          if(ii < pos) nbad++;
+        }
+        size_t payload = pos+sizeof(rice_frame_s);
+        if(frame->type == RICE_RAW && isRecord(&map[payload])) record(payload);
+        else addSeg(SEG_RICE, pos, hdr.nsamp);
+        pos = payload + frame->nbytes;
+        lastGood = pos;
+      }
+      ncut = (uint32_t)((size - lastGood)/(hdr.nch*hdr.nsamp*4));
+      return;
+    }
+
+    size_t nb = blockBytes(&hdr);
+    size_t nblk = (size - pos)/nb;     // incomplete last block is cut
+    size_t end = pos + nblk*nb;
+    while(end > pos)
+    { // trailing unwritten (all zero) blocks
+      const uint8_t *w = &map[end-nb];
+      size_t ii; for(ii=0; ii<nb && !w[ii]; ii++) ;
+      if(ii < nb) break;
+      end -= nb; ncut++;
+    }
+    if(size > pos + nblk*nb) ncut++;
+
+    for(; pos < end; pos += nb)
+    { if(isRecord(&map[pos])) record(pos);
+      else addSeg(SEG_DATA, pos, hdr.nsamp);
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,132 @@
+// Copyright 2017 by Walter Zimmer
+//
+// esmi2sdiv.cpp
+// host check of the I2S divider solver (src/i2sdiv.h)
+//
+// usage: esmi2sdiv [-s step] [-n nbits]   sweep 8..192 kHz (step Hz, default 100) and
+//                                         the standard rates for all F_CPU
+//        esmi2sdiv -f fs [-n nbits]       dividers of fs for all F_CPU (exact ones first)
+//
+// each solution is checked against the register rules (ranges, FRACT <= DIVIDE), its
+// rate is recomputed from the registers and compared with the former float search
+// of i2s_speedConfig (31 multipliers); prints per F_CPU the exact rates and the
+// largest error, and the standard rates that are exact; exit code 1 if a check fails
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
+
+#include "i2sdiv.h"
+
+static const uint32_t cpus[] = {24000000, 48000000, 72000000, 96000000, 120000000, 144000000,
+                                168000000, 180000000, 192000000, 216000000, 240000000};
+#define NCPU (sizeof(cpus)/sizeof(cpus[0]))
+
+static double oldSearch(uint32_t fcpu, int nbits, uint32_t fs)
+{ // former search (source taken as F_CPU), error in ppm, NAN if it found no dividers
+  int i1 = 1, i2 = 1, i3 = 2;
+  float A = fcpu/2.0f/i3/(2.0f*nbits*fs);
+  float mn = 1.0;
+  for(int ii=1; ii<32; ii++)
+  { float xx = A*ii-(int32_t)(A*ii);
+    if(xx<mn && A*ii<256.0) { mn = xx; i1 = ii; i2 = A*ii;}
+  }
+  if(i2 < i1 || i2 < 1) return NAN;
+  return ((double) i2sClockSource(fcpu)*i1/i2/2.0/i3/(2.0*nbits)/fs - 1.0)*1e6;
+}
+
+static int check(uint32_t fcpu, int nbits, uint32_t fs, const i2s_div_s &d)
+{ // returns 0 if solution is not valid
+  if(d.ppm == I2SDIV_NONE) return 0;
+  if(d.fract > 255 || d.divide > 4095 || d.div > 255 || d.fract > d.divide) return 0;
+  uint64_t num = (uint64_t) i2sClockSource(fcpu)*(d.fract+1);
+  uint64_t den = (uint64_t)(d.divide+1)*2*(d.div+1)*2*nbits;
+  if((num == den*fs) != (d.exact != 0)) return 0;
+  double rate = (double) num/den;
+  return fabs(rate - d.fs) < 1e-9*fs && fabs((rate/fs - 1.0)*1e6 - d.ppm) < 1e-6;
+}
+
+int main(int argc, char *argv[])
+{
+  uint32_t step = 100, fsOne = 0;
+  int nbits = 32;
+  int opt;
+  while((opt = getopt(argc, argv, "s:n:f:")) != -1)
+  { switch(opt)
+    { case 's': step = atoi(optarg); break;
+      case 'n': nbits = atoi(optarg); break;
+      case 'f': fsOne = atoi(optarg); break;
+      default: step = 0; break;
+    }
+  }
+  if(!step || nbits < 8 || nbits > 32)
+  { fprintf(stderr,"usage: esmi2sdiv [-s step] [-n nbits] | -f fs [-n nbits]\n");
+    return 1;
+  }
+
+  if(fsOne)
+  { std::vector<std::pair<double, uint32_t>> list;
+    for(uint32_t ic=0; ic<NCPU; ic++)
+    { i2s_div_s d = i2sDivSolve(i2sClockSource(cpus[ic]), nbits, fsOne);
+      list.push_back(std::make_pair(fabs(d.ppm), ic));
+    }
+    std::stable_sort(list.begin(), list.end());
+    for(auto &l: list)
+    { uint32_t fcpu = cpus[l.second];
+      i2s_div_s d = i2sDivSolve(i2sClockSource(fcpu), nbits, fsOne);
+      if(d.ppm == I2SDIV_NONE) { printf("F_CPU %3u MHz: no dividers\n", fcpu/1000000); continue; }
+      printf("F_CPU %3u MHz: FRACT %3d DIVIDE %4d DIV %3d  %.6f Hz  %s%.3f ppm\n", fcpu/1000000,
+          d.fract, d.divide, d.div, d.fs, d.exact? "exact " : "", d.ppm);
+    }
+    return 0;
+  }
+
+  std::vector<uint32_t> rates;
+  for(uint32_t fs=8000; fs<=192000; fs+=step) rates.push_back(fs);
+  for(uint32_t ii=0; ii<I2S_NRATES; ii++) rates.push_back(i2sRates[ii]);
+  std::sort(rates.begin(), rates.end());
+  rates.erase(std::unique(rates.begin(), rates.end()), rates.end());
+
+  int nfail = 0;
+  printf("# %zu rates 8..192 kHz (step %u Hz), %d bits per word\n", rates.size(), step, nbits);
+  printf("#F_CPU  exact  max ppm (at Hz)     former: max ppm  failed  worse\n");
+  for(uint32_t ic=0; ic<NCPU; ic++)
+  { uint32_t fcpu = cpus[ic];
+    uint32_t nexact = 0, nold = 0, nworse = 0, fsMax = 0;
+    double maxPpm = 0, maxOld = 0;
+    for(auto fs: rates)
+    { i2s_div_s d = i2sDivSolve(i2sClockSource(fcpu), nbits, fs);
+      if(!check(fcpu, nbits, fs, d))
+      { printf("F_CPU %u fs %u: invalid solution\n", fcpu, fs); nfail++; continue; }
+      if(d.exact) nexact++;
+      if(fabs(d.ppm) > maxPpm) { maxPpm = fabs(d.ppm); fsMax = fs; }
+      double old = oldSearch(fcpu, nbits, fs);
+      if(std::isnan(old)) nold++;
+      else
+      { maxOld = std::max(maxOld, fabs(old));
+        if(fabs(old) < fabs(d.ppm) - 1e-6) nworse++; // former search better: solver is not exhaustive
+      }
+    }
+    nfail += nworse;
+    printf("%4u  %5u/%zu  %8.3f (%6u)   %12.1f  %6u  %5u\n", fcpu/1000000, nexact, rates.size(),
+        maxPpm, fsMax, maxOld, nold, nworse);
+  }
+
+  printf("\n# standard rates (x: exact, else ppm)\n#F_CPU");
+  for(uint32_t ii=0; ii<I2S_NRATES; ii++) printf(" %6u", i2sRates[ii]);
+  printf("\n");
+  for(uint32_t ic=0; ic<NCPU; ic++)
+  { printf("%4u  ", cpus[ic]/1000000);
+    for(uint32_t ii=0; ii<I2S_NRATES; ii++)
+    { i2s_div_s d = i2sDivSolve(i2sClockSource(cpus[ic]), nbits, i2sRates[ii]);
+      if(d.exact) printf(" %6s", "x"); else printf(" %6.2f", d.ppm);
+    }
+    printf("\n");
+  }
+  printf("# check: %s\n", nfail? "failed" : "ok");
+  return nfail? 1 : 0;
+}
@@ -0,0 +1,158 @@
+// Copyright 2017 by Walter Zimmer
+//
+// esmindex.cpp
+// time index (catalog) of a deployment, and extraction of any time range
+//
+// usage: esmindex -b dir [-v]                build dir/ESMINDEX.idx (scans all .bin files once)
+//        esmindex -i index                   list runs and files
+//        esmindex -i index -s start -e end [-o out.wav|out.raw] [-w bits]
+//
+//   start and end are "YYYY-MM-DD HH:MM:SS" (UTC, 'T' allowed) or s since 1970
+//   the range is extracted across file boundaries (zeros where nothing was
+//   recorded) as WAV (16, 24 or 32 bits) or raw interleaved int32
+//   without -o the files of the range are listed
+//
+// see esmindex.h for how files are grouped into runs and timed
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include <string>
+
+#include "esmindex.h"
+#include "wav.h"
+
+#define INDEX_NAME "ESMINDEX.idx"
+
+static double parseTime(const char *str)
+{ int Y, M, D, h = 0, m = 0, s = 0;
+  char sep;
+  if(sscanf(str, "%d-%d-%d%c%d:%d:%d", &Y, &M, &D, &sep, &h, &m, &s) >= 3)
+  { struct tm tx;
+    memset(&tx, 0, sizeof(tx));
+    tx.tm_year = Y-1900; tx.tm_mon = M-1; tx.tm_mday = D;
+    tx.tm_hour = h; tx.tm_min = m; tx.tm_sec = s;
+    return (double) timegm(&tx);
+  }
+  return atof(str);
+}
+
+static const char *timeString(double t)
+{ static char str[64];
+  time_t tt = (time_t) t;
+  struct tm tx;
+  gmtime_r(&tt, &tx);
+  snprintf(str, sizeof(str), "%04d-%02d-%02d %02d:%02d:%06.3f", tx.tm_year+1900, tx.tm_mon+1,
+      tx.tm_mday, tx.tm_hour, tx.tm_min, tx.tm_sec + (t - tt));
+  return str;
+}
+
+static void list(const c_esmIndex &index)
+{ const std::vector<esm_entry_s> &f = index.files;
+  for(size_t ii=0; ii<f.size(); )
+  { size_t jj = ii;
+    uint32_t ngap = 0, nidle = 0, ncut = 0;
+    while(jj < f.size() && f[jj].run == f[ii].run)
+    { ngap += f[jj].ngap; nidle += f[jj].nidle; ncut += f[jj].ncut; jj++; }
+    printf("run %u: %s", f[ii].run, timeString(f[ii].tstart));
+    printf(" - %s, %zu files, %u ch, %u Hz", timeString(index.tend(f[jj-1])),
+        jj-ii, f[ii].nch, f[ii].fsamp);
+    if(f[ii].rate != f[ii].fsamp) printf(" (measured %.3f)", f[ii].rate);
+    if(ngap) printf(", %u dropped blocks", ngap);
+    if(nidle) printf(", %u idle blocks", nidle);
+    if(ncut) printf(", %u blocks cut", ncut);
+    printf("\n");
+    ii = jj;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  const char *buildDir = 0, *indexName = 0, *outName = 0;
+  double t0 = 0, t1 = 0;
+  int haveRange = 0, bits = 24, verbose = 0;
+  int opt;
+  while((opt = getopt(argc, argv, "b:i:s:e:o:w:v")) != -1)
+  { switch(opt)
+    { case 'b': buildDir = optarg; break;
+      case 'w': bits = atoi(optarg); break;
+      case 'i': indexName = optarg; break;
+      case 's': t0 = parseTime(optarg); haveRange |= 1; break;
+      case 'e': t1 = parseTime(optarg); haveRange |= 2; break;
+      case 'o': outName = optarg; break;
+      case 'v': verbose = 1; break;
+      default: argc = 0; break;
+    }
+  }
+  if(argc == 0 || (!buildDir && !indexName) || (haveRange && haveRange != 3) ||
+     (bits != 16 && bits != 24 && bits != 32))
+  { fprintf(stderr,"usage: esmindex -b dir [-v]\n"
+                   "       esmindex -i index [-s start -e end [-o out.wav|out.raw] [-w bits]]\n");
+    return 1;
+  }
+
+  c_esmIndex index;
+  if(buildDir)
+  { int n = index.build(buildDir, verbose);
+    std::string name = std::string(buildDir) + "/" + INDEX_NAME;
+    if(!index.save(name.c_str())) { perror(name.c_str()); return 1; }
+    printf("# %s: %d files, %u runs\n", name.c_str(), n, index.nrun);
+    list(index);
+    return 0;
+  }
+
+  if(!index.load(indexName)) { fprintf(stderr,"%s: no index\n", indexName); return 1; }
+  if(!haveRange) { list(index); return 0; }
+  if(t1 <= t0) { fprintf(stderr,"empty range\n"); return 1; }
+
+  if(!outName)
+  { // files of the range
+    for(int ii = index.first(t0); ii<(int) index.files.size() && index.files[ii].tstart < t1; ii++)
+    { const esm_entry_s &e = index.files[ii];
+      printf("%s: %s, %.1f s\n", e.name, timeString(e.tstart), e.nsamp/e.rate);
+    }
+    return 0;
+  }
+
+  uint32_t nch = index.channels(t0, t1);
+  if(!nch) { fprintf(stderr,"number of channels changes in range\n"); return 1; }
+  int ii = index.first(t0);
+  uint32_t fs = index.files.empty()? 1 : index.files[std::min<size_t>(ii, index.files.size()-1)].fsamp;
+
+  FILE *fout = fopen(outName, "wb");
+  if(!fout) { perror(outName); return 1; }
+  size_t len = strlen(outName);
+  int wav = !(len > 4 && !strcmp(outName+len-4, ".raw"));
+  uint8_t hdr[WAV_HEADER_MAX];
+  uint32_t hsize = 0;
+  if(wav)
+  { // size is patched when done
+    hsize = wav_header(hdr, nch, fs, bits, 0);
+    fwrite(hdr, 1, hsize, fout);
+  }
+  std::vector<uint8_t> out;
+  int ok = 1;
+  uint64_t nsamp = index.forEach(t0, t1, [&](const int32_t *x, uint32_t n, uint32_t nc)
+  { if(wav)
+    { out.resize((size_t) n*nc*bits/8);
+      std::vector<int32_t> tmp(x, x + n*nc);
+      if(bits == 16) for(auto &v: tmp) v >>= 8;
+      if(bits == 32) for(auto &v: tmp) v = (int32_t)((uint32_t) v << 8);
+      wav_pack(out.data(), tmp.data(), tmp.size(), bits);
+      ok = ok && fwrite(out.data(), 1, out.size(), fout) == out.size();
+    }
+    else ok = ok && fwrite(x, sizeof(int32_t), (size_t) n*nc, fout) == (size_t) n*nc;
+  });
+  if(wav)
+  { if(!wav_fits(nch, bits, nsamp)) fprintf(stderr,"%s: too large for WAV\n", outName);
+    wav_header(hdr, nch, fs, bits, nsamp);
+    ok = ok && !fseek(fout, 0, SEEK_SET) && fwrite(hdr, 1, hsize, fout) == hsize;
+  }
+  if(fclose(fout) || !ok) { perror(outName); return 1; }
+  printf("%s: %s, %.1f s, %u ch\n", outName, timeString(t0), (double) nsamp/fs, nch);
+  return nsamp? 0 : 1;
+}
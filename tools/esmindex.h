@@ -0,0 +1,284 @@
+// Copyright 2017 by Walter Zimmer
+//
+// esmindex.h
+// time index (catalog) of all .bin files of a deployment, for the host tools
+//
+//   c_esmIndex index;
+//   index.build("/media/card");                  // scans every file once
+//   index.save("/media/card/ESMINDEX.idx");
+//   ...
+//   index.load("/media/card/ESMINDEX.idx");
+//   index.forEach(t0, t1, [&](const int32_t *x, uint32_t n, uint32_t nch) { ... });
+//
+// files are sorted by start time and grouped into runs: a file continues the
+// previous one if it has the same configuration and its header rtc is where the
+// previous file ends (within RUN_TOL s); within a run the samples are contiguous
+// (idle gaps of trigger mode and overrun gaps are zero filled, see esmfile.h)
+// the sampling rate of a run is measured: a line is fitted through the header rtc
+// (1 s resolution) against the sample index of the first sample of each file, so
+// the time of a sample is accurate to about a second even after weeks; the
+// nominal rate is kept while the fit is less certain than RATE_TOL (short runs,
+// roughly less than two hours)
+// files of loggers that measure the rate against the RTC (HDR_RATE) have the time of
+// their first sample in the header (to some us); if at least two files of a run
+// have it, the line is fitted through these times instead
+// time t (s since 1970) is found with a binary search over the start times (O(log n))
+//
+// index file: esm_index_s followed by nfile esm_entry_s
+//
+#ifndef ESMINDEX_H
+#define ESMINDEX_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <dirent.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include "esmfile.h"
+
+#define INDEX_MAGIC 0x5843534Du // "MSCX"
+#define RUN_TOL     3.0         // s, rtc tolerance of continuing files
+#define RATE_TOL    20e-6       // largest standard error of a measured rate (relative)
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t nmagic;    // ~magic
+  uint32_t nfile;
+  uint32_t nrun;
+  uint32_t fill[4];
+} esm_index_s;
+
+typedef struct
+{
+  char name[48];      // relative to the directory of the index
+  uint32_t rtc;       // header rtc
+  uint32_t run;       // index of run
+  uint32_t nch;
+  uint32_t fsamp;     // nominal
+  uint32_t fmt;
+  uint32_t ngap;      // blocks dropped on overrun (zero filled)
+  uint32_t nidle;     // blocks not written in trigger mode (zero filled)
+  uint32_t ncut;      // unwritten blocks at end (power loss)
+  uint64_t nsamp;     // samples per channel (time line)
+  uint64_t runSample; // index of first sample in run
+  double tstart;      // time of first sample (s since 1970)
+  double rate;        // measured sampling rate of run
+  double tmeas;       // time of first sample measured by logger (header_s.tfirst, 0 if not)
+} esm_entry_s;
+
+class c_esmIndex
+{
+public:
+  std::vector<esm_entry_s> files;
+  std::string dir;    // of the files
+  uint32_t nrun = 0;
+
+  // scan all .bin files of a directory; returns number of files
+  int build(const char *path, int verbose = 0)
+  { dir = path; files.clear();
+    DIR *dp = opendir(path);
+    if(!dp) return 0;
+    std::vector<std::string> names;
+    struct dirent *de;
+    while((de = readdir(dp)))
+    { size_t n = strlen(de->d_name);
+      if(n > 4 && n < sizeof(((esm_entry_s *)0)->name) && !strcmp(de->d_name+n-4, ".bin")) names.push_back(de->d_name);
+    }
+    closedir(dp);
+
+    for(auto &name: names)
+    { c_esmFile file;
+      if(!file.open((dir + "/" + name).c_str(), 2))
+      { fprintf(stderr,"%s: %s\n",name.c_str(),file.error); continue;}
+      if(!file.samples()) continue;
+      esm_entry_s e;
+      memset(&e, 0, sizeof(e));
+      strcpy(e.name, name.c_str());
+      e.rtc = file.hdr.rtc; e.nch = file.hdr.nch; e.fsamp = file.hdr.fsamp; e.fmt = file.hdr.fmt;
+      e.ngap = file.ngap; e.nidle = file.nidle; e.ncut = file.ncut;
+      e.nsamp = file.samples();
+      if((file.hdr.flags & HDR_RATE) && file.hdr.npoint) e.tmeas = file.hdr.tfirst;
+      files.push_back(e);
+      if(verbose) fprintf(stderr,"%s: %.1f s\n", name.c_str(), (double) e.nsamp/e.fsamp);
+    }
+    std::sort(files.begin(), files.end(), [](const esm_entry_s &a, const esm_entry_s &b)
+      { return (a.rtc != b.rtc)? a.rtc < b.rtc : strcmp(a.name, b.name) < 0; });
+    runs();
+    return files.size();
+  }
+
+  int save(const char *name)
+  { FILE *fout = fopen(name, "wb");
+    if(!fout) return 0;
+    esm_index_s h = { INDEX_MAGIC, ~INDEX_MAGIC, (uint32_t) files.size(), nrun, {0,0,0,0} };
+    int ok = fwrite(&h, sizeof(h), 1, fout) == 1 &&
+             fwrite(files.data(), sizeof(esm_entry_s), files.size(), fout) == files.size();
+    return (fclose(fout) == 0) && ok;
+  }
+
+  int load(const char *name)
+  { FILE *fid = fopen(name, "rb");
+    if(!fid) return 0;
+    esm_index_s h;
+    int ok = fread(&h, sizeof(h), 1, fid) == 1 && h.magic == INDEX_MAGIC && h.nmagic == (uint32_t) ~INDEX_MAGIC;
+    if(ok)
+    { files.resize(h.nfile); nrun = h.nrun;
+      ok = fread(files.data(), sizeof(esm_entry_s), h.nfile, fid) == h.nfile;
+    }
+    fclose(fid);
+    std::string path(name);
+    size_t slash = path.rfind('/');
+    dir = (slash == std::string::npos)? "." : path.substr(0, slash);
+    return ok;
+  }
+
+  // file with tstart <= t (may end before t), -1 if t is before the first file
+  int find(double t) const
+  { auto it = std::upper_bound(files.begin(), files.end(), t,
+        [](double tt, const esm_entry_s &e) { return tt < e.tstart; });
+    return (int)(it - files.begin()) - 1;
+  }
+
+  double tend(const esm_entry_s &e) const { return e.tstart + e.nsamp/e.rate; }
+
+  // first file with data in [t0,t1) or after it
+  int first(double t0) const
+  { int ii = find(t0);
+    if(ii < 0) ii = 0;
+    if(ii < (int) files.size() && tend(files[ii]) <= t0) ii++;
+    return ii;
+  }
+
+  // channels of the files in [t0,t1), 0 if they differ
+  uint32_t channels(double t0, double t1) const
+  { int ii = first(t0);
+    uint32_t nch = 0;
+    for(int jj=ii; jj<(int) files.size() && files[jj].tstart < t1; jj++)
+    { if(nch && files[jj].nch != nch) return 0;
+      nch = files[jj].nch;
+    }
+    if(!nch && !files.empty()) nch = files[std::min<size_t>(ii, files.size()-1)].nch;
+    return nch;
+  }
+
+  /*
+   * calls fn(const int32_t *x, uint32_t n, uint32_t nch) with the interleaved samples
+   * of [t0,t1) in order, across file boundaries; time not covered by files is zeros
+   * samples are 24 bit (FMT_INT16 files are scaled)
+   * returns samples per channel, or 0 if the files have different number of channels
+   */
+  template <typename F>
+  uint64_t forEach(double t0, double t1, F fn) const
+  { int ii = first(t0);
+    uint32_t nch = channels(t0, t1);
+    if(!nch) return 0;
+
+    uint64_t nout = 0;
+    double rate = files.empty()? 1 : files[std::min<size_t>(ii, files.size()-1)].rate;
+    std::vector<int32_t> buf;
+    double t = t0;
+    while(t < t1)
+    { if(ii >= (int) files.size() || t < files[ii].tstart)
+      { // no data: zeros up to next file
+        double te = (ii < (int) files.size())? std::min(files[ii].tstart, t1) : t1;
+        uint64_t nz = (uint64_t) llround((te - t)*rate);
+        buf.assign(std::min<uint64_t>(nz, 65536)*nch, 0);
+        for(uint64_t kk=0; kk<nz; kk+=65536)
+        { uint32_t n = (uint32_t) std::min<uint64_t>(65536, nz-kk);
+          fn(buf.data(), n, nch);
+        }
+        nout += nz;
+        t = te;
+        continue;
+      }
+      const esm_entry_s &e = files[ii];
+      rate = e.rate;
+      uint64_t s0 = (uint64_t) llround((t - e.tstart)*e.rate);
+      uint64_t s1 = std::min<uint64_t>(e.nsamp, (uint64_t) llround((t1 - e.tstart)*e.rate));
+      c_esmFile file;
+      if(s1 > s0 && file.open((dir + "/" + e.name).c_str(), 2) && file.samples() == e.nsamp)
+      { file.forEach(s0, s1, [&](const c_esmBlock &blk)
+        { buf.resize(blk.n*nch);
+          int shift = (e.fmt == FMT_INT16)? 8 : 0;
+          for(uint32_t ich=0; ich<nch; ich++)
+          { c_esmChan x = blk.chan(ich);
+            for(uint32_t kk=0; kk<blk.n; kk++) buf[kk*nch+ich] = (int32_t)((uint32_t) x[kk] << shift);
+          }
+          fn(buf.data(), blk.n, nch);
+        });
+        nout += s1 - s0;
+      }
+      else if(s1 > s0)
+      { // file vanished or changed: zeros
+        fprintf(stderr,"%s: cannot read, replaced by zeros\n", e.name);
+        buf.assign((s1-s0)*nch, 0);
+        fn(buf.data(), (uint32_t)(s1-s0), nch);
+        nout += s1 - s0;
+      }
+      t = e.tstart + s1/e.rate;
+      ii++;
+    }
+    return nout;
+  }
+
+private:
+  void runs(void)
+  { // group continuing files and measure rate of each run
+    nrun = 0;
+    size_t bgn = 0;
+    for(size_t ii=0; ii<=files.size(); ii++)
+    { if(ii < files.size() && ii > bgn)
+      { const esm_entry_s &p = files[ii-1], &e = files[ii];
+        double expect = p.rtc + (double) p.nsamp/p.fsamp;
+        if(e.nch == p.nch && e.fsamp == p.fsamp && fabs(e.rtc - expect) <= RUN_TOL) continue;
+      }
+      if(ii > bgn) fit(bgn, ii);
+      bgn = ii;
+    }
+  }
+
+  void fit(size_t i0, size_t i1)
+  { // files i0..i1-1 are one run
+    uint64_t s = 0;
+    for(size_t ii=i0; ii<i1; ii++) { files[ii].runSample = s; s += files[ii].nsamp; files[ii].run = nrun; }
+    double fs = files[i0].fsamp;
+    double rate = fs;
+    size_t nmeas = 0;
+    for(size_t ii=i0; ii<i1; ii++) if(files[ii].tmeas > 0) nmeas++;
+    int meas = nmeas >= 2; // use measured times only
+    auto use = [&](size_t ii) { return !meas || files[ii].tmeas > 0; };
+    auto tobs = [&](size_t ii) { return meas? files[ii].tmeas : files[ii].rtc + 0.5; }; // rtc is truncated to seconds
+    size_t n = meas? nmeas : i1 - i0;
+    if(n >= (meas? 2u : 3u))
+    { // least squares of time against sample index
+      double mx = 0, my = 0, sxx = 0, sxy = 0, syy = 0;
+      for(size_t ii=i0; ii<i1; ii++) if(use(ii)) { mx += files[ii].runSample; my += tobs(ii); }
+      mx /= n; my /= n;
+      for(size_t ii=i0; ii<i1; ii++) if(use(ii))
+      { double dx = files[ii].runSample - mx, dy = tobs(ii) - my;
+        sxx += dx*dx; sxy += dx*dy; syy += dy*dy;
+      }
+      if(sxy > 0)
+      { double b = sxy/sxx; // s per sample
+        // standard error of slope, residuals at least the rtc truncation (1/12 s^2)
+        double var = meas? ((n > 2)? std::max((syy - b*sxy)/(n-2), 0.0) : 0.0)
+                         : std::max((syy - b*sxy)/(n-2), 1.0/12);
+        double err = sqrt(var/sxx)/b;
+        // else rtc was set during the run or the fit is too uncertain
+        if(fabs(1/(b*fs) - 1) < 0.01 && err < RATE_TOL) rate = 1/b;
+      }
+    }
+    double my = 0, mx = 0;
+    for(size_t ii=i0; ii<i1; ii++) if(use(ii)) { my += tobs(ii); mx += files[ii].runSample/rate; }
+    double a = (my - mx)/n;
+    for(size_t ii=i0; ii<i1; ii++) { files[ii].rate = rate; files[ii].tstart = a + files[ii].runSample/rate; }
+    nrun++;
+  }
+};
+
+#endif
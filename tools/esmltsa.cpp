@@ -0,0 +1,102 @@
+// Copyright 2017 by Walter Zimmer
+//
+// esmltsa.cpp
+// reads long-term spectral average files (.lts) written with DO_LTSA
+//
+// usage: esmltsa [-t] [-p out.pgm] file.lts ...
+//   prints a summary (time span, lost frames, median level per octave band)
+//   -t         lists records: time, lost frames, levels in dB
+//   -p out.pgm writes an image (time along x, frequency up, black is low level)
+//   files are read in sequence (e.g. several days)
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+
+#include "binfile.h"
+
+int main(int argc, char *argv[])
+{
+  int list = 0;
+  const char *pgmName = 0;
+  int ii = 1;
+  for(; ii<argc && argv[ii][0]=='-'; ii++)
+  { if(!strcmp(argv[ii],"-t")) list = 1;
+    else if(!strcmp(argv[ii],"-p") && ii+1<argc) pgmName = argv[++ii];
+    else break;
+  }
+  if(ii >= argc) { fprintf(stderr,"usage: esmltsa [-t] [-p out.pgm] file.lts ...\n"); return 1;}
+
+  ltsa_header_s head;
+  memset(&head, 0, sizeof(head));
+  std::vector<uint8_t> levels;  // all records, nbin each
+  uint32_t nrec = 0, nlost = 0, tfirst = 0, tlast = 0;
+
+  for(; ii<argc; ii++)
+  { FILE *fid = fopen(argv[ii],"rb");
+    if(!fid) { perror(argv[ii]); continue;}
+    ltsa_header_s hd;
+    if(fread(&hd,sizeof(hd),1,fid)!=1 || hd.magic != LTSA_MAGIC || hd.nmagic != (uint32_t) ~LTSA_MAGIC)
+    { fprintf(stderr,"%s: not an LTSA file\n",argv[ii]); fclose(fid); continue;}
+    if(head.nbin && (hd.nbin != head.nbin || hd.fsamp != head.fsamp))
+    { fprintf(stderr,"%s: different configuration, skipped\n",argv[ii]); fclose(fid); continue;}
+    head = hd;
+
+    ltsa_rec_s rec;
+    std::vector<uint8_t> lv(head.nbin);
+    while(fread(&rec,sizeof(rec),1,fid)==1 && fread(lv.data(),1,head.nbin,fid)==head.nbin)
+    { if(!nrec) tfirst = rec.rtc;
+      tlast = rec.rtc;
+      nlost += rec.nlost;
+      nrec++;
+      levels.insert(levels.end(), lv.begin(), lv.end());
+      if(list)
+      { printf("%10u %3u", rec.rtc, rec.nlost);
+        for(uint32_t kk=0; kk<head.nbin; kk++) printf(" %.1f", head.dbMin + lv[kk]*head.dbStep);
+        printf("\n");
+      }
+    }
+    fclose(fid);
+  }
+  if(!nrec) { fprintf(stderr,"esmltsa: no records\n"); return 1;}
+
+  float df = (float) head.fsamp/head.nfft;
+  time_t t0 = tfirst, t1 = tlast;
+  char s0[32], s1[32];
+  strftime(s0, sizeof(s0), "%Y-%m-%d %H:%M:%S", gmtime(&t0));
+  strftime(s1, sizeof(s1), "%Y-%m-%d %H:%M:%S", gmtime(&t1));
+  printf("# %u records from %s to %s, %u bins of %.1f Hz, %u frames per record, %u frames lost\n",
+      nrec, s0, s1, head.nbin, df, head.nframe, nlost);
+
+  // median level of octave bands (from 2nd bin)
+  printf("# band(Hz)       median(dB)\n");
+  for(uint32_t k0=1; k0<head.nbin; k0*=2)
+  { uint32_t k1 = std::min(2*k0, head.nbin);
+    std::vector<uint8_t> v;
+    for(uint32_t rr=0; rr<nrec; rr++)
+    { // mean level of band in this record
+      uint32_t sum = 0;
+      for(uint32_t kk=k0; kk<k1; kk++) sum += levels[rr*head.nbin+kk];
+      v.push_back((uint8_t)(sum/(k1-k0)));
+    }
+    std::nth_element(v.begin(), v.begin()+v.size()/2, v.end());
+    printf("%7.0f-%-7.0f %7.1f\n", k0*df, k1*df, head.dbMin + v[v.size()/2]*head.dbStep);
+  }
+
+  if(pgmName)
+  { FILE *fout = fopen(pgmName,"wb");
+    if(!fout) { perror(pgmName); return 1;}
+    fprintf(fout,"P5\n%u %u\n255\n", nrec, head.nbin);
+    std::vector<uint8_t> row(nrec);
+    for(int kk=head.nbin-1; kk>=0; kk--)
+    { for(uint32_t rr=0; rr<nrec; rr++) row[rr] = levels[rr*head.nbin+kk];
+      fwrite(row.data(),1,nrec,fout);
+    }
+    fclose(fout);
+  }
+  return 0;
+}
@@ -0,0 +1,189 @@
+// Copyright 2017 by Walter Zimmer
+//
+// esmresample.cpp
+// host check and benchmark of the USB audio resampler (src/resample.h)
+//
+// usage: esmresample [-t sec] [-k ppm] [-f fs] [-a freq]
+//   -t sec   simulated time per rate once the controller tracks (default 20, the first
+//            5 s of it are not evaluated)
+//   -k ppm   I2S clock error against the USB (host) clock (default 100)
+//   -f fs    I2S rate (default: 32000, 44100, 48000, 96000)
+//   -a freq  test tone of left channel (default 997 Hz, right channel 3.1 times higher)
+//
+// as on the teensy, each I2S interrupt puts 128 frames into the ring (c_buff) and then
+// runs the update, which counts the samples USB has taken by its frame number (1 ms,
+// 441 per 10 frames) and resamples a block of 128 samples while one is due (the update
+// is pended again); the I2S clock is off by -k ppm, so the resampler has to follow
+// with its ratio correction; acquiring takes some minutes of simulated time (gears of
+// c_resample), evaluation starts when the controller reached its tracking gear
+// per rate it prints THD (harmonics 2..9) and THD+N of both channels relative to the
+// tone (least squares fit at the tone frequency as seen by the host clock, in windows
+// of 8192 samples as an analyser would, the worst window is shown), the range of the
+// ratio correction and of the ring fill, underruns (blocks not delivered) and the cost
+// in ns and x86 cycles per output sample (stereo)
+// exit code 1 if THD is above -110 dB, THD+N above -85 dB or a block was not delivered;
+// the limits hold from 30 ppm on; where I2S interrupts and USB frames are commensurate,
+// as at 32 kHz, the 1 ms position of the sink drifts as a sawtooth, which the loop
+// follows when it is slow: -k 10 -f 32000 shows THD+N of about -76 dB (see resample.h)
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <unistd.h>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#if defined(__x86_64__) || defined(__i386__)
+  #include <x86intrin.h>
+  static inline uint64_t cycles(void) { return __rdtsc();}
+#else
+  static inline uint64_t cycles(void) { return 0;}
+#endif
+
+#include "resample.h"
+
+#define N_SAMP   128     // frames per I2S interrupt
+#define N_OUT    128     // samples per USB audio block
+#define F_USB    44100
+#define T_SETTLE 5.0     // s
+#define T_LOCK   900.0   // s, longest acquisition
+#define THD_MAX  (-110.0) // dB
+#define THDN_MAX (-85.0) // dB
+#define N_WIN    8192
+#define N_RING   (4*(N_OUT*96000/F_USB+1)) // as audioBuffer of myAPP.cpp
+#define USB_FRAME_SAMPLES 441 // per 10 USB frames
+#define USB_DUE_MAX (4*10*N_OUT)
+
+static double fitTone(const std::vector<int16_t> &x, double f, double *thd)
+{ // returns THD+N in dB, thd: harmonics 2..9 in dB (least squares, one frequency at a time;
+  // the fundamental together with DC and t*cos, t*sin, so a slow drift of phase and level
+  // is followed as by the tracking notch of an analyser)
+  size_t n = x.size();
+  double p[10] = {0};
+  std::vector<double> res(x.begin(), x.end());
+  for(int h=1; h<10; h++)
+  { double w = 2.0*M_PI*f*h/F_USB;
+    if(h > 1 && f*h >= 0.45*F_USB) break;
+    int m = (h == 1)? 5 : 2;
+    double A[5][6] = {{0}};
+    for(size_t ii=0; ii<n; ii++)
+    { double t = (ii - 0.5*n)/n, c = cos(w*ii), s = sin(w*ii);
+      double g[5] = {c, s, t*c, t*s, 1.0};
+      for(int jj=0; jj<m; jj++)
+      { for(int kk=0; kk<m; kk++) A[jj][kk] += g[jj]*g[kk];
+        A[jj][5] += g[jj]*res[ii];
+      }
+    }
+    for(int jj=0; jj<m; jj++) // Gauss-Jordan, the normal matrix is positive definite
+    { for(int kk=0; kk<m; kk++)
+      { if(kk == jj) continue;
+        double q = A[kk][jj]/A[jj][jj];
+        for(int ll=0; ll<6; ll++) A[kk][ll] -= q*A[jj][ll];
+      }
+    }
+    double a[5] = {0};
+    for(int jj=0; jj<m; jj++) a[jj] = A[jj][5]/A[jj][jj];
+    for(size_t ii=0; ii<n; ii++)
+    { double t = (ii - 0.5*n)/n, c = cos(w*ii), s = sin(w*ii);
+      res[ii] -= a[0]*c + a[1]*s + t*(a[2]*c + a[3]*s) + a[4];
+    }
+    p[h] = 0.5*(a[0]*a[0] + a[1]*a[1]);
+  }
+  double ph = 0; for(int h=2; h<10; h++) ph += p[h];
+  double pn = 0; for(auto v: res) pn += v*v; pn /= n;
+  *thd = 10*log10(ph/p[1] + 1e-30);
+  return 10*log10((pn + ph)/p[1] + 1e-30);
+}
+
+int main(int argc, char *argv[])
+{
+  double tsim = 20, ppm = 100, ftone = 997;
+  uint32_t fsOne = 0;
+  int opt;
+  while((opt = getopt(argc, argv, "t:k:f:a:")) != -1)
+  { switch(opt)
+    { case 't': tsim = atof(optarg); break;
+      case 'k': ppm = atof(optarg); break;
+      case 'f': fsOne = atoi(optarg); break;
+      case 'a': ftone = atof(optarg); break;
+      default: fprintf(stderr,"usage: esmresample [-t sec] [-k ppm] [-f fs] [-a freq]\n"); return 1;
+    }
+  }
+  if(tsim <= T_SETTLE + 1) tsim = T_SETTLE + 1;
+  std::vector<uint32_t> rates = {32000, 44100, 48000, 96000};
+  if(fsOne) rates.assign(1, fsOne);
+
+  int nfail = 0;
+  printf("# I2S clock %+.1f ppm, tones %.0f Hz (left) %.0f Hz (right), -1 dBFS, %d taps %d phases\n",
+      -ppm, ftone, 3.1*ftone, RS_NTAP, RS_NPH);
+  printf("#    fs   THD L/R (dB)   THD+N L/R (dB)   corr min..max ppm   fill min..max (target)  underrun  ns/sample  cycles/sample\n");
+  for(auto fs: rates)
+  { std::vector<uint32_t> store(N_RING);
+    c_buff ring(store.data(), N_RING);
+    c_resample rs;
+    rs.init(fs, F_USB);
+
+    double fi2s = fs*(1.0 - ppm*1e-6); // true I2S rate on host clock
+    std::vector<int16_t> outl, outr;
+    std::vector<uint32_t> frames(N_SAMP);
+    int16_t left[N_OUT], right[N_OUT];
+    uint64_t nin = 0, frame = 0;
+    uint32_t due = 0, fmin = N_RING, fmax = 0, underrun0 = 0;
+    int32_t cmin = RS_MAXPPM, cmax = -RS_MAXPPM;
+    double nsSum = 0; uint64_t cycSum = 0, nproc = 0;
+    double amp = 32767*pow(10.0, -1/20.0);
+
+    double tlock = -1; // controller reached tracking gear
+    for(uint64_t k=1; k*N_SAMP/fi2s < ((tlock < 0)? T_LOCK : tlock) + tsim; k++)
+    { // I2S interrupt k
+      for(int ii=0; ii<N_SAMP; ii++, nin++)
+      { int16_t l = (int16_t) lrint(amp*sin(2*M_PI*ftone*nin/fs));
+        int16_t r = (int16_t) lrint(amp*sin(2*M_PI*3.1*ftone*nin/fs));
+        frames[ii] = (uint16_t) l | ((uint32_t)(uint16_t) r << 16);
+      }
+      ring.put(frames.data(), N_SAMP);
+      // update, as AudioInterface::update: samples taken by USB from start of frames until now
+      double t = k*N_SAMP/fi2s;
+      uint64_t fn = (uint64_t)(t*1000);
+      due += (fn - frame)*USB_FRAME_SAMPLES;
+      frame = fn;
+      if(due > USB_DUE_MAX) due = USB_DUE_MAX;
+      while(due >= 10*N_OUT) // update is pended again while a block is due
+      { due -= 10*N_OUT;
+        auto t0 = std::chrono::steady_clock::now();
+        uint64_t c0 = cycles();
+        int ok = rs.process(&ring, left, right, N_OUT, due/10);
+        cycSum += cycles() - c0;
+        nsSum += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+        if(!ok) continue; // USB plays nothing for this block
+        nproc++;
+        if(tlock < 0 && rs.gear == RS_GEARS) tlock = t;
+        if(tlock < 0 || t < tlock + T_SETTLE) { underrun0 = rs.underrun; continue; }
+        uint32_t fill = ring.available();
+        if(fill < fmin) fmin = fill;
+        if(fill > fmax) fmax = fill;
+        cmin = std::min(cmin, rs.ppm()); cmax = std::max(cmax, rs.ppm());
+        outl.insert(outl.end(), left, left+N_OUT);
+        outr.insert(outr.end(), right, right+N_OUT);
+      }
+    }
+    // tones on host clock
+    double thdl = -999, thdr = -999, thdnl = -999, thdnr = -999;
+    double fl = ftone*fi2s/fs, fr = 3.1*ftone*fi2s/fs;
+    for(size_t ii=0; ii+N_WIN <= outl.size(); ii+=N_WIN)
+    { double d, dn;
+      dn = fitTone(std::vector<int16_t>(&outl[ii], &outl[ii]+N_WIN), fl, &d);
+      thdl = std::max(thdl, d); thdnl = std::max(thdnl, dn);
+      dn = fitTone(std::vector<int16_t>(&outr[ii], &outr[ii]+N_WIN), fr, &d);
+      thdr = std::max(thdr, d); thdnr = std::max(thdnr, dn);
+    }
+    uint32_t under = rs.underrun - underrun0;
+    printf("%7u  %6.1f %6.1f   %7.1f %7.1f   %8d..%-8d   %6u..%-6u (%5u)  %8u  %9.1f  %13.1f\n", fs, thdl, thdr, thdnl, thdnr,
+        cmin, cmax, fmin, fmax, rs.target, under, nsSum/nproc/N_OUT, (double) cycSum/nproc/N_OUT);
+    if(tlock < 0) printf("%7u  controller did not reach tracking gear in %.0f s\n", fs, T_LOCK);
+    if(tlock < 0 || thdl > THD_MAX || thdr > THD_MAX || thdnl > THDN_MAX || thdnr > THDN_MAX || under) nfail++;
+  }
+  printf("# check: %s\n", nfail? "failed" : "ok");
+  return nfail? 1 : 0;
+}
@@ -0,0 +1,123 @@
+// Copyright 2017 by Walter Zimmer
+//
+// esmricebench.cpp
+// host check and benchmark of the rice coder (src/rice.h) as used with COMPRESS
+//
+// usage: esmricebench [-t sec] [-f fs] [-x seed]
+//   -t sec   audio time per channel count (default 60)
+//   -f fs    sampling rate (default 44100)
+//   -x seed  random seed of the test signal (default 1)
+//
+// for 1, 2 and 4 channels, blocks of 128 samples (32 bit words of 24 bit samples, as
+// the queue of COMPRESS) are encoded with rice_encode() and decoded with rice_decode()
+// the test signal is soundscape like: low-level noise, bursts of a loud tone and
+// single full-scale outliers; a few special blocks are mixed in (silence, full scale
+// alternating, random 32 bit words that do not compress, a gap record that is forced
+// into a raw frame)
+// each decoded block is compared with its source (bit exact), exit code 1 on mismatch
+// prints the compression ratio and MB/s (of 32 bit input) of encoder and decoder on
+// one host core, with the real-time rate needed and its share of the core; host
+// figures are only indicative for the teensy (loop() runs the encoder per write)
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "binfile.h"
+#include "rice.h"
+
+#define N_SAMP 128
+
+static void signal(int32_t *dst, int nch, uint64_t blk, double fs, std::mt19937 &rng)
+{ std::normal_distribution<double> noise(0.0, 200.0); // about -92 dB re full scale
+  std::uniform_int_distribution<uint32_t> any;
+  int special = (int)(blk % 97);
+  for(int ii=0; ii<N_SAMP; ii++)
+    for(int ich=0; ich<nch; ich++)
+    { int32_t *v = &dst[ii*nch + ich];
+      if(special == 11) { *v = 0; continue; }                                // silence
+      if(special == 23) { *v = (ii & 1)? 0x7fffff : -0x800000; continue; }   // full scale
+      if(special == 37) { *v = (int32_t) any(rng); continue; }               // incompressible
+      double x = noise(rng);
+      if((blk / 50) % 20 == 3) // burst of 50 blocks every 1000 blocks
+        x += 2e6*sin(2*M_PI*3000.0*(blk*N_SAMP + ii)/fs + ich);
+      if(any(rng) % 5000 == 0) x = (any(rng) & 1)? 0x7fffff : -0x800000; // outlier
+      if(x > 0x7fffff) x = 0x7fffff;
+      if(x < -0x800000) x = -0x800000;
+      *v = (int32_t) lrint(x);
+    }
+  if(special == 59)
+  { // record, as Logger::compress() sees it
+    memset(dst, 0, nch*N_SAMP*4);
+    gap_s *gap = (gap_s *) dst;
+    gap->magic = GAP_MAGIC; gap->nmagic = ~GAP_MAGIC;
+    gap->ndrop = 3; gap->block = (uint32_t) blk; gap->sample = blk*N_SAMP;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  double tsim = 60, fs = 44100;
+  unsigned seed = 1;
+  int opt;
+  while((opt = getopt(argc, argv, "t:f:x:")) != -1)
+  { switch(opt)
+    { case 't': tsim = atof(optarg); break;
+      case 'f': fs = atof(optarg); break;
+      case 'x': seed = atoi(optarg); break;
+      default: fprintf(stderr,"usage: esmricebench [-t sec] [-f fs] [-x seed]\n"); return 1;
+    }
+  }
+
+  int nbad = 0;
+  printf("# fs %.0f Hz, %.0f s of audio per run, blocks of %d samples\n", fs, tsim, N_SAMP);
+  printf("# nch  ratio  raw%%  enc MB/s  dec MB/s  need MB/s  enc core%%  dec core%%\n");
+  for(int nch: {1, 2, 4})
+  { std::mt19937 rng(seed);
+    uint64_t nblk = (uint64_t)(tsim*fs/N_SAMP);
+    uint32_t nd = nch*N_SAMP;
+    std::vector<int32_t> src(nblk*nd), dec(nd);
+    for(uint64_t kk=0; kk<nblk; kk++) signal(&src[kk*nd], nch, kk, fs, rng);
+
+    // worst case per block: frame header and raw block
+    std::vector<uint8_t> cod(nblk*(sizeof(rice_frame_s) + nd*4));
+    std::vector<uint32_t> pos(nblk+1);
+    auto t0 = std::chrono::steady_clock::now();
+    pos[0] = 0;
+    for(uint64_t kk=0; kk<nblk; kk++)
+    { const int32_t *ptr = &src[kk*nd];
+      pos[kk+1] = pos[kk] + rice_encode(&cod[pos[kk]], ptr, nch, N_SAMP, isRecord(ptr));
+    }
+    auto t1 = std::chrono::steady_clock::now();
+
+    uint64_t nraw = 0, nerr = 0;
+    double nsDec = 0;
+    for(uint64_t kk=0; kk<nblk; kk++)
+    { memset(dec.data(), 0x55, nd*4);
+      auto t2 = std::chrono::steady_clock::now();
+      uint32_t nb = rice_decode(dec.data(), &cod[pos[kk]], pos[nblk]-pos[kk], N_SAMP);
+      nsDec += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t2).count();
+      if(((const rice_frame_s *)&cod[pos[kk]])->type == RICE_RAW) nraw++;
+      if(nb != pos[kk+1]-pos[kk] || memcmp(dec.data(), &src[kk*nd], nd*4))
+      { if(nerr++ < 5) printf("%5d  block %llu differs after round trip\n", nch, (unsigned long long) kk);
+      }
+    }
+    if(nerr) nbad++;
+
+    double nsEnc = std::chrono::duration<double, std::nano>(t1 - t0).count();
+    double bytes = (double) nblk*nd*4;
+    double need = nch*fs*4/1e6;
+    double enc = bytes/nsEnc*1e3, dec_ = bytes/nsDec*1e3;
+    printf("%5d  %5.2f  %4.1f  %8.1f  %8.1f  %9.3f  %9.2f  %9.2f%s\n", nch,
+        bytes/pos[nblk], 100.0*nraw/nblk, enc, dec_, need, 100.0*need/enc, 100.0*need/dec_,
+        nerr? "  MISMATCH" : "");
+  }
+  printf("# check: %s\n", nbad? "failed" : "ok");
+  return nbad? 1 : 0;
+}
@@ -0,0 +1,167 @@
+// Copyright 2017 by Walter Zimmer
+//
+// esmringstress.cpp
+// host stress test of the Logger queue (src/logger.h), a single-producer/single-consumer
+// ring: a producer thread (as the I2S ISR) reserves, fills and commits blocks, a consumer
+// thread (as loop()) claims and consumes them in batches
+//
+// usage: esmringstress [-n nblocks] [-q nq] [-w naud] [-r rate] [-x seed]
+//   -n nblocks  blocks produced (default 2000000)
+//   -q nq       queue blocks, power of 2 (default 64)
+//   -w naud     largest batch claimed by the consumer (default 8)
+//   -r rate     blocks per second offered by the producer, 0: as fast as possible
+//               (default 100000; 4 channels at 44.1 kHz are 1378 blocks/s)
+//   -x seed     random seed of the consumer stalls (default 1)
+//
+// the consumer stalls at random (yield or sleep up to 200 us), so that the producer
+// overruns the queue; each data block carries its sequence number and a pattern
+// checked:
+//   - data blocks arrive in strictly increasing order, with intact content
+//   - each gap record announces exactly the blocks missing before the next data block
+//     (gap_s.block is the first missing sequence number, gap_s.ndrop their count)
+//   - consumed plus announced dropped blocks equal produced blocks, and the dropped
+//     blocks equal the overrun count of the producer
+//   - Logger::consumed() (sequence at tail, gap records count ndrop) equals produced
+// after the producer has finished and the consumer has emptied the queue, one more
+// block is produced, so that blocks dropped at the end are announced too
+// exit code 1 on any mismatch; the makefile builds it with -fsanitize=thread
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <random>
+
+#define N_SAMP 128
+#include "loggerhost.h" // src/logger.h
+
+#define ND 64 // words per block
+
+static uint32_t pattern(uint32_t seq, uint32_t ii) { return seq*2654435761u + ii*40503u + 1; }
+
+static Logger<uint32_t> logger;
+static std::atomic<int> producing;
+
+static struct
+{ uint64_t nblocks = 2000000;
+  uint32_t nq = 64, na = 8;
+  double rate = 100000;
+  unsigned seed = 1;
+} cfg;
+
+static uint64_t produced = 0; // producer
+static struct { uint64_t data = 0, gaps = 0, dropped = 0, errors = 0, batches = 0; } cons; // consumer
+
+static void produce(uint32_t seq)
+{ uint32_t *ptr = logger.reserve();
+  if(!ptr) return; // dropped, will be announced by a gap record
+  ptr[0] = seq;
+  for(uint32_t ii=1; ii<ND; ii++) ptr[ii] = pattern(seq, ii);
+  logger.commit();
+}
+
+static void producer(void)
+{ auto t0 = std::chrono::steady_clock::now();
+  for(uint64_t kk=0; kk<cfg.nblocks; kk++)
+  { if(cfg.rate > 0)
+      std::this_thread::sleep_until(t0 + std::chrono::nanoseconds((uint64_t)(kk*1e9/cfg.rate)));
+    produce((uint32_t) kk);
+    produced++;
+  }
+  producing = 0;
+}
+
+static uint32_t expected = 0; // next sequence number
+
+static void check(const uint32_t *ptr)
+{ if(isGap(ptr))
+  { const gap_s *gap = (const gap_s *) ptr;
+    if(gap->block != expected || gap->ndrop == 0)
+    { if(cons.errors++ < 10) printf("gap of %u blocks at %u, expected at %u\n", gap->ndrop, gap->block, expected); }
+    cons.gaps++;
+    cons.dropped += gap->ndrop;
+    expected = gap->block + gap->ndrop;
+    return;
+  }
+  uint32_t seq = ptr[0];
+  int bad = (seq != expected); // strictly increasing, no block missing without gap record
+  for(uint32_t ii=1; ii<ND && !bad; ii++) bad = (ptr[ii] != pattern(seq, ii));
+  if(bad && cons.errors++ < 10) printf("block %u: expected %u or content wrong\n", seq, expected);
+  cons.data++;
+  expected = seq + 1;
+}
+
+static void consumer(void)
+{ std::mt19937 rng(cfg.seed);
+  std::uniform_int_distribution<int> stall(0, 99);
+  while(1)
+  { int more = producing; // read before available(), so nothing is missed at the end
+    uint32_t n = logger.available();
+    if(!n)
+    { if(!more) break;
+      std::this_thread::yield();
+      continue;
+    }
+    if(n > cfg.na) n = cfg.na;
+    uint32_t *ptr = logger.claim(n);
+    if(ptr)
+      for(uint32_t ii=0; ii<n; ii++) check(ptr + ii*ND); // contiguous batch
+    else
+      for(uint32_t ii=0; ii<n; ii++) check(logger.block(ii)); // batch wraps around end of pool
+    logger.consume(n);
+    cons.batches++;
+    int s = stall(rng);
+    if(s < 10) std::this_thread::yield();
+    else if(s < 12) std::this_thread::sleep_for(std::chrono::microseconds(s*10 + stall(rng)));
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  int opt;
+  while((opt = getopt(argc, argv, "n:q:w:r:x:")) != -1)
+  { switch(opt)
+    { case 'n': cfg.nblocks = strtoull(optarg, 0, 0); break;
+      case 'q': cfg.nq = atoi(optarg); break;
+      case 'w': cfg.na = atoi(optarg); break;
+      case 'r': cfg.rate = atof(optarg); break;
+      case 'x': cfg.seed = atoi(optarg); break;
+      default: fprintf(stderr,"usage: esmringstress [-n nblocks] [-q nq] [-w naud] [-r rate] [-x seed]\n"); return 1;
+    }
+  }
+  static uint8_t arena[1<<22] __attribute__((aligned(8)));
+  if(!logger.configure(arena, sizeof(arena), cfg.nq, ND, cfg.na))
+  { fprintf(stderr,"esmringstress: geometry nq %u naud %u not supported\n", cfg.nq, cfg.na); return 1; }
+  header.nsamp = N_SAMP;
+  logger.start();
+
+  producing = 1;
+  auto t0 = std::chrono::steady_clock::now();
+  std::thread tc(consumer);
+  std::thread tp(producer);
+  tp.join();
+  tc.join();
+  double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+  // announce what was dropped at the end: queue is empty, so this block gets in
+  produce((uint32_t) cfg.nblocks);
+  produced++;
+  for(uint32_t ii=0, n=logger.available(); ii<n; ii++) check(logger.block(ii));
+  logger.consume(logger.available());
+
+  uint64_t nerr = cons.errors;
+  if(cons.data + cons.dropped != produced) nerr++;
+  if(cons.dropped != logger.overrun) nerr++;
+  if(logger.consumed() != (uint32_t) produced) nerr++;
+  printf("# nq %u, batches up to %u, %.0f blocks/s offered (%.0fx 4 channels at 44.1 kHz)\n",
+      cfg.nq, cfg.na, produced/sec, produced/sec/(4*44100.0/N_SAMP));
+  printf("# produced %llu = consumed %llu + dropped %llu (%llu gap records, overrun %u), %llu batches, consumed() %u\n",
+      (unsigned long long) produced, (unsigned long long) cons.data, (unsigned long long) cons.dropped,
+      (unsigned long long) cons.gaps, (unsigned) logger.overrun, (unsigned long long) cons.batches,
+      (unsigned) logger.consumed());
+  printf("# check: %s\n", nerr? "failed" : "ok");
+  return nerr? 1 : 0;
+}
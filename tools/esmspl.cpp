@@ -0,0 +1,101 @@
+// Copyright 2017 by Walter Zimmer
+//
+// esmspl.cpp
+// reads sound level files (.spl) written with DO_SPL
+//
+// usage: esmspl [-t] [-c ich] file.spl ...
+//   prints a summary per channel (time span, median, L10, L90 and maximum of Leq,
+//   highest peak, clipped samples, lost records)
+//   -t       lists records: time, lost records, then leq lmax lmin peak nclip per channel
+//   -c ich   summary of one channel only
+//   files are read in sequence (e.g. several days)
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+
+#include "binfile.h"
+
+static float db(int16_t lv) { return lv*0.01f; }
+
+static float percentile(std::vector<int16_t> v, float pct)
+{ if(v.empty()) return 0;
+  size_t k = (size_t)(pct/100.0f*(v.size()-1) + 0.5f);
+  std::nth_element(v.begin(), v.begin()+k, v.end());
+  return db(v[k]);
+}
+
+int main(int argc, char *argv[])
+{
+  int list = 0, only = -1;
+  int ii = 1;
+  for(; ii<argc && argv[ii][0]=='-'; ii++)
+  { if(!strcmp(argv[ii],"-t")) list = 1;
+    else if(!strcmp(argv[ii],"-c") && ii+1<argc) only = atoi(argv[++ii]);
+    else break;
+  }
+  if(ii >= argc) { fprintf(stderr,"usage: esmspl [-t] [-c ich] file.spl ...\n"); return 1;}
+
+  spl_header_s head;
+  memset(&head, 0, sizeof(head));
+  std::vector<spl_chan_s> chans;  // all records, nch each
+  uint32_t nrec = 0, nlost = 0, tfirst = 0, tlast = 0;
+
+  for(; ii<argc; ii++)
+  { FILE *fid = fopen(argv[ii],"rb");
+    if(!fid) { perror(argv[ii]); continue;}
+    spl_header_s hd;
+    if(fread(&hd,sizeof(hd),1,fid)!=1 || hd.magic != SPL_MAGIC || hd.nmagic != (uint32_t) ~SPL_MAGIC || !hd.nch)
+    { fprintf(stderr,"%s: not a sound level file\n",argv[ii]); fclose(fid); continue;}
+    if(head.nch && (hd.nch != head.nch || hd.fsamp != head.fsamp))
+    { fprintf(stderr,"%s: different configuration, skipped\n",argv[ii]); fclose(fid); continue;}
+    head = hd;
+
+    spl_rec_s rec;
+    std::vector<spl_chan_s> ch(head.nch);
+    while(fread(&rec,sizeof(rec),1,fid)==1 && fread(ch.data(),sizeof(spl_chan_s),head.nch,fid)==head.nch)
+    { if(!nrec) tfirst = rec.rtc;
+      tlast = rec.rtc;
+      nlost += rec.nlost;
+      nrec++;
+      chans.insert(chans.end(), ch.begin(), ch.end());
+      if(list)
+      { printf("%10u %3u", rec.rtc, rec.nlost);
+        for(uint32_t ic=0; ic<head.nch; ic++)
+          printf("  %6.2f %6.2f %6.2f %6.2f %5u", db(ch[ic].leq), db(ch[ic].lmax), db(ch[ic].lmin),
+              db(ch[ic].peak), ch[ic].nclip);
+        printf("\n");
+      }
+    }
+    fclose(fid);
+  }
+  if(!nrec) { fprintf(stderr,"esmspl: no records\n"); return 1;}
+
+  time_t t0 = tfirst, t1 = tlast;
+  char s0[32], s1[32];
+  strftime(s0, sizeof(s0), "%Y-%m-%d %H:%M:%S", gmtime(&t0));
+  strftime(s1, sizeof(s1), "%Y-%m-%d %H:%M:%S", gmtime(&t1));
+  printf("# %u records from %s to %s, %u channels, %.3f s per record, %u records lost\n",
+      nrec, s0, s1, head.nch, (double) head.nblock*head.nsamp/head.fsamp, nlost);
+  printf("# levels in dB re full scale sine (peak re full scale)\n");
+  printf("# ch   median    L10     L90     max    peak    nclip\n");
+  for(uint32_t ic=0; ic<head.nch; ic++)
+  { if(only >= 0 && (int) ic != only) continue;
+    std::vector<int16_t> leq;
+    int16_t peak = SPL_MIN;
+    uint64_t nclip = 0;
+    for(uint32_t rr=0; rr<nrec; rr++)
+    { const spl_chan_s *c = &chans[rr*head.nch+ic];
+      leq.push_back(c->leq);
+      if(c->peak > peak) peak = c->peak;
+      nclip += c->nclip;
+    }
+    printf("%4u %7.2f %7.2f %7.2f %7.2f %7.2f %8llu\n", ic, percentile(leq,50), percentile(leq,90),
+        percentile(leq,10), percentile(leq,100), db(peak), (unsigned long long) nclip);
+  }
+  return 0;
+}
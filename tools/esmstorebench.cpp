@@ -0,0 +1,146 @@
+// Copyright 2017 by Walter Zimmer
+//
+// esmstorebench.cpp
+// host check and benchmark of the fused store kernel (src/store.h)
+//
+// usage: esmstorebench [nblocks]
+//   for 1, 2, 4 channels (and 1 or 2 of 4 I2S channels), each logged format and raw I2S or decimated (24 bit) input
+//   compares store() with the plain reference storeRef() (bit exact, random
+//   words including the unused low bits), unpacks what store() wrote (as the
+//   readers of the .bin files) and compares it with the source samples, and
+//   prints cycles (x86 time stamp counter), ns per block of 128 samples and MB/s
+//   (of logged bytes) with its multiple of the real-time rate at 44.1 kHz
+//   'old' is the former three pass path (correct all I2S words in place, extract
+//   the channel, copy into the queue), for comparison
+//   host cycles are only indicative, on the teensy acqLoop prints the measured
+//   cycles per block (log stage) with DO_PROFILE
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+  #include <x86intrin.h>
+  static inline uint64_t cycles(void) { return __rdtsc();}
+#else
+  static inline uint64_t cycles(void) { return 0;}
+#endif
+
+#include "store.h"
+
+#define N_SAMP 128
+
+static int nerror = 0;
+
+static void report(const char *name, int nch, int nsrc, int fmt, int raw, int ok, uint64_t cyc, double ns, int nblocks)
+{ static const char *fmtName[] = {"int32", "int16", "pack24"};
+  static const int fmtBytes[] = {4, 2, 3};
+  double bytes = (double) nch*N_SAMP*fmtBytes[fmt]*nblocks;
+  double mbs = bytes/ns*1e3;
+  printf("%3d %4d %-6s %3d %-4s %10.0f %10.1f %8.1f %8.0f %s\n", nch, nsrc, fmtName[fmt], raw, name,
+      (double) cyc/nblocks, ns/nblocks, mbs, mbs*1e6/(nch*44100.0*fmtBytes[fmt]), ok? "" : "MISMATCH");
+  if(!ok) nerror++;
+}
+
+// sample as a reader of the .bin file gets it (little endian, sign extended)
+static int32_t unpack(const uint8_t *p, int fmt)
+{ if(fmt == FMT_PACK24) return (int32_t)((uint32_t)(p[0] | (p[1] << 8) | (p[2] << 16)) << 8) >> 8;
+  if(fmt == FMT_INT16) return (int16_t)(p[0] | (p[1] << 8));
+  return (int32_t)(p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24));
+}
+
+// expected sample: bits 30..7 of an I2S word (raw) or the 24 bit sample, upper 16 bits for int16
+static int32_t expect(int32_t x, int fmt, int raw)
+{ int32_t v = x;
+  if(raw) { v = (int32_t)(((uint32_t) x >> 7) & 0xffffff); if(v >= 0x800000) v -= 0x1000000; }
+  if(fmt == FMT_INT16) v = (v - (v & 0xff))/256;
+  return v;
+}
+
+template <int nch, int nsrc, int fmt, int raw>
+static void check(int nblocks)
+{ typedef c_store<nch, nsrc, fmt, raw> store_t;
+  std::vector<int32_t> src(nsrc*N_SAMP);
+  std::vector<uint32_t> out(nch*N_SAMP), ref(nch*N_SAMP);
+  int ok = 1;
+  for(int ii=0; ii<1000 && ok; ii++)
+  { for(auto &v: src) v = raw? (int32_t)(((uint32_t) rand() << 16) ^ (uint32_t) rand()) : ((rand() & 0xffffff) - 0x800000);
+    if(ii == 0) for(size_t kk=0; kk<src.size(); kk++) src[kk] = raw? ((kk & 1)? 0x7fffffff : (int32_t) 0x80000000) : ((kk & 1)? 0x7fffff : -0x800000);
+    int ich = (rand() % (nsrc/nch))*nch;
+    memset(out.data(), 0x55, out.size()*4); memset(ref.data(), 0x55, ref.size()*4);
+    store_t::store(out.data(), src.data()+ich, N_SAMP);
+    store_t::storeRef(ref.data(), src.data()+ich, N_SAMP);
+    ok = !memcmp(out.data(), ref.data(), out.size()*4);
+    // round trip
+    const uint8_t *p = (const uint8_t *) out.data();
+    for(int kk=0; kk<N_SAMP && ok; kk++)
+      for(int jj=0; jj<nch && ok; jj++, p += store_t::BYTES)
+        ok = (unpack(p, fmt) == expect(src[ich + kk*nsrc + jj], fmt, raw));
+  }
+
+  auto t0 = std::chrono::steady_clock::now();
+  uint64_t c0 = cycles();
+  for(int ii=0; ii<nblocks; ii++)
+  { store_t::store(out.data(), src.data(), N_SAMP);
+    asm volatile("" : : "r" (out.data()) : "memory");
+  }
+  uint64_t c1 = cycles();
+  double ns = std::chrono::duration<double,std::nano>(std::chrono::steady_clock::now()-t0).count();
+  report("new", nch, nsrc, fmt, raw, ok, c1-c0, ns, nblocks);
+}
+
+template <int nch>
+static void old(int nblocks)
+{ // MSB correction of all I2S words, extraction, copy (Logger::write)
+  const int nsrc = (nch <= 2)? 2 : 4;
+  std::vector<int32_t> src(nsrc*N_SAMP), data1(N_SAMP), queue(nch*N_SAMP);
+  for(auto &v: src) v = rand();
+  auto t0 = std::chrono::steady_clock::now();
+  uint64_t c0 = cycles();
+  for(int ii=0; ii<nblocks; ii++)
+  { int32_t *s = src.data();
+    for(int kk=0; kk<nsrc*N_SAMP; kk++) { s[kk] <<= 1; s[kk] >>= 8; }
+    int32_t *logData = s;
+    if(nch == 1) { for(int kk=0; kk<N_SAMP; kk++) data1[kk] = s[2*kk]; logData = data1.data(); }
+    for(int kk=0; kk<nch*N_SAMP; kk++) queue[kk] = logData[kk];
+    asm volatile("" : : "r" (queue.data()), "r" (s) : "memory");
+  }
+  uint64_t c1 = cycles();
+  double ns = std::chrono::duration<double,std::nano>(std::chrono::steady_clock::now()-t0).count();
+  report("old", nch, nsrc, FMT_INT32, 1, 1, c1-c0, ns, nblocks);
+}
+
+template <int nch>
+static void bench(int nblocks)
+{ const int nsrc = (nch <= 2)? 2 : 4;
+  old<nch>(nblocks);
+  check<nch, nsrc, FMT_INT32, 1>(nblocks);
+  check<nch, nsrc, FMT_PACK24, 1>(nblocks);
+  check<nch, nsrc, FMT_INT16, 1>(nblocks);
+  check<nch, nch, FMT_INT32, 0>(nblocks);
+  check<nch, nch, FMT_PACK24, 0>(nblocks);
+  check<nch, nch, FMT_INT16, 0>(nblocks);
+}
+
+template <int nch>
+static void bench4(int nblocks)
+{ // one or two of four I2S channels (acqConfig ACQ_CASE(1,4) and ACQ_CASE(2,4))
+  check<nch, 4, FMT_INT32, 1>(nblocks);
+  check<nch, 4, FMT_PACK24, 1>(nblocks);
+  check<nch, 4, FMT_INT16, 1>(nblocks);
+}
+
+int main(int argc, char *argv[])
+{
+  int nblocks = (argc>1)? atoi(argv[1]) : 100000;
+  printf("nch nsrc fmt    raw       cyc/block   ns/block     MB/s  x rt\n");
+  bench<1>(nblocks);
+  bench4<1>(nblocks);
+  bench<2>(nblocks);
+  bench4<2>(nblocks);
+  bench<4>(nblocks);
+  printf("%s\n", nerror? "# store differs from reference or source" : "# all bit exact");
+  return nerror? 1 : 0;
+}
@@ -0,0 +1,127 @@
+// Copyright 2017 by Walter Zimmer
+//
+// esmtimeline.cpp
+// rebuilds the sample timeline of an ESM_Logger .bin file from its gap records
+//
+// usage: esmtimeline [-x] file.bin [out.bin]
+//   prints contiguous segments and gaps (in samples per channel, from file start),
+//   gaps of trigger mode (no detection) are listed as idle
+//   if out.bin is given, writes a copy where each gap is replaced by zero samples
+//   so that sample positions in out.bin are true time positions
+//   (block index records are not copied)
+//   -x also lists the block index entries and checks them for lost blocks
+//   the statistics record at file end (write latency, queue depth) is printed
+//   as is the measured rate (header: since logger start, record: over this file)
+//   with the RTC time of the first sample
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include "binfile.h"
+
+int main(int argc, char *argv[])
+{
+  int listIndex = 0;
+  if(argc>1 && !strcmp(argv[1],"-x")) { listIndex=1; argc--; argv++; }
+  if(argc<2) { fprintf(stderr,"usage: esmtimeline [-x] file.bin [out.bin]\n"); return 1;}
+
+  FILE *fid = fopen(argv[1],"rb");
+  if(!fid) { perror(argv[1]); return 1;}
+
+  header_s header;
+  if(fread(&header,sizeof(header),1,fid)!=1) { fprintf(stderr,"%s: no header\n",argv[1]); return 1;}
+  if(!header.nch || !header.nsamp) { fprintf(stderr,"%s: bad header\n",argv[1]); return 1;}
+
+  FILE *fout = 0;
+  if(argc>2)
+  { fout = fopen(argv[2],"wb");
+    if(!fout) { perror(argv[2]); return 1;}
+    fwrite(&header,sizeof(header),1,fout);
+  }
+
+  uint32_t nb = blockBytes(&header); // bytes per block
+  std::vector<uint8_t> block(nb), zero(nb,0);
+
+  printf("# %s: nch %u fsamp %u nsamp %u flags %x fmt %u\n",
+      argv[1], header.nch, header.fsamp, header.nsamp, header.flags, header.fmt);
+  if((header.flags & HDR_RATE) && header.npoint)
+    printf("# rate %.4f Hz (%.3f ppm, %u stamps) drift %.3f ppm/h, block %u at %.6f s\n",
+        header.rate, header.ppm, header.npoint, header.drift, header.block, header.tfirst);
+  printf("# type       start      length  abs_sample\n");
+
+  uint64_t tpos = 0;   // timeline position (samples per channel)
+  uint64_t segStart = 0, segLen = 0;
+  uint64_t nblocks = 0, ngaps = 0, ndropped = 0;
+  uint64_t nentries = 0, nlost = 0;
+  idx_entry_s last = {0,0,0,0};
+
+  while(fread(block.data(),1,nb,fid)==nb)
+  {
+    if((header.flags & HDR_GAPS) && isGap(block.data()))
+    { gap_s *gap = (gap_s *) block.data();
+      if(segLen) printf("segment %10llu %10llu\n",(unsigned long long)segStart,(unsigned long long)segLen);
+      uint64_t len = (uint64_t) gap->ndrop*header.nsamp;
+      printf("%s %10llu %10llu  %llu\n",(gap->cause == GAP_IDLE)? "idle   " : "gap    ",
+          (unsigned long long)tpos,(unsigned long long)len,
+          (unsigned long long)gap->sample);
+      if(fout) for(uint32_t ii=0; ii<gap->ndrop; ii++) fwrite(zero.data(),1,nb,fout);
+      tpos += len;
+      ngaps++; ndropped += gap->ndrop;
+      segStart = tpos; segLen = 0;
+      continue;
+    }
+    if((header.flags & HDR_INDEX) && isIndex(block.data()))
+    { idx_s *rec = (idx_s *) block.data();
+      idx_entry_s *ent = (idx_entry_s *) (rec+1);
+      for(uint32_t ii=0; ii<rec->nent; ii++)
+      { // sequence number and interrupt count advance together unless the ISR lost blocks
+        int32_t lost = nentries? (int32_t)((ent[ii].rxcount-last.rxcount) - (ent[ii].seq-last.seq)) : 0;
+        if(lost>0) nlost += lost;
+        if(listIndex)
+          printf("index   %10u %10u %10u %4u %s\n", ent[ii].seq, ent[ii].rxcount, ent[ii].cycles, ent[ii].nblk,
+              (lost>0)? "lost" : "");
+        last = ent[ii];
+        nentries++;
+      }
+      continue;
+    }
+    if((header.flags & HDR_STATS) && isStat(block.data()))
+    { stat_s *st = (stat_s *) block.data();
+      printf("# writes %u x %u bytes latency mean %u us max %u us\n", st->nwrite, st->wbytes,
+          st->nwrite? st->sumLatency/st->nwrite : 0, st->maxLatency);
+      printf("# queue max %u rotation %u of %u blocks overrun %u busy %u\n",
+          st->queueMax, st->rotateDepth, st->queueSize, st->overrun, st->busy);
+      for(int ii=0; ii<STAT_NHIST; ii++)
+        if(st->hist[ii]) printf("#  latency %8u us %u\n", 1u<<ii, st->hist[ii]);
+      continue;
+    }
+    if((header.flags & HDR_RATE) && isRate(block.data()))
+    { rate_s *rt = (rate_s *) block.data();
+      printf("# file rate %.4f Hz (%.3f ppm, %u stamps over %.0f s, rms %.1f us) drift %.3f ppm/h\n",
+          rt->rate, rt->ppm, rt->npoint, rt->span, rt->rms, rt->drift);
+      printf("# first sample (block %u) at %.6f s, run rate %.4f Hz (%.3f ppm, %u stamps)\n",
+          rt->block, rt->tfirst, rt->runRate, rt->runPpm, rt->runPoint);
+      continue;
+    }
+    if((header.flags & HDR_TRACE) && isTrace(block.data())) continue; // see esmtrace
+    if(fout) fwrite(block.data(),1,nb,fout);
+    tpos += header.nsamp;
+    segLen += header.nsamp;
+    nblocks++;
+  }
+  if(segLen) printf("segment %10llu %10llu\n",(unsigned long long)segStart,(unsigned long long)segLen);
+
+  printf("# blocks %llu gaps %llu dropped blocks %llu duration %.3f s\n",
+      (unsigned long long)nblocks, (unsigned long long)ngaps, (unsigned long long)ndropped,
+      (double)tpos/header.fsamp);
+  if(header.flags & HDR_INDEX)
+    printf("# index entries %llu blocks lost before queue %llu\n",
+      (unsigned long long)nentries, (unsigned long long)nlost);
+
+  fclose(fid);
+  if(fout) fclose(fout);
+  return 0;
+}
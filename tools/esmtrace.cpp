@@ -0,0 +1,240 @@
+// Copyright 2017 by Walter Zimmer
+//
+// esmtrace.cpp
+// replays uSD write latency traces (SD_TRACE) against the Logger queue
+// to find the smallest queue (NQ) that logs without overrun
+//
+// usage: esmtrace [options] file.bin ... | file.trc
+//   -o out.trc  write the trace entries of all input files into a compact trace file
+//   -c list     channel counts (default 1,2,4)
+//   -f list     sampling frequencies in Hz (default 44100,48000,96000)
+//   -n nsamp    samples per block (default 128)
+//   -b bytes    bytes per sample (default 3, pack24)
+//   -a naud     blocks per write (default 64/32/16 for 1/2/4 channels, i.e. NAUD)
+//   -v          list trace entries
+//
+// the trace is a sequence of card operations with their duration, as seen by
+// uSD_IF::save() on the teensy; it is replayed as a card that needs the same time
+// for the same byte range: a write of the replayed configuration costs the time
+// of the traced writes it overlaps, at the median rate (us per byte) of the trace,
+// plus the excess (stall) of each traced write that ends within it;
+// file operations are done when the queue is drained, as save() does.
+// the producer adds a block every nsamp/fsamp, the queue depth includes the blocks
+// being written (ZERO_COPY), so a queue of NQ >= max depth blocks has no overrun
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#include "binfile.h"
+#include "rice.h"
+
+static std::vector<uint32_t> trace;
+
+static int readTrace(const char *name)
+{ // append trace entries of .trc or .bin file
+  FILE *fid = fopen(name,"rb");
+  if(!fid) { perror(name); return 0;}
+  std::vector<uint8_t> data;
+  uint8_t tmp[65536];
+  size_t nr;
+  while((nr=fread(tmp,1,sizeof(tmp),fid))>0) data.insert(data.end(),tmp,tmp+nr);
+  fclose(fid);
+
+  if(data.size() >= sizeof(trace_s) && isTrace(data.data()))
+  { // trace file
+    trace_s *rec = (trace_s *) data.data();
+    uint32_t *ent = (uint32_t *) (rec+1);
+    if(sizeof(trace_s) + rec->nent*sizeof(uint32_t) > data.size())
+    { fprintf(stderr,"%s: truncated trace file\n",name); return 0;}
+    trace.insert(trace.end(), ent, ent+rec->nent);
+    return 1;
+  }
+
+  if(data.size() < sizeof(header_s)) { fprintf(stderr,"%s: no header\n",name); return 0;}
+  header_s header;
+  memcpy(&header, data.data(), sizeof(header));
+  if(!header.nch || !header.nsamp) { fprintf(stderr,"%s: bad header\n",name); return 0;}
+  if(!(header.flags & HDR_TRACE)) { fprintf(stderr,"%s: no trace records (SD_TRACE)\n",name); return 0;}
+
+  uint32_t nd = header.nch*header.nsamp;
+  std::vector<int32_t> block(nd);
+  size_t pos = sizeof(header);
+  uint32_t nrec = 0;
+  while(pos < data.size())
+  { const void *ptr = &data[pos];
+    if(header.fmt == FMT_RICE)
+    { uint32_t nb = rice_decode(block.data(), &data[pos], data.size()-pos, header.nsamp);
+      if(!nb) { pos += 4; continue; } // lost sync (or zero padded end of file)
+      ptr = block.data();
+      pos += nb;
+    }
+    else
+    { uint32_t nb = blockBytes(&header);
+      if(pos + nb > data.size()) break;
+      pos += nb;
+    }
+    if(isTrace(ptr))
+    { const trace_s *rec = (const trace_s *) ptr;
+      const uint32_t *ent = (const uint32_t *) (rec+1);
+      trace.insert(trace.end(), ent, ent+rec->nent);
+      nrec++;
+    }
+  }
+  fprintf(stderr,"%s: %u trace records\n", name, nrec);
+  return 1;
+}
+
+struct result_s { uint32_t maxDepth; double seconds; };
+
+static result_s replay(int nch, double fsamp, int nsamp, int bps, int na, double usPerByte)
+{
+  double blockBytes = (double) nch*nsamp*bps;
+  double chunk = na*blockBytes;
+  double tblk = nsamp/fsamp*1e6; // us between blocks
+
+  double t = 0;         // us
+  uint64_t head = 0;    // blocks queued by ISR
+  uint64_t tail = 0;    // blocks released by loop()
+  uint32_t maxDepth = 0;
+  auto advance = [&](double dt)
+  { t += dt;
+    head = (uint64_t)(t/tblk + 1e-6); // (tolerate rounding of t)
+    uint64_t depth = head - tail;
+    if(depth > maxDepth) maxDepth = depth > 0xffffffff? 0xffffffff : (uint32_t) depth;
+  };
+
+  // card position (bytes) and pending file operations
+  size_t iw = 0;        // next trace entry
+  double wpos = 0;      // bytes of entry iw already used
+  size_t nent = trace.size();
+  std::vector<double> ops;
+
+  while(1)
+  { // move file operations at card position into pending list
+    while(iw < nent && !TRACE_SECTORS(trace[iw])) ops.push_back(TRACE_US(trace[iw++]));
+    if(iw == nent && ops.empty()) break;
+    if(maxDepth > (1u<<20)) break; // card is too slow
+
+    if(head - tail >= (uint64_t) na && iw < nent)
+    { // write chunk
+      double need = chunk, cost = 0;
+      while(need > 0 && iw < nent)
+      { uint32_t ent = trace[iw];
+        if(!TRACE_SECTORS(ent)) { ops.push_back(TRACE_US(ent)); iw++; continue; }
+        double nb = TRACE_SECTORS(ent)*512.0;
+        double base = nb*usPerByte;
+        if(base > TRACE_US(ent)) base = TRACE_US(ent);
+        double use = (nb-wpos < need)? nb-wpos : need;
+        cost += base*use/nb;
+        need -= use; wpos += use;
+        if(wpos >= nb) { cost += TRACE_US(ent)-base; iw++; wpos = 0; } // stall at end of write
+      }
+      advance(cost);
+      tail += na;
+    }
+    else if(!ops.empty() && head - tail < (uint64_t) na)
+    { // queue is drained, do one file operation
+      advance(ops.front());
+      ops.erase(ops.begin());
+    }
+    else
+    { // wait for next block
+      advance((head+1)*tblk - t);
+    }
+  }
+  result_s res = { maxDepth, t*1e-6 };
+  return res;
+}
+
+static std::vector<double> parseList(const char *txt)
+{ std::vector<double> list;
+  for(const char *ptr = txt; ptr && *ptr; )
+  { list.push_back(atof(ptr));
+    ptr = strchr(ptr,',');
+    if(ptr) ptr++;
+  }
+  return list;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *outName = 0;
+  std::vector<double> chans = {1,2,4}, freqs = {44100,48000,96000};
+  int nsamp = 128, bps = 3, naud = 0, verbose = 0;
+  int opt;
+  while((opt = getopt(argc, argv, "o:c:f:n:b:a:v")) != -1)
+  { switch(opt)
+    { case 'o': outName = optarg; break;
+      case 'c': chans = parseList(optarg); break;
+      case 'f': freqs = parseList(optarg); break;
+      case 'n': nsamp = atoi(optarg); break;
+      case 'b': bps = atoi(optarg); break;
+      case 'a': naud = atoi(optarg); break;
+      case 'v': verbose = 1; break;
+      default: optind = argc+1; break;
+    }
+  }
+  if(optind >= argc)
+  { fprintf(stderr,"usage: esmtrace [-o out.trc] [-c 1,2,4] [-f 44100,48000,96000] [-n nsamp] [-b bytes] [-a naud] [-v] file.bin ... | file.trc\n");
+    return 1;
+  }
+  for(int ii=optind; ii<argc; ii++) readTrace(argv[ii]);
+  if(trace.empty()) { fprintf(stderr,"esmtrace: no trace entries\n"); return 1;}
+
+  if(outName)
+  { FILE *fout = fopen(outName,"wb");
+    if(!fout) { perror(outName); return 1;}
+    trace_s rec = { TRACE_MAGIC, ~TRACE_MAGIC, (uint32_t) trace.size(), 0 };
+    fwrite(&rec,sizeof(rec),1,fout);
+    fwrite(trace.data(),sizeof(uint32_t),trace.size(),fout);
+    fclose(fout);
+  }
+
+  // trace summary
+  double nbytes = 0, wtime = 0, otime = 0;
+  uint32_t nops = 0, maxw = 0, maxo = 0;
+  for(auto ent: trace)
+  { if(verbose) printf("%8u us %4u sectors\n", TRACE_US(ent), TRACE_SECTORS(ent));
+    if(TRACE_SECTORS(ent))
+    { nbytes += TRACE_SECTORS(ent)*512.0; wtime += TRACE_US(ent);
+      if(TRACE_US(ent) > maxw) maxw = TRACE_US(ent);
+    }
+    else
+    { nops++; otime += TRACE_US(ent);
+      if(TRACE_US(ent) > maxo) maxo = TRACE_US(ent);
+    }
+  }
+  printf("# trace: %zu writes %.2f MB at %.2f MB/s (max %u us), %u file operations (max %u us)\n",
+      trace.size()-nops, nbytes/1048576.0, wtime? nbytes/wtime/1.048576 : 0.0, maxw, nops, maxo);
+  // median rate of writes
+  std::vector<double> rates;
+  for(auto ent: trace) if(TRACE_SECTORS(ent)) rates.push_back(TRACE_US(ent)/(TRACE_SECTORS(ent)*512.0));
+  std::nth_element(rates.begin(), rates.begin()+rates.size()/2, rates.end());
+  double usPerByte = rates.empty()? 0 : rates[rates.size()/2];
+
+  printf("#  nch    fsamp    MB/s naud  replay_s  max_depth    NQ  RAM_kB  NQ=256/nch\n");
+
+  for(auto c: chans)
+    for(auto f: freqs)
+    { int nch = (int) c;
+      int na = naud? naud : (nch==1)? 64 : (nch==2)? 32 : 16;
+      result_s res = replay(nch, f, nsamp, bps, na, usPerByte);
+      uint32_t nq = 1;
+      while(nq < res.maxDepth) nq <<= 1; // Logger needs power of 2
+      uint32_t blockBytes = nch*nsamp*bps;
+      double rate = blockBytes*f/nsamp/1048576.0;
+      if(res.maxDepth > (1u<<20))
+      { printf("%6d %8.0f %7.3f %4d  card too slow\n", nch, f, rate, na);
+        continue;
+      }
+      printf("%6d %8.0f %7.3f %4d %9.1f %10u %5u %7.1f  %s\n", nch, f, rate, na, res.seconds,
+          res.maxDepth, nq, nq*blockBytes/1024.0, (res.maxDepth <= (uint32_t)(256/nch))? "ok" : "overrun");
+    }
+  return 0;
+}
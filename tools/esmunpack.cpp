@@ -0,0 +1,68 @@
+// Copyright 2017 by Walter Zimmer
+//
+// esmunpack.cpp
+// converts an ESM_Logger .bin file with packed 24 bit samples (FMT_PACK24)
+// into a .bin file with 32 bit samples (FMT_INT32)
+//
+// usage: esmunpack in.bin out.bin
+//   gap, block index and statistics records are kept (zero padded to the larger block size)
+//   files that are not packed are copied unchanged
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include "binfile.h"
+
+int main(int argc, char *argv[])
+{
+  if(argc<3) { fprintf(stderr,"usage: esmunpack in.bin out.bin\n"); return 1;}
+
+  FILE *fid = fopen(argv[1],"rb");
+  if(!fid) { perror(argv[1]); return 1;}
+
+  header_s header;
+  if(fread(&header,sizeof(header),1,fid)!=1) { fprintf(stderr,"%s: no header\n",argv[1]); return 1;}
+  if(!header.nch || !header.nsamp) { fprintf(stderr,"%s: bad header\n",argv[1]); return 1;}
+
+  FILE *fout = fopen(argv[2],"wb");
+  if(!fout) { perror(argv[2]); return 1;}
+
+  uint32_t nb = blockBytes(&header); // input bytes per block
+  uint32_t nd = header.nch*header.nsamp; // samples per block
+  std::vector<uint8_t> block(nb);
+  std::vector<int32_t> out(nd);
+
+  int isPacked = (header.fmt == FMT_PACK24);
+  if(isPacked) header.fmt = FMT_INT32;
+  fwrite(&header,sizeof(header),1,fout);
+
+  uint64_t nblocks = 0, nrecords = 0;
+  while(fread(block.data(),1,nb,fid)==nb)
+  {
+    if(!isPacked)
+    { fwrite(block.data(),1,nb,fout);
+    }
+    else if(isRecord(block.data()))
+    { // records keep their layout
+      memset(out.data(),0,nd*sizeof(int32_t));
+      memcpy(out.data(),block.data(),nb);
+      fwrite(out.data(),sizeof(int32_t),nd,fout);
+      nrecords++;
+      continue;
+    }
+    else
+    { unpack24(out.data(),block.data(),nd);
+      fwrite(out.data(),sizeof(int32_t),nd,fout);
+    }
+    nblocks++;
+  }
+  fprintf(stderr,"%s: %llu blocks %llu records %s\n", argv[1],
+      (unsigned long long)nblocks, (unsigned long long)nrecords, isPacked? "unpacked" : "copied");
+
+  fclose(fid);
+  fclose(fout);
+  return 0;
+}
@@ -0,0 +1,220 @@
+// Copyright 2017 by Walter Zimmer
+//
+// flac.h
+// minimal FLAC encoder for the host tools (no libFLAC needed)
+//
+// fixed block size stream, independent channels, each subframe is the smallest
+// of CONSTANT, VERBATIM and FIXED (polynomial predictor order 0..4) with
+// partitioned rice coding (5 bit parameters); no MD5 signature (all zero,
+// i.e. "not computed", as allowed by the format)
+// frames are numbered, so any range of frames can be encoded on its own
+// (e.g. by several threads) and the results concatenated
+//
+#ifndef FLAC_H
+#define FLAC_H
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+/*------------------------- bit writer -----------------------------*/
+class c_flacOut
+{
+  std::vector<uint8_t> &buf;
+  uint64_t acc;   // pending bits (msb first)
+  int nacc;
+public:
+  c_flacOut(std::vector<uint8_t> &dst) : buf(dst), acc(0), nacc(0) {;}
+
+  inline void put(uint32_t val, int nbits) // nbits <= 32
+  { if(!nbits) return;
+    acc = (acc << nbits) | (val & (0xffffffffu >> (32-nbits)));
+    nacc += nbits;
+    while(nacc >= 8) { nacc -= 8; buf.push_back((uint8_t)(acc >> nacc)); }
+    acc &= (1ull << nacc) - 1;
+  }
+  inline void zeros(uint32_t n) { while(n > 32) { put(0,32); n -= 32;} put(0,n);}
+  void align(void) { if(nacc) put(0, 8-nacc); }
+};
+
+/*------------------------- checksums ------------------------------*/
+static inline uint8_t flac_crc8(const uint8_t *ptr, size_t n)
+{ uint8_t crc = 0;
+  while(n--)
+  { crc ^= *ptr++;
+    for(int ii=0; ii<8; ii++) crc = (crc & 0x80)? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+  }
+  return crc;
+}
+
+static inline uint16_t flac_crc16(const uint8_t *ptr, size_t n)
+{ uint16_t crc = 0;
+  while(n--)
+  { crc ^= (uint16_t)(*ptr++) << 8;
+    for(int ii=0; ii<8; ii++) crc = (crc & 0x8000)? (uint16_t)((crc << 1) ^ 0x8005) : (uint16_t)(crc << 1);
+  }
+  return crc;
+}
+
+/*------------------------- encoder --------------------------------*/
+class c_flacEnc
+{
+public:
+  uint32_t minFrame = 0xffffff, maxFrame = 0; // frame sizes seen by encode()
+
+  void init(int nchan, uint32_t fsamp, int bits, int blockSize)
+  { nch = nchan; fs = fsamp; bps = bits; bs = blockSize;
+    res.resize(bs); chan.resize(bs);
+  }
+  int blockSize(void) { return bs; }
+
+  // stream marker and STREAMINFO; frame sizes are from the encoder(s) that made the frames
+  void header(std::vector<uint8_t> &dst, uint64_t nsamp, uint32_t fmin, uint32_t fmax)
+  { c_flacOut out(dst);
+    out.put('f',8); out.put('L',8); out.put('a',8); out.put('C',8);
+    out.put(1,1); out.put(0,7); out.put(34,24); // last metadata block, STREAMINFO
+    out.put(bs,16); out.put(bs,16);
+    if(fmin > fmax) fmin = fmax = 0; // unknown
+    out.put(fmin,24); out.put(fmax,24);
+    out.put(fs,20); out.put(nch-1,3); out.put(bps-1,5);
+    out.put((uint32_t)(nsamp >> 32),4); out.put((uint32_t) nsamp,32);
+    for(int ii=0; ii<4; ii++) out.put(0,32); // MD5 not computed
+  }
+
+  /*
+   * encode one frame of nsamp (<= block size, smaller only for the last frame)
+   * interleaved samples, appends to dst
+   */
+  void encode(std::vector<uint8_t> &dst, const int32_t *src, int nsamp, uint32_t frameNumber)
+  { size_t bgn = dst.size();
+    c_flacOut out(dst);
+    out.put(0xFFF8,16); // sync, fixed block size
+    int bsCode = 7;
+    for(int ii=0; ii<8; ii++) if(nsamp == (256 << ii)) bsCode = 8+ii;
+    if(bsCode == 7 && nsamp <= 256) bsCode = 6;
+    out.put(bsCode,4);
+    out.put(0,4);       // sample rate from STREAMINFO
+    out.put(nch-1,4);   // independent channels
+    out.put((bps==8)? 1 : (bps==12)? 2 : (bps==16)? 4 : (bps==20)? 5 : (bps==24)? 6 : 0, 3);
+    out.put(0,1);
+    utf8(out, frameNumber);
+    if(bsCode == 6) out.put(nsamp-1,8);
+    if(bsCode == 7) out.put(nsamp-1,16);
+    out.put(flac_crc8(&dst[bgn], dst.size()-bgn),8);
+
+    for(int ich=0; ich<nch; ich++)
+    { for(int ii=0; ii<nsamp; ii++) chan[ii] = src[ii*nch+ich];
+      subframe(out, chan.data(), nsamp);
+    }
+    out.align();
+    uint16_t crc = flac_crc16(&dst[bgn], dst.size()-bgn);
+    out.put(crc,16);
+
+    uint32_t nb = dst.size()-bgn;
+    if(nb < minFrame) minFrame = nb;
+    if(nb > maxFrame) maxFrame = nb;
+  }
+
+private:
+  int nch = 1, bps = 24, bs = 4096;
+  uint32_t fs = 44100;
+  std::vector<int32_t> res, chan;
+
+  static void utf8(c_flacOut &out, uint32_t v)
+  { if(v < 0x80) { out.put(v,8); return; }
+    int n = (v < 0x800)? 2 : (v < 0x10000)? 3 : (v < 0x200000)? 4 : (v < 0x4000000)? 5 : 6;
+    out.put(((0xff00 >> n) & 0xff) | (v >> (6*(n-1))), 8);
+    for(int ii=n-2; ii>=0; ii--) out.put(0x80 | ((v >> (6*ii)) & 0x3f), 8);
+  }
+
+  static inline uint32_t zigzag(int32_t x) { return ((uint32_t)x << 1) ^ (uint32_t)(x >> 31);}
+
+  // residual of fixed predictor of order at x (needs order previous samples)
+  static inline int64_t residual(const int32_t *x, int order)
+  { switch(order)
+    { case 0: return x[0];
+      case 1: return (int64_t)x[0] - x[-1];
+      case 2: return (int64_t)x[0] - 2*(int64_t)x[-1] + x[-2];
+      case 3: return (int64_t)x[0] - 3*(int64_t)x[-1] + 3*(int64_t)x[-2] - x[-3];
+      default: return (int64_t)x[0] - 4*(int64_t)x[-1] + 6*(int64_t)x[-2] - 4*(int64_t)x[-3] + x[-4];
+    }
+  }
+
+  // estimated bits and parameter of a rice partition with sum of zigzag values
+  static uint64_t riceBits(uint64_t sum, uint32_t n, int *k)
+  { uint64_t mean = n? sum/n : 0;
+    int kk = 0; while(kk < 30 && (mean >> (kk+1))) kk++;
+    *k = kk;
+    return 5 + (uint64_t) n*(kk+1) + (sum >> kk);
+  }
+
+  void subframe(c_flacOut &out, const int32_t *x, int n)
+  { // constant
+    int ii;
+    for(ii=1; ii<n && x[ii]==x[0]; ii++) ;
+    if(ii == n)
+    { out.put(0,8); out.put((uint32_t) x[0], bps);
+      return;
+    }
+
+    // fixed predictor with smallest sum of absolute residuals
+    int order = -1;
+    uint64_t best = ~0ull;
+    int maxOrder = (n > 4)? 4 : n-1;
+    for(int oo=0; oo<=maxOrder; oo++)
+    { uint64_t sum = 0;
+      int ok = 1;
+      for(ii=oo; ii<n; ii++)
+      { int64_t r = residual(x+ii, oo);
+        if(r >= (1ll<<30) || r < -(1ll<<30)) { ok = 0; break; } // keep zigzag in 31 bits
+        sum += (r < 0)? -r : r;
+      }
+      if(ok && sum < best) { best = sum; order = oo; }
+    }
+
+    if(order >= 0)
+    { for(ii=order; ii<n; ii++) res[ii] = (int32_t) residual(x+ii, order);
+
+      // partition order with fewest estimated bits
+      int maxPart = 0;
+      while(maxPart < 8 && !(n % (1 << (maxPart+1))) && (n >> (maxPart+1)) > order) maxPart++;
+      uint64_t bestBits = ~0ull; int bestPart = 0;
+      for(int pp=0; pp<=maxPart; pp++)
+      { uint64_t bits = 0;
+        int np = n >> pp;
+        for(int jj=0; jj<(1<<pp); jj++)
+        { int i0 = (jj==0)? order : jj*np, i1 = (jj+1)*np;
+          uint64_t sum = 0; for(ii=i0; ii<i1; ii++) sum += zigzag(res[ii]);
+          int k; bits += riceBits(sum, i1-i0, &k);
+        }
+        if(bits < bestBits) { bestBits = bits; bestPart = pp; }
+      }
+
+      if(8 + order*bps + 6 + bestBits < (uint64_t) n*bps)
+      { out.put(0,1); out.put(8+order,6); out.put(0,1);
+        for(ii=0; ii<order; ii++) out.put((uint32_t) x[ii], bps);
+        out.put(1,2);          // rice coding with 5 bit parameters
+        out.put(bestPart,4);
+        int np = n >> bestPart;
+        for(int jj=0; jj<(1<<bestPart); jj++)
+        { int i0 = (jj==0)? order : jj*np, i1 = (jj+1)*np;
+          uint64_t sum = 0; for(ii=i0; ii<i1; ii++) sum += zigzag(res[ii]);
+          int k; riceBits(sum, i1-i0, &k);
+          out.put(k,5);
+          for(ii=i0; ii<i1; ii++)
+          { uint32_t u = zigzag(res[ii]);
+            out.zeros(u >> k); out.put(1,1);
+            out.put(u,k);
+          }
+        }
+        return;
+      }
+    }
+
+    // verbatim
+    out.put(2,8);
+    for(ii=0; ii<n; ii++) out.put((uint32_t) x[ii], bps);
+  }
+};
+
+#endif
@@ -0,0 +1,54 @@
+// Copyright 2017 by Walter Zimmer
+//
+// loggerhost.h
+// src/logger.h for host tools that use the Logger without the simulation
+// (esmdrainbench, esmringstress), built with -Isim/stub
+// provides what myAPP.cpp gives logger.h (parameters, acq_s) and the teensy and
+// card stubs: no Serial output, the RTC stands still, card operations take no
+// time and nothing is written
+// include once, in place of logger.h
+//
+#ifndef LOGGERHOST_H
+#define LOGGERHOST_H
+
+#include "core_pins.h"
+#include "usb_serial.h"
+
+typedef struct { char name[5]; } parameters_s;
+parameters_s parameters = {"HOST"};
+typedef struct { uint32_t fsamp; uint16_t chanMask; uint16_t nq; uint16_t naud; } acq_s;
+
+#include "logger.h"
+
+usb_serial_class Serial;
+int usb_serial_class::printf(const char *fmt, ...) { return 0; }
+void usb_serial_class::print(const char *txt) {;}
+void usb_serial_class::println(const char *txt) {;}
+void usb_serial_class::println(int val) {;}
+
+void (* _VectorsRam[256])(void);
+extern "C" { volatile uint32_t systick_millis_count = 0; volatile uint32_t rxCount = 0; }
+volatile uint32_t RTC_TSR = 1500000000u, RTC_TPR = 0, RTC_SR = 0, FTFL_FSTAT = FTFL_FSTAT_CCIF;
+volatile uint8_t FTFL_FCCOB0, FTFL_FCCOB1, FTFL_FCCOB4, FTFL_FCCOB5, FTFL_FCCOB6, FTFL_FCCOB7;
+void (*FsDateTime::callback)(uint16_t *date, uint16_t *time);
+volatile uint32_t ARM_DEMCR = 0, ARM_DWT_CTRL = 0;
+uint32_t simCycles(void) { return 0; }
+
+void pinMode(int pin, int mode) {;}
+void digitalWrite(int pin, int val) {;}
+void digitalWriteFast(int pin, int val) {;}
+int digitalReadFast(int pin) { return HIGH; }
+void delay(uint32_t msec) {;}
+uint32_t millis(void) { return 0; }
+uint32_t micros(void) { return 0; }
+extern "C" void yield(void) {;}
+
+void simSdOp(int op, uint32_t nbytes) {;}
+uint32_t simAllocate(FsFile *file, uint32_t nsect) { return 0; }
+FsFile *simFileAt(uint32_t sector) { return 0; }
+void simFileOpened(FsFile *file) {;}
+void simFileRestore(FsFile *file) {;}
+void simFileClosed(FsFile *file, int removed) { file->data.clear(); }
+void simHalt(const char *msg) { fprintf(stderr, "errorHalt: %s\n", msg); exit(1); }
+
+#endif
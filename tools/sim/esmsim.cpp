@@ -0,0 +1,488 @@
+// Copyright 2017 by Walter Zimmer
+//
+// esmsim.cpp
+// host simulation of the I2S -> Logger -> uSD pipeline
+//
+// the firmware (myAPP.cpp with logger.h and mfs.h) is compiled for linux against
+// the stubs in sim/stub; a discrete event clock calls i2sInProcessing at the exact
+// N_SAMP/fsamp cadence and the fake SdFs (sim/stub/SdFs.h) advances the clock
+// by the modelled latency of each card operation, so that the ISR keeps filling
+// the queue while loop() is blocked in a write, as on the teensy
+//
+// usage: esmsim [options]
+//   -t sec    simulated logging time (default 120)
+//   -r MB/s   sustained card write rate (default 20)
+//   -o us     overhead per file system write and per multi-sector start (default 300)
+//   -p n      latency spikes per MB of file system writes (default 0.1)
+//   -q n      latency spikes per MB of raw sector writes (default 0.1)
+//   -s ms     largest spike, spikes are uniform in s/2..s (default 150)
+//   -a ms     latency of open, preAllocate, truncate, close (default 20)
+//   -l us     duration of a loop() pass without card access (default 2)
+//   -x seed   random seed (default 1)
+//   -e n      detections per minute (TRIGGER, logger.trigger() is called at random times)
+//   -f Hz     sampling frequency (acq.fsamp, default F_SAMP)
+//   -c mask   logged I2S slots (acq.chanMask, default CHAN_MASK)
+//   -n n      queue blocks (acq.nq, default NQ, 0: as many as fit into arena, at least 256/channels)
+//   -w n      blocks per write (acq.naud, default NAUD, 0: 64/channels; nq must be at least 2*n)
+//   -k ppm    error of the I2S clock against the RTC (default 0)
+//   -d dir    write closed files into dir
+//   -v        show Serial output of firmware
+//
+// the acquisition configuration (acq) is set as by Config.txt, the compile time
+// configuration of the firmware (MAX_MB, ARENA_KB, DECIMATE, COMPRESS, PACK_16,
+// RAW_WRITE, BLOCK_INDEX and the defaults F_SAMP, N_CHAN, NQ, NAUD) by SIMFLAGS, e.g.
+//   make bin/esmsim SIMFLAGS="-DNQ=128 -DRAW_WRITE"
+//
+// the I2S data are a ramp per I2S channel, so the files are checked for lost,
+// duplicated or corrupted samples (except with DECIMATE > 1)
+// the RTC (seconds and 32768 Hz prescaler) runs on simulated time, the I2S clock
+// is off by -k ppm, so the measured rate of each file (rate_s) is compared with it
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <math.h>
+#include <map>
+#include <random>
+
+#include "myAPP.cpp"
+#include "binfile.h"
+#include "rice.h"
+
+extern "C" volatile uint32_t rxCount;
+
+/*------------------------- configuration --------------------------*/
+static struct
+{
+  double tsim = 120;       // s
+  double rate = 20;        // MB/s (= bytes/us)
+  double overhead = 300;   // us
+  double fsSpikes = 0.1;   // per MB
+  double rawSpikes = 0.1;  // per MB
+  double spike = 150;      // ms
+  double fileOp = 20;      // ms
+  double loopCost = 2;     // us
+  unsigned seed = 1;
+  double events = 1;        // per minute
+  double ppm = 0;           // I2S clock error
+  const char *dir = 0;
+  int verbose = 0;
+} cfg;
+
+/*------------------------- simulated clock ------------------------*/
+static uint64_t simNow = 0;   // ns
+static uint64_t isrCount = 0; // number of I2S interrupts
+static uint64_t isrStart = 0; // isrCount at logger start
+static uint64_t sampleCount = 0;
+static std::vector<uint64_t> depthHist;
+static uint32_t depthMax = 0;
+
+static inline uint64_t isrTime(uint64_t k)
+{ if(cfg.ppm == 0) return (k*N_SAMP*1000000000ull)/acq.fsamp;
+  return (uint64_t)(k*N_SAMP*1e9/(acq.fsamp*(1.0+cfg.ppm*1e-6)));
+}
+static inline void rtcSet(uint64_t ns)
+{ RTC_TSR = 1500000000u + (uint32_t)(ns/1000000000ull);
+  RTC_TPR = (uint32_t)(((ns % 1000000000ull)*32768)/1000000000ull);
+}
+
+#define RAMP_STEP 1000003 // offset between I2S channels
+#if LOG_FMT == FMT_INT16
+  #define RAMP_SHIFT 8 // logged upper 16 bits of the 24 bit samples hold the ramp
+#else
+  #define RAMP_SHIFT 0
+#endif
+#define RAMP_MASK (0xffffff >> RAMP_SHIFT)
+static inline int32_t rampValue(uint64_t n, int slot)
+{ return ((int32_t)(((n + (uint64_t)slot*RAMP_STEP) & RAMP_MASK) << (8+RAMP_SHIFT))) >> 8;
+}
+
+static std::mt19937 rng;
+static double uniform(void) { return std::uniform_real_distribution<double>(0.0,1.0)(rng); }
+#ifdef TRIGGER
+  static double nextEvent = 0; // s
+  static uint32_t nevents = 0;
+#endif
+
+static void fireIsr(void)
+{ // DMA has filled one half of the double buffer
+  int32_t *half = (int32_t *) i2s_rx_buffer + (isrCount & 1)*i2sChan*N_SAMP;
+  for(int ii=0; ii<N_SAMP; ii++)
+    for(uint32_t ic=0; ic<i2sChan; ic++)
+      half[ii*i2sChan+ic] = (int32_t)(((uint32_t)rampValue(sampleCount+ii, ic) & 0xffffff) << 7);
+  sampleCount += N_SAMP;
+  isrCount++;
+  rxCount++;
+  rtcSet(simNow);
+  i2sInProcessing(0, half);
+  #ifdef TRIGGER
+    // stand-in for detector (see tools/esmdetect for the detector on real data)
+    if(cfg.events > 0 && simNow*1e-9 >= nextEvent)
+    { if(nextEvent > 0) { logger.trigger(); nevents++; }
+      nextEvent = simNow*1e-9 - log(1.0-uniform())*60.0/cfg.events;
+    }
+  #endif
+
+  uint32_t depth = logger.available();
+  if(depth > logger.queueSize) depth = logger.queueSize;
+  depthHist[depth]++;
+  if(depth > depthMax) depthMax = depth;
+}
+
+static void simAdvance(uint64_t dt)
+{ // let time pass, I2S interrupts preempt whatever runs
+  uint64_t tend = simNow + dt;
+  while(isrTime(isrCount+1) <= tend)
+  { simNow = isrTime(isrCount+1);
+    fireIsr();
+  }
+  simNow = tend;
+  rtcSet(simNow);
+}
+
+/*------------------------- fake card latency ----------------------*/
+struct spike_s { double toNext = -1; uint32_t count = 0; };
+static spike_s fsSpike, rawSpike;
+
+static double spikes(spike_s *sp, double perMB, uint32_t nbytes)
+{ // spikes at random byte positions (poisson with perMB per MB)
+  if(perMB <= 0) return 0;
+  if(sp->toNext < 0) sp->toNext = -log(1.0-uniform())*1048576.0/perMB;
+  double us = 0;
+  sp->toNext -= nbytes;
+  while(sp->toNext < 0)
+  { us += cfg.spike*1000.0*(0.5 + 0.5*uniform());
+    sp->count++;
+    sp->toNext += -log(1.0-uniform())*1048576.0/perMB;
+  }
+  return us;
+}
+
+static double sdBusy = 0;       // us
+static uint64_t sdBytes = 0;    // bytes written to card
+static uint32_t sdOps[SIM_REMOVE+1];
+
+void simSdOp(int op, uint32_t nbytes)
+{
+  double us;
+  switch(op)
+  { case SIM_WRITE:     us = cfg.overhead + nbytes/cfg.rate + spikes(&fsSpike, cfg.fsSpikes, nbytes); break;
+    case SIM_RAW_START: us = cfg.overhead; break;
+    case SIM_RAW_DATA:  us = nbytes/cfg.rate + spikes(&rawSpike, cfg.rawSpikes, nbytes); break;
+    case SIM_RAW_STOP:  us = 10; break;
+    default:            us = cfg.fileOp*1000.0; break;
+  }
+  sdOps[op]++;
+  sdBytes += nbytes;
+  sdBusy += us;
+  simAdvance((uint64_t)(us*1000.0));
+}
+
+/*------------------------- fake card files ------------------------*/
+static std::vector<FsFile *> extents;
+static uint32_t nextSector = 8192;
+static int nextFileId = 0;
+
+uint32_t simAllocate(FsFile *file, uint32_t nsect)
+{ uint32_t bgn = nextSector;
+  nextSector += nsect;
+  for(auto f: extents) if(f == file) return bgn;
+  extents.push_back(file);
+  return bgn;
+}
+
+FsFile *simFileAt(uint32_t sector)
+{ for(auto f: extents)
+    if(f->isOpen && sector >= f->bgn && sector < f->bgn+f->nsect) return f;
+  return 0;
+}
+
+void simFileOpened(FsFile *file) { file->id = nextFileId++; }
+
+void simHalt(const char *msg)
+{ fprintf(stderr,"esmsim: errorHalt: %s at %.3f s\n", msg, simNow*1e-9);
+  exit(1);
+}
+
+/*------------------------- file check -----------------------------*/
+struct closed_s { std::string name; std::vector<uint8_t> data; int removed; };
+static std::map<int, closed_s> closedFiles;
+static int nextCheckId = 0;
+
+static struct
+{ int nfiles = 0;
+  uint64_t nblocks = 0, ngaps = 0, ndropped = 0, nbad = 0, nrecords = 0;
+  uint64_t nidle = 0, nskipped = 0;
+  uint64_t expected = 0; int haveExpected = 0;
+  uint64_t nbytes = 0;
+  uint32_t nrate = 0; double rateErr = 0, timeErr = 0; // ppm, us
+} chk;
+
+#define SLOT(ic) (iChan+(ic)) // logged slots are contiguous (see acqConfig)
+
+static void checkBlock(const int32_t *buf, uint32_t nch, uint32_t nsamp)
+{ // compare logged samples with ramp
+  chk.nblocks++;
+  if(DECIMATE > 1) return;
+  int slot0 = SLOT(0);
+  if(!chk.haveExpected)
+  { chk.expected = (uint32_t)((buf[0] >> RAMP_SHIFT) - slot0*RAMP_STEP) & RAMP_MASK;
+    chk.haveExpected = 1;
+  }
+  int bad = 0;
+  for(uint32_t ii=0; ii<nsamp && !bad; ii++)
+    for(uint32_t ic=0; ic<nch; ic++)
+    { int slot = SLOT(ic);
+      if(buf[ii*nch+ic] != rampValue(chk.expected+ii, slot)) { bad = 1; break; }
+    }
+  if(bad)
+  { chk.nbad++;
+    if(cfg.verbose) printf("esmsim: bad block %llu\n", (unsigned long long)chk.nblocks);
+    chk.expected = (uint32_t)((buf[0] >> RAMP_SHIFT) - slot0*RAMP_STEP) & RAMP_MASK; // resync
+  }
+  chk.expected += nsamp;
+}
+
+static int checkRecord(const void *buf, closed_s *file)
+{
+  if(isGap(buf))
+  { const gap_s *gap = (const gap_s *) buf;
+    if(gap->cause == GAP_IDLE) { chk.nidle++; chk.nskipped += gap->ndrop; }
+    else { chk.ngaps++; chk.ndropped += gap->ndrop; }
+    chk.expected += (uint64_t) gap->ndrop*header.nsamp;
+    return 1;
+  }
+  if(isStat(buf))
+  { const stat_s *st = (const stat_s *) buf;
+    printf("  %-28s writes %5u latency mean %6u us max %7u us queue max %4u rotation %4u overrun %u\n",
+        file->name.c_str(), st->nwrite, st->nwrite? st->sumLatency/st->nwrite : 0, st->maxLatency,
+        st->queueMax, st->rotateDepth, st->overrun);
+    chk.nrecords++;
+    return 1;
+  }
+  if(isRate(buf))
+  { const rate_s *rt = (const rate_s *) buf;
+    printf("  %-28s rate %.4f Hz %8.3f ppm (%u stamps, rms %.1f us) drift %.3f ppm/h run %.4f ppm\n",
+        file->name.c_str(), rt->rate, rt->ppm, rt->npoint, rt->rms, rt->drift, rt->runPpm);
+    if(rt->npoint > 10)
+    { chk.nrate++;
+      if(fabs(rt->ppm - cfg.ppm) > chk.rateErr) chk.rateErr = fabs(rt->ppm - cfg.ppm);
+      if(DECIMATE == 1)
+      { // samples of logged block b arrive with interrupt isrStart+b+1
+        double t = 1500000000.0 + isrTime(isrStart + rt->block)*1e-9;
+        if(fabs(rt->tfirst - t)*1e6 > chk.timeErr) chk.timeErr = fabs(rt->tfirst - t)*1e6;
+      }
+    }
+    chk.nrecords++;
+    return 1;
+  }
+  if(isRecord(buf)) { chk.nrecords++; return 1; }
+  return 0;
+}
+
+static void checkFile(closed_s *file)
+{
+  if(file->removed) return;
+  chk.nfiles++;
+  chk.nbytes += file->data.size();
+  if(cfg.dir)
+  { std::string path = std::string(cfg.dir) + "/" + file->name;
+    FILE *fid = fopen(path.c_str(),"wb");
+    if(fid) { fwrite(file->data.data(),1,file->data.size(),fid); fclose(fid); }
+    else perror(path.c_str());
+  }
+  if(file->data.size() < sizeof(header_s)) { printf("  %s: no header\n", file->name.c_str()); return; }
+
+  header_s hdr;
+  memcpy(&hdr, file->data.data(), sizeof(hdr));
+  uint32_t nd = hdr.nch*hdr.nsamp;
+  std::vector<int32_t> buf(nd);
+  const uint8_t *ptr = file->data.data() + sizeof(hdr);
+  const uint8_t *end = file->data.data() + file->data.size();
+
+  if(hdr.fmt == FMT_RICE)
+  { while(ptr + sizeof(rice_frame_s) <= end)
+    { uint32_t nc = rice_decode(buf.data(), ptr, end-ptr, hdr.nsamp);
+      if(!nc) { printf("  %s: bad frame at %ld\n", file->name.c_str(), (long)(ptr-file->data.data())); break; }
+      if(!checkRecord(buf.data(), file)) checkBlock(buf.data(), hdr.nch, hdr.nsamp);
+      ptr += nc;
+    }
+    return;
+  }
+
+  uint32_t nb = blockBytes(&hdr);
+  for(; ptr + nb <= end; ptr += nb)
+  { if(checkRecord(ptr, file)) continue;
+    if(hdr.fmt == FMT_PACK24) unpack24(buf.data(), ptr, nd);
+    else if(hdr.fmt == FMT_INT16)
+      for(uint32_t ii=0; ii<nd; ii++) buf[ii] = (int32_t)((const int16_t *) ptr)[ii] << 8;
+    else memcpy(buf.data(), ptr, nb);
+    checkBlock(buf.data(), hdr.nch, hdr.nsamp);
+  }
+  if(ptr != end) printf("  %s: %ld bytes after last block\n", file->name.c_str(), (long)(end-ptr));
+}
+
+static std::map<std::string, std::vector<uint8_t>> auxFiles; // other than .bin, e.g. LTSA
+
+void simFileRestore(FsFile *file)
+{ auto it = auxFiles.find(file->name);
+  if(it != auxFiles.end()) file->data = it->second;
+}
+
+void simFileClosed(FsFile *file, int removed)
+{ if(file->name.size() < 4 || file->name.compare(file->name.size()-4, 4, ".bin"))
+  { // not a data file, keep for appending and report
+    auxFiles[file->name].swap(file->data);
+    file->data.clear();
+    closedFiles[file->id].removed = 1; // nothing to check
+    while(closedFiles.count(nextCheckId)) closedFiles.erase(nextCheckId++);
+    return;
+  } // files are checked in order of creation (previous file may be closed after next was opened)
+  closed_s &cf = closedFiles[file->id];
+  cf.name = file->name;
+  cf.data.swap(file->data);
+  cf.removed = removed;
+  file->data.clear();
+  while(closedFiles.count(nextCheckId))
+  { checkFile(&closedFiles[nextCheckId]);
+    closedFiles.erase(nextCheckId++);
+  }
+}
+
+/*------------------------- teensy stubs ---------------------------*/
+usb_serial_class Serial;
+int usb_serial_class::printf(const char *fmt, ...)
+{ if(!cfg.verbose) return 0;
+  va_list ap; va_start(ap, fmt);
+  int n = vprintf(fmt, ap);
+  va_end(ap);
+  return n;
+}
+void usb_serial_class::print(const char *txt) { if(cfg.verbose) fputs(txt, stdout); }
+void usb_serial_class::println(const char *txt) { if(cfg.verbose) puts(txt); }
+void usb_serial_class::println(int val) { if(cfg.verbose) ::printf("%d\n", val); }
+
+void (* _VectorsRam[256])(void);
+extern "C" { volatile uint32_t systick_millis_count = 0; volatile uint32_t rxCount = 0; }
+volatile uint32_t RTC_TSR = 1500000000u, RTC_TPR = 0, RTC_SR = 0, FTFL_FSTAT = FTFL_FSTAT_CCIF;
+volatile uint8_t FTFL_FCCOB0, FTFL_FCCOB1, FTFL_FCCOB4, FTFL_FCCOB5, FTFL_FCCOB6, FTFL_FCCOB7;
+void (*FsDateTime::callback)(uint16_t *date, uint16_t *time);
+volatile uint32_t ARM_DEMCR = 0, ARM_DWT_CTRL = 0;
+uint32_t simCycles(void) { return (uint32_t)(simNow*(F_CPU/1000000)/1000); }
+
+void pinMode(int pin, int mode) {;}
+void digitalWrite(int pin, int val) {;}
+void digitalWriteFast(int pin, int val) {;}
+int digitalReadFast(int pin) { return HIGH; }
+void delay(uint32_t msec) { simAdvance((uint64_t)msec*1000000ull); }
+uint32_t millis(void) { return (uint32_t)(simNow/1000000ull); }
+uint32_t micros(void) { return (uint32_t)(simNow/1000ull); }
+extern "C" void hibernate(uint32_t nsec) {;}
+
+uint32_t c_ICS43432::init(int32_t fsamp, int32_t *buffer, uint32_t nbuf, uint16_t nch) { fs = fsamp; ppm = 0; return fsamp; }
+void c_ICS43432::start(void) {;}
+void c_ICS43432::stop(void) {;}
+void c_ICS43432::exit(void) {;}
+
+/*------------------------- main -----------------------------------*/
+static uint32_t percentile(double p)
+{ uint64_t n = 0;
+  for(auto h: depthHist) n += h;
+  uint64_t m = 0;
+  for(uint32_t ii=0; ii<depthHist.size(); ii++) { m += depthHist[ii]; if(m >= p*n) return ii; }
+  return logger.queueSize;
+}
+
+int main(int argc, char *argv[])
+{
+  int opt;
+  while((opt = getopt(argc, argv, "t:r:o:p:q:s:a:l:x:e:f:c:n:w:k:d:v")) != -1)
+  { switch(opt)
+    { case 't': cfg.tsim = atof(optarg); break;
+      case 'r': cfg.rate = atof(optarg); break;
+      case 'o': cfg.overhead = atof(optarg); break;
+      case 'p': cfg.fsSpikes = atof(optarg); break;
+      case 'q': cfg.rawSpikes = atof(optarg); break;
+      case 's': cfg.spike = atof(optarg); break;
+      case 'a': cfg.fileOp = atof(optarg); break;
+      case 'l': cfg.loopCost = atof(optarg); break;
+      case 'x': cfg.seed = atoi(optarg); break;
+      case 'e': cfg.events = atof(optarg); break;
+      case 'f': acq.fsamp = atoi(optarg); break;
+      case 'c': acq.chanMask = strtol(optarg, 0, 0); break;
+      case 'n': acq.nq = atoi(optarg); break;
+      case 'w': acq.naud = atoi(optarg); break;
+      case 'k': cfg.ppm = atof(optarg); break;
+      case 'd': cfg.dir = optarg; break;
+      case 'v': cfg.verbose = 1; break;
+      default: fprintf(stderr,"usage: esmsim [-t sec] [-r MB/s] [-o us] [-p n] [-q n] [-s ms] [-a ms] [-l us] [-x seed] [-e n]\n"
+                       "              [-f Hz] [-c mask] [-n nq] [-w naud] [-k ppm] [-d dir] [-v]\n");
+               return 1;
+    }
+  }
+  rng.seed(cfg.seed);
+
+  // as in setup()
+  logger.init();
+  if(!acqConfig()) { fprintf(stderr,"esmsim: acquisition configuration not supported\n"); return 1; }
+  depthHist.assign(logger.queueSize+1, 0);
+  loggerSetup(nChan, acq.fsamp, N_SAMP);
+  acqSetup();
+  acqStart();
+  delay(300); // allow acq to settle down
+  isrStart = isrCount;
+  loggerStart();
+
+  // as in loop()
+  uint64_t t0 = simNow;
+  uint64_t tend = simNow + (uint64_t)(cfg.tsim*1e9);
+  while(simNow < tend)
+  { if((int16_t) loggerLoop() <= 0) break;
+    simAdvance((uint64_t)(cfg.loopCost*1000.0));
+  }
+  uint32_t dropStop = i2sWriteErrorCount;
+  loggerStop(1);
+  while((int16_t) loggerLoop() > 0) simAdvance((uint64_t)(cfg.loopCost*1000.0));
+  acqStop();
+  double tlog = (simNow-t0)*1e-9;
+
+  uint32_t blockBytesIn = logger.blockSize;
+  printf("# fsamp %d mask 0x%x (%d of %d ch) DECIMATE %d fmt %d nq %d naud %d: block %u bytes, write %u bytes, queue %u kB of %d kB arena",
+      acq.fsamp, acq.chanMask, nChan, i2sChan, DECIMATE, LOG_FMT, logger.queueSize, logger.chunkBlocks,
+      blockBytesIn, logger.maxBlockSize, (unsigned)(logger.queueSize*blockBytesIn/1024), ARENA_KB);
+  #ifdef RAW_WRITE
+    printf(", raw write");
+  #endif
+  printf("\n# card: %.1f MB/s, overhead %.0f us, spikes %.2f/%.2f per MB up to %.0f ms, file op %.0f ms\n",
+      cfg.rate, cfg.overhead, cfg.fsSpikes, cfg.rawSpikes, cfg.spike, cfg.fileOp);
+  printf("# simulated %.1f s, %llu interrupts, input %.3f MB/s\n",
+      tlog, (unsigned long long)isrCount, blockBytesIn*(double)acq.fsamp/N_SAMP/DECIMATE/1048576.0);
+  printf("# written %.2f MB in %d files, throughput %.3f MB/s, card busy %.1f %%, spikes %u/%u\n",
+      chk.nbytes/1048576.0, chk.nfiles, chk.nbytes/1048576.0/tlog, 100.0*sdBusy*1e-6/tlog,
+      fsSpike.count, rawSpike.count);
+  printf("# queue depth (blocks): median %u  99%% %u  99.9%% %u  max %u of %d\n",
+      percentile(0.5), percentile(0.99), percentile(0.999), depthMax, logger.queueSize);
+  printf("# dropped blocks %u (%.3f %%) + %u after stop, gaps %llu announcing %llu blocks\n",
+      dropStop, 100.0*dropStop/(isrCount? isrCount : 1), i2sWriteErrorCount-dropStop,
+      (unsigned long long)chk.ngaps, (unsigned long long)chk.ndropped);
+  for(auto &aux: auxFiles)
+  { printf("# %s: %zu bytes\n", aux.first.c_str(), aux.second.size());
+    if(cfg.dir)
+    { std::string path = std::string(cfg.dir) + "/" + aux.first;
+      FILE *fid = fopen(path.c_str(),"wb");
+      if(fid) { fwrite(aux.second.data(),1,aux.second.size(),fid); fclose(fid); }
+    }
+  }
+  #ifdef TRIGGER
+    printf("# trigger: %u detections, %llu idle gaps, %llu blocks not written (%.1f %%)\n",
+        nevents, (unsigned long long)chk.nidle, (unsigned long long)chk.nskipped,
+        100.0*chk.nskipped/(chk.nskipped+chk.nblocks? chk.nskipped+chk.nblocks : 1));
+  #endif
+  printf("# rate: %u files measured, largest error %.4f ppm, %.1f us of first sample (I2S clock %+.3f ppm)\n",
+      chk.nrate, chk.rateErr, chk.timeErr, cfg.ppm);
+  printf("# check: %llu blocks, %llu records, %llu bad blocks%s\n",
+      (unsigned long long)chk.nblocks, (unsigned long long)chk.nrecords, (unsigned long long)chk.nbad,
+      (DECIMATE > 1)? " (samples not checked with DECIMATE)" : "");
+  return chk.nbad? 2 : 0;
+}
@@ -0,0 +1,138 @@
+// SdFs.h (host simulation)
+// fake uSD card and file system below c_mFS
+// files are kept in memory; each operation asks the simulation for its latency
+// (simSdOp), which advances the simulated clock and so lets the I2S ISR run
+// closed files are handed to the simulation for checking (simFileClosed)
+// the length in the directory entry is kept apart from the sectors, as on the card:
+// raw sectors (SdCard::writeData) do not change it, seekSet() past it fails, and a
+// closed file ends there; preAllocate() sets it to the allocated size (FAT), with
+// -DSIM_EXFAT it stays 0 (exFAT valid length), so mfs.h does not use raw writes
+// to model a different storage, replace simSdOp() in esmsim.cpp
+//
+#ifndef SDFS_H
+#define SDFS_H
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#define O_RDONLY 0x00
+#define O_WRITE  0x01
+#define O_RDWR   0x02
+#define O_CREAT  0x40
+#define O_TRUNC  0x200
+#define O_APPEND 0x400
+
+#define FIFO_SDIO 0
+#define DMA_SDIO  1
+struct SdioConfig { int mode; SdioConfig(int m) : mode(m) {;} };
+
+#define FS_DATE(y,m,d) ((((y)-1980)<<9) | ((m)<<5) | (d))
+#define FS_TIME(h,m,s) (((h)<<11) | ((m)<<5) | ((s)>>1))
+struct FsDateTime { static void (*callback)(uint16_t *date, uint16_t *time); };
+
+// operations with latency
+enum { SIM_OPEN, SIM_PREALLOC, SIM_WRITE, SIM_RAW_START, SIM_RAW_DATA, SIM_RAW_STOP,
+       SIM_TRUNCATE, SIM_CLOSE, SIM_REMOVE };
+
+class FsFile;
+void simSdOp(int op, uint32_t nbytes);
+uint32_t simAllocate(FsFile *file, uint32_t nsect); // returns first sector
+FsFile *simFileAt(uint32_t sector);
+void simFileOpened(FsFile *file);
+void simFileRestore(FsFile *file); // content of earlier file of same name (O_APPEND)
+void simFileClosed(FsFile *file, int removed);
+void simHalt(const char *msg);
+
+class FsFile
+{
+public:
+  std::string name;
+  std::vector<uint8_t> data;   // sectors of the file
+  uint64_t length = 0;         // length in directory entry
+  uint64_t pos = 0;
+  uint32_t bgn = 0, nsect = 0; // contiguous extent
+  int id = -1;                 // order of creation
+  bool isOpen = false;
+
+  bool open(const char *filename, int flags)
+  { if(!(flags & O_CREAT)) return false; // there are no files on the fake card
+    name = filename; data.clear(); length = pos = 0; bgn = nsect = 0; isOpen = true;
+    simSdOp(SIM_OPEN, 0);
+    simFileOpened(this);
+    if(flags & O_APPEND) { simFileRestore(this); pos = length = data.size(); }
+    return true;
+  }
+  bool preAllocate(uint64_t nbytes)
+  { nsect = (uint32_t)((nbytes+511)/512);
+    bgn = simAllocate(this, nsect);
+#ifndef SIM_EXFAT
+    length = nbytes; // FAT: file size, exFAT: data length only
+#endif
+    simSdOp(SIM_PREALLOC, 0);
+    return true;
+  }
+  bool contiguousRange(uint32_t *bgnSector, uint32_t *endSector)
+  { if(!nsect) return false;
+    *bgnSector = bgn; *endSector = bgn+nsect-1;
+    return true;
+  }
+  size_t write(const void *buf, size_t nbyte)
+  { if(pos+nbyte > data.size()) data.resize(pos+nbyte);
+    memcpy(&data[pos], buf, nbyte);
+    pos += nbyte;
+    if(pos > length) length = pos;
+    simSdOp(SIM_WRITE, nbyte);
+    return nbyte;
+  }
+  int read(void *buf, size_t nbyte) { return -1; }
+  uint64_t fileSize(void) { return length; }
+  bool seekSet(uint64_t p) { if(p > length) return false; pos = p; return true; }
+  bool truncate(void) { data.resize(pos); length = pos; simSdOp(SIM_TRUNCATE, 0); return true; }
+  bool sync(void) { return true; }
+  bool close(void)
+  { if(!isOpen) return false;
+    isOpen = false; simSdOp(SIM_CLOSE, 0);
+    data.resize(length); // what a reader of the card gets
+    simFileClosed(this, 0);
+    return true;
+  }
+  bool remove(void)
+  { if(!isOpen) return false;
+    isOpen = false; simSdOp(SIM_REMOVE, 0); simFileClosed(this, 1);
+    return true;
+  }
+  // sector written by SdCard (length is not changed)
+  void putSector(uint32_t sector, const uint8_t *src)
+  { uint64_t off = (uint64_t)(sector-bgn)*512;
+    if(off+512 > data.size()) data.resize(off+512);
+    memcpy(&data[off], src, 512);
+  }
+};
+
+class SdCard
+{
+  uint32_t sector = 0;
+public:
+  bool writeStart(uint32_t s) { sector = s; simSdOp(SIM_RAW_START, 0); return true; }
+  bool writeData(const uint8_t *src)
+  { FsFile *file = simFileAt(sector);
+    if(!file) return false;
+    file->putSector(sector++, src);
+    simSdOp(SIM_RAW_DATA, 512);
+    return true;
+  }
+  bool writeStop(void) { simSdOp(SIM_RAW_STOP, 0); return true; }
+};
+
+class SdFs
+{
+  SdCard sdCard;
+public:
+  bool begin(SdioConfig config) { return true; }
+  SdCard *card(void) { return &sdCard; }
+  void errorHalt(const char *msg) { simHalt(msg); }
+};
+
+#endif
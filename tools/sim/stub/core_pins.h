@@ -0,0 +1,31 @@
+// core_pins.h (host simulation)
+// replaces teensy core functions used by the firmware, implemented in esmsim.cpp
+#ifndef CORE_PINS_H
+#define CORE_PINS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define LOW 0
+#define HIGH 1
+
+void pinMode(int pin, int mode);
+void digitalWrite(int pin, int val);
+void digitalWriteFast(int pin, int val);
+int digitalReadFast(int pin);
+void delay(uint32_t msec);
+uint32_t millis(void);
+uint32_t micros(void);
+extern "C" void yield(void);
+extern void (* _VectorsRam[])(void);
+
+#define __disable_irq()
+#define __enable_irq()
+#define NVIC_SET_PRIORITY(irq,prio)
+
+#endif
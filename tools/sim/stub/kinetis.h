@@ -0,0 +1,24 @@
+// kinetis.h (host simulation)
+// registers used by the firmware are plain variables (defined in esmsim.cpp)
+// the DWT cycle counter (block index stamps) counts simulated time at F_CPU;
+// SIM_HOST tells profile.h to measure with the host clock instead
+#ifndef KINETIS_H
+#define KINETIS_H
+
+#include <stdint.h>
+
+extern volatile uint32_t RTC_TSR, RTC_TPR, RTC_SR;
+#define RTC_SR_TCE 0x10
+
+extern volatile uint32_t FTFL_FSTAT;
+extern volatile uint8_t FTFL_FCCOB0, FTFL_FCCOB1, FTFL_FCCOB4, FTFL_FCCOB5, FTFL_FCCOB6, FTFL_FCCOB7;
+#define FTFL_FSTAT_CCIF 0x80
+
+#define SIM_HOST
+extern volatile uint32_t ARM_DEMCR, ARM_DWT_CTRL;
+#define ARM_DEMCR_TRCENA       (1<<24)
+#define ARM_DWT_CTRL_CYCCNTENA (1<<0)
+uint32_t simCycles(void);
+#define ARM_DWT_CYCCNT simCycles()
+
+#endif
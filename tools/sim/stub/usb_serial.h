@@ -0,0 +1,26 @@
+// usb_serial.h (host simulation)
+// Serial output goes to stdout when the simulation is verbose
+#ifndef USB_SERIAL_H
+#define USB_SERIAL_H
+
+#include "core_pins.h"
+#include "kinetis.h"
+
+class usb_serial_class
+{
+public:
+  void begin(long baud) {;}
+  int available(void) { return 0; }
+  int read(void) { return -1; }
+  long parseInt(void) { return 0; }
+  void flush(void) {;}
+  operator bool() { return true; }
+  int printf(const char *fmt, ...) __attribute__((format(printf,2,3)));
+  void print(const char *txt);
+  void println(const char *txt="");
+  void println(int val);
+  void write(const uint8_t *buf, int n) {;}
+};
+extern usb_serial_class Serial;
+
+#endif
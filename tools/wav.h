@@ -0,0 +1,51 @@
+// Copyright 2017 by Walter Zimmer
+//
+// wav.h
+// WAV output for the host tools: header and little endian sample packing
+// WAVE_FORMAT_EXTENSIBLE is used for more than 2 channels or more than 16 bits
+//
+#ifndef WAV_H
+#define WAV_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define WAV_HEADER_MAX 68
+
+// writes header for nsamp samples per channel, returns header size
+static inline uint32_t wav_header(uint8_t *hdr, uint32_t nch, uint32_t fs, uint32_t bits, uint64_t nsamp)
+{ uint32_t bps = bits/8;
+  int ext = (nch > 2) || (bps > 2);
+  uint32_t fmtSize = ext? 40 : 16;
+  uint64_t nbytes = nsamp*nch*bps;
+  uint8_t *p = hdr;
+  auto put16 = [&p](uint32_t v) { *p++ = v; *p++ = v >> 8; };
+  auto put32 = [&](uint32_t v) { put16(v); put16(v >> 16); };
+  memcpy(p, "RIFF", 4); p += 4; put32((uint32_t)(4 + 8 + fmtSize + 8 + nbytes));
+  memcpy(p, "WAVEfmt ", 8); p += 8; put32(fmtSize);
+  put16(ext? 0xFFFE : 1); put16(nch); put32(fs); put32(fs*nch*bps);
+  put16(nch*bps); put16(bits);
+  if(ext)
+  { static const uint8_t pcm[16] = {1,0,0,0, 0,0,0x10,0, 0x80,0,0,0xaa,0,0x38,0x9b,0x71};
+    put16(22); put16(bits); put32(0); memcpy(p, pcm, 16); p += 16;
+  }
+  memcpy(p, "data", 4); p += 4; put32((uint32_t) nbytes);
+  return p - hdr;
+}
+
+// largest data size a WAV header can describe
+static inline int wav_fits(uint32_t nch, uint32_t bits, uint64_t nsamp)
+{ return WAV_HEADER_MAX + nsamp*nch*(bits/8) <= 0xffffffffull;
+}
+
+// n samples (already scaled to bits) into little endian bytes, returns end of dst
+static inline uint8_t *wav_pack(uint8_t *dst, const int32_t *src, size_t n, uint32_t bits)
+{ uint32_t bps = bits/8;
+  for(size_t ii=0; ii<n; ii++)
+  { uint32_t u = (uint32_t) src[ii];
+    for(uint32_t b=0; b<bps; b++) { *dst++ = u; u >>= 8; }
+  }
+  return dst;
+}
+
+#endif